@@ -21,10 +21,12 @@ freely, subject to the following restrictions:
 #pragma once
 
 #include "xmlreg.h"
+#include "registry.h"
 
 #include <map>
+#include <algorithm>
 #include <string>
-#include <iostream>
+#include <vector>
 
 #include <windows.h>
 
@@ -33,19 +35,75 @@ class arguments
 	bool import = false;
 	bool exprt = false;
 	bool wipe = false;
+	bool batch = false;
+	bool serve = false;
+	bool rollback = false;
+	bool verify = false;
+	bool copy = false;
+	bool first_mismatch = false;
 	bool unattended = false;
 	bool skip_err = false;
+	bool dry_run = false;
+	bool stats = false;
+	bool progress = false;
+	bool resume = false;
+	bool force_resume = false;
+	bool hex_numbers = false;
+	bool quiet = false;
+	bool verbose = false;
+	bool log_json = false;
 	int error_code = 0;
+	// written once the logging switches are applied
+	std::vector<std::wstring> warnings;
 
 	std::wstring file;
 	std::wstring program_path;
 	std::wstring com_dll;
+	std::wstring trace_file;
+	std::wstring format;
+	std::wstring wine_file;
+	std::wstring journal_file;
+	std::wstring undo_file;
+	unsigned trace_depth = 8;
 
 	HKEY input_hive = HKEY_CURRENT_USER, output_hive = HKEY_CURRENT_USER;
 	REGSAM input_redirection = 0, output_redirection = 0;
 	std::wstring input_key, output_key;
 
 	std::map<std::wstring, std::wstring> matches;
+	// --include and --exclude can be repeated
+	std::vector<std::wstring> includes, excludes;
+	std::vector<unsigned long> value_types;
+
+	// a comma separated list of the type names used in the xml
+	bool parseValueTypes(const std::wstring& list)
+	{
+		size_t start = 0;
+		while (start <= list.length())
+		{
+			size_t end = list.find(L',', start);
+			if (end == std::wstring::npos) end = list.length();
+			std::wstring name = list.substr(start, end - start);
+			start = end + 1;
+			if (name.length() == 0) continue;
+
+			DWORD type = xrutils::stringToPropType(name);
+			if (xrutils::propTypeToString(type) != name) return false;
+			value_types.push_back(type);
+		}
+		return true;
+	}
+
+	// HKLM\Software\Vendor for --copy, false if the path does not start with a hive
+	static bool parseKeyPath(const std::wstring& path, HKEY& hive, std::wstring& key)
+	{
+		hive = winreg::splitHiveFromKey(path, key);
+		std::wstring name = path.substr(0, path.find_first_of(L'\\'));
+		std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+		if (name.length() > 0 && name.back() == L':') name.pop_back();
+		// anything that is not a hive name comes back as HKCU
+		return hive != HKEY_CURRENT_USER || name == L"HKCU" || name == L"HKEY_CURRENT_USER";
+	}
 
 public:
 	arguments(int argc, wchar_t* argv[])
@@ -83,6 +141,57 @@ public:
 					tokens[L"skip-errors"] = L"true";
 					current_switch = L"";
 				}
+				else if (current_switch == L"-st" || current_switch == L"--stats")
+				{
+					tokens[L"stats"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-pg" || current_switch == L"--progress")
+				{
+					tokens[L"progress"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-fm" || current_switch == L"--first-mismatch")
+				{
+					tokens[L"first-mismatch"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-rs" || current_switch == L"--resume")
+				{
+					tokens[L"resume"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-fr" || current_switch == L"--force-resume")
+				{
+					tokens[L"resume"] = L"true";
+					tokens[L"force-resume"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-dr" || current_switch == L"--dry-run")
+				{
+					tokens[L"dry-run"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-hx" || current_switch == L"--hex")
+				{
+					tokens[L"hex"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-q" || current_switch == L"--quiet")
+				{
+					tokens[L"quiet"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-v" || current_switch == L"--verbose")
+				{
+					tokens[L"verbose"] = L"true";
+					current_switch = L"";
+				}
+				else if (current_switch == L"-lj" || current_switch == L"--log-json")
+				{
+					tokens[L"log-json"] = L"true";
+					current_switch = L"";
+				}
 			}
 			else
 			{
@@ -92,6 +201,23 @@ public:
 					tokens[L"export"] = token;
 				else if (current_switch == L"-w" || current_switch == L"--wipe")
 					tokens[L"wipe"] = token;
+				else if (current_switch == L"-b" || current_switch == L"--batch")
+					tokens[L"batch"] = token;
+				else if (current_switch == L"-sv" || current_switch == L"--serve")
+					tokens[L"serve"] = token;
+				else if (current_switch == L"-rb" || current_switch == L"--rollback")
+					tokens[L"rollback"] = token;
+				else if (current_switch == L"-vf" || current_switch == L"--verify")
+					tokens[L"verify"] = token;
+				else if (current_switch == L"-cp" || current_switch == L"--copy")
+				{
+					// the next token is the target, whatever it starts with
+					tokens[L"copy"] = token;
+					current_switch = L" copy-target";
+					continue;
+				}
+				else if (current_switch == L" copy-target")
+					tokens[L"copy-target"] = token;
 				else if (current_switch == L"-h" || current_switch == L"--hive")
 					tokens[L"hive"] = token;
 				else if (current_switch == L"-k" || current_switch == L"--key")
@@ -110,8 +236,32 @@ public:
 					tokens[L"output-key"] = token;
 				else if (current_switch == L"-or" || current_switch == L"--output-redirection")
 					tokens[L"output-redirection"] = token;
+				else if (current_switch == L"-f" || current_switch == L"--format")
+					tokens[L"format"] = token;
+				else if (current_switch == L"-wn" || current_switch == L"--wine")
+					tokens[L"wine"] = token;
+				else if (current_switch == L"-jr" || current_switch == L"--journal")
+					tokens[L"journal"] = token;
+				else if (current_switch == L"-ul" || current_switch == L"--undo-log")
+					tokens[L"undo-log"] = token;
+				else if (current_switch == L"-tr" || current_switch == L"--trace")
+					tokens[L"trace"] = token;
+				else if (current_switch == L"-td" || current_switch == L"--trace-depth")
+					tokens[L"trace-depth"] = token;
 				else if (current_switch == L"-cd" || current_switch == L"--com-dll")
 					tokens[L"com-dll"] = token;
+				else if (current_switch == L"-in" || current_switch == L"--include")
+					includes.push_back(token);
+				else if (current_switch == L"-ex" || current_switch == L"--exclude")
+					excludes.push_back(token);
+				else if (current_switch == L"-vt" || current_switch == L"--value-types")
+				{
+					if (!parseValueTypes(token))
+					{
+						error_code = ERROR_XRUSAGE_VALUE_TYPE;
+						return;
+					}
+				}
 				else if (current_switch == L"-m" || current_switch == L"--match")
 					current_match = token;
 				else if (current_switch == L"-rp" || current_switch == L"--replace")
@@ -131,16 +281,32 @@ public:
 
 		skip_err = tokens.find(L"skip-errors") != tokens.end();
 		unattended = tokens.find(L"unattended") != tokens.end();
+		dry_run = tokens.find(L"dry-run") != tokens.end();
+		stats = tokens.find(L"stats") != tokens.end();
+		progress = tokens.find(L"progress") != tokens.end();
+		resume = tokens.find(L"resume") != tokens.end();
+		force_resume = tokens.find(L"force-resume") != tokens.end();
+		first_mismatch = tokens.find(L"first-mismatch") != tokens.end();
+		hex_numbers = tokens.find(L"hex") != tokens.end();
+		quiet = tokens.find(L"quiet") != tokens.end();
+		verbose = tokens.find(L"verbose") != tokens.end();
+		log_json = tokens.find(L"log-json") != tokens.end();
 
 		bool hasImport = tokens.find(L"import") != tokens.end();
 		bool hasExport = tokens.find(L"export") != tokens.end();
 		bool hasWipe = tokens.find(L"wipe") != tokens.end();
-		if ((hasImport && hasExport) || (hasImport && hasWipe) || (hasExport && hasWipe))
+		bool hasBatch = tokens.find(L"batch") != tokens.end();
+		bool hasServe = tokens.find(L"serve") != tokens.end();
+		bool hasRollback = tokens.find(L"rollback") != tokens.end();
+		bool hasVerify = tokens.find(L"verify") != tokens.end();
+		bool hasCopy = tokens.find(L"copy") != tokens.end();
+		if ((int)hasImport + (int)hasExport + (int)hasWipe + (int)hasBatch + (int)hasServe + (int)hasRollback + (int)hasVerify
+			+ (int)hasCopy > 1)
 		{
 			error_code = ERROR_XRUSAGE_IMPORT_AND_EXPORT_AND_WIPE;
 			return;
 		}
-		if (!hasImport && !hasExport && !hasWipe)
+		if (!hasImport && !hasExport && !hasWipe && !hasBatch && !hasServe && !hasRollback && !hasVerify && !hasCopy)
 		{
 			error_code = ERROR_XRUSAGE_NOIMPORT_AND_NOEXPORT_AND_NOWIPE;
 			return;
@@ -149,6 +315,11 @@ public:
 		if (hasImport) file = tokens[L"import"];
 		else if (hasExport) file = tokens[L"export"];
 		else if (hasWipe) file = tokens[L"wipe"];
+		else if (hasBatch) file = tokens[L"batch"];
+		else if (hasServe) file = tokens[L"serve"];
+		else if (hasRollback) file = tokens[L"rollback"];
+		else if (hasVerify) file = tokens[L"verify"];
+		else if (hasCopy) file = tokens[L"copy"];
 
 		if (file.length() == 0) error_code = ERROR_XRUSAGE_NO_FILE;
 
@@ -167,10 +338,42 @@ public:
 		import = hasImport;
 		exprt = hasExport;
 		wipe = hasWipe;
+		batch = hasBatch;
+		serve = hasServe;
+		rollback = hasRollback;
+		verify = hasVerify;
+		copy = hasCopy;
+
+		if (tokens.find(L"format") != tokens.end())
+			format = tokens[L"format"];
+		if (tokens.find(L"wine") != tokens.end())
+			wine_file = tokens[L"wine"];
+		if (tokens.find(L"journal") != tokens.end())
+			journal_file = tokens[L"journal"];
+		if (tokens.find(L"undo-log") != tokens.end())
+			undo_file = tokens[L"undo-log"];
+		if (tokens.find(L"trace") != tokens.end())
+			trace_file = tokens[L"trace"];
+		if (tokens.find(L"trace-depth") != tokens.end())
+			trace_depth = (unsigned)_wtoi(tokens[L"trace-depth"].c_str());
 
 		if (tokens.find(L"com-dll") != tokens.end())
 			com_dll = tokens[L"com-dll"];
 
+		if (resume && journal_file.length() == 0)
+		{
+			error_code = ERROR_XRUSAGE_RESUME_WITHOUT_JOURNAL;
+			return;
+		}
+		if (journal_file.length() > 0 && !import)
+			warnings.push_back(L"ignoring --journal, it only applies to --import");
+		else if (journal_file.length() > 0 && wine_file.length() > 0)
+			warnings.push_back(L"ignoring --journal, a wine registry file is only written once the whole import succeeded");
+		if (undo_file.length() > 0 && !import)
+			warnings.push_back(L"ignoring --undo-log, it only applies to --import");
+		else if (undo_file.length() > 0 && wine_file.length() > 0)
+			warnings.push_back(L"ignoring --undo-log, keep a copy of the wine registry file instead");
+
 		if (exprt && !hasHive)
 		{
 			if (!hasInHive)
@@ -186,13 +389,13 @@ public:
 		}
 
 		if (hasHive && hasInHive && hasOutHive)
-			std::wcout << "warning: ignoring --hive because --input-hive and --output-hive were used" << std::endl;
+			warnings.push_back(L"ignoring --hive because --input-hive and --output-hive were used");
 
 		if (hasKey && hasInKey && hasOutKey)
-			std::wcout << "warning: ignoring --key because --input-key and --output-key were used" << std::endl;
+			warnings.push_back(L"ignoring --key because --input-key and --output-key were used");
 
 		if (hasRedir && hasInRedir && hasOutRedir)
-			std::wcout << "warning: ignoring --redirection because --input-redirection and --output-redirection were used" << std::endl;
+			warnings.push_back(L"ignoring --redirection because --input-redirection and --output-redirection were used");
 
 		if (hasInHive) input_hive = xrutils::stringToHive(tokens[L"input-hive"]);
 		else if (hasHive) input_hive = xrutils::stringToHive(tokens[L"hive"]);
@@ -211,14 +414,34 @@ public:
 
 		if (hasOutRedir) output_redirection = xrutils::stringToRedirection(tokens[L"output-redirection"]);
 		else if (hasRedir) output_redirection = xrutils::stringToRedirection(tokens[L"redirection"]);
+
+		if (copy)
+		{
+			if (hasHive || hasKey || hasInHive || hasInKey || hasOutHive || hasOutKey)
+				warnings.push_back(L"ignoring --hive and --key options, --copy names both keys");
+			if (!parseKeyPath(file, input_hive, input_key) || !parseKeyPath(tokens[L"copy-target"], output_hive, output_key))
+				error_code = ERROR_XRUSAGE_COPY_KEYS;
+		}
 	}
 
 	bool isExport() { return exprt; }
 	bool isImport() { return import; }
 	bool isWipe() { return wipe; }
+	bool isBatch() { return batch; }
+	bool isServe() { return serve; }
+	bool isRollback() { return rollback; }
+	bool isVerify() { return verify; }
+	bool isCopy() { return copy; }
 
 	std::wstring getFile() { return file; }
 	std::wstring getComDll() { return com_dll; }
+	std::wstring getFormat() { return format; }
+	std::wstring getWineFile() { return wine_file; }
+	std::wstring getJournalFile() { return journal_file; }
+	std::wstring getUndoFile() { return undo_file; }
+	bool getResume() { return resume; }
+	bool getForceResume() { return force_resume; }
+	bool getFirstMismatch() { return first_mismatch; }
 
 	HKEY getInputHive() { return input_hive; }
 	std::wstring getInputKey() { return input_key; }
@@ -230,8 +453,21 @@ public:
 
 	bool getUnattended() { return unattended; }
 	bool getSkipErrors() { return skip_err; }
+	bool getDryRun() { return dry_run; }
+	bool getStats() { return stats; }
+	bool getProgress() { return progress; }
+	bool getHexNumbers() { return hex_numbers; }
+	bool getQuiet() { return quiet; }
+	bool getVerbose() { return verbose; }
+	bool getLogJson() { return log_json; }
+	std::vector<std::wstring> getWarnings() { return warnings; }
+	std::wstring getTraceFile() { return trace_file; }
+	unsigned getTraceDepth() { return trace_depth; }
 
 	std::map<std::wstring, std::wstring> getReplacements() { return matches; }
+	std::vector<std::wstring> getIncludes() { return includes; }
+	std::vector<std::wstring> getExcludes() { return excludes; }
+	std::vector<unsigned long> getValueTypes() { return value_types; }
 
 	int getError()
 	{
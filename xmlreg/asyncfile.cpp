@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "asyncfile.h"
+#include "gzip.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace asyncfile {
+
+	// large enough for the disk to see long sequential writes
+	static const size_t buffer_size = 1 << 20;
+
+	writer::~writer()
+	{
+		close();
+	}
+
+	bool writer::open(const wstring& path, bool compress)
+	{
+		file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+
+		this->compress = compress;
+		filling.reserve(buffer_size);
+		pending.reserve(buffer_size);
+		worker = thread(&writer::writeLoop, this);
+		return true;
+	}
+
+	bool writer::writeAll(const string& data)
+	{
+		xrstats::timer t(xrstats::PHASE_WRITE);
+		size_t done = 0;
+		while (done < data.size())
+		{
+			DWORD written = 0;
+			DWORD size = (DWORD)min(data.size() - done, (size_t)1 << 30);
+			if (!WriteFile(file, data.data() + done, size, &written, nullptr) || written == 0) return false;
+			done += written;
+		}
+		return true;
+	}
+
+	void writer::writeLoop()
+	{
+		gzip::deflater deflater;
+		unique_lock<mutex> guard(lock);
+		while (true)
+		{
+			changed.wait(guard, [this] { return has_pending || finishing; });
+			if (has_pending)
+			{
+				guard.unlock();
+				bool ok;
+				if (compress)
+				{
+					{
+						xrstats::timer t(xrstats::PHASE_COMPRESSION);
+						deflater.block(pending);
+					}
+					ok = writeAll(deflater.out);
+					deflater.out.clear();
+				}
+				else ok = writeAll(pending);
+				guard.lock();
+
+				if (!ok) failed = true;
+				has_pending = false;
+				changed.notify_all();
+				continue;
+			}
+
+			if (compress)
+			{
+				deflater.finish();
+				if (!writeAll(deflater.out)) failed = true;
+			}
+			return;
+		}
+	}
+
+	// waits for the thread to take the previous buffer, then gives it the current one
+	void writer::handOver()
+	{
+		unique_lock<mutex> guard(lock);
+		changed.wait(guard, [this] { return !has_pending; });
+		pending.swap(filling);
+		has_pending = true;
+		changed.notify_all();
+		guard.unlock();
+		filling.clear();
+	}
+
+	void writer::write(const void* data, size_t size)
+	{
+		filling.append((const char*)data, size);
+		if (filling.size() >= buffer_size) handOver();
+	}
+
+	bool writer::close()
+	{
+		if (file == INVALID_HANDLE_VALUE) return false;
+		if (worker.joinable())
+		{
+			if (filling.size() > 0) handOver();
+			{
+				lock_guard<mutex> guard(lock);
+				finishing = true;
+			}
+			changed.notify_all();
+			worker.join();
+		}
+		if (!CloseHandle(file)) failed = true;
+		file = INVALID_HANDLE_VALUE;
+		return !failed;
+	}
+}
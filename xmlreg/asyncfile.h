@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <windows.h>
+
+// sequential output files written by a separate thread
+namespace asyncfile {
+
+	// write() fills one buffer while the thread writes (and optionally compresses) the other one,
+	// so the caller only waits when it produces data faster than the disk takes it
+	class writer
+	{
+		HANDLE file = INVALID_HANDLE_VALUE;
+		bool compress = false;
+		std::string filling;			// being written by the caller
+		std::string pending;			// being written by the thread
+		bool has_pending = false;
+		bool finishing = false;
+		bool failed = false;
+		std::mutex lock;
+		std::condition_variable changed;
+		std::thread worker;
+
+		void writeLoop();
+		void handOver();
+		bool writeAll(const std::string& data);
+
+	public:
+		~writer();
+		// creates or truncates 'path', gzip compressing everything written if 'compress' is set
+		bool open(const std::wstring& path, bool compress);
+		void write(const void* data, size_t size);
+		bool close();
+	};
+}
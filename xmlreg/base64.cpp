@@ -24,6 +24,7 @@ freely, subject to the following restrictions:
 */
 
 #include "base64.h"
+#include "stats.h"
 
 static const unsigned char encodelookup[] = {
 //  'A'   'B'   'C'   'D'   'E'   'F'   'G'   'H'   'I'   'J'   'K'   'L'   'M'   'N'   'O'   'P'   'Q'   'R'   'S'   'T'   'U'   'V'   'W'   'X'   'Y'   'Z'
@@ -85,6 +86,7 @@ size_t get_buffer_size_for_decoding(size_t encoded_length)
 
 std::string b64encode(const char* data, size_t data_length)
 {
+	xrstats::timer t(xrstats::PHASE_BASE64);
 	char* buffer = nullptr;
 	size_t len = base64_encode(data, data_length, &buffer, 1);
 	std::string ret(buffer, len);
@@ -94,6 +96,7 @@ std::string b64encode(const char* data, size_t data_length)
 
 std::string b64encode(std::string data)
 {
+	xrstats::timer t(xrstats::PHASE_BASE64);
 	char* buffer = nullptr;
 	size_t len = base64_encode(data.c_str(), data.length(), &buffer, 1);
 	std::string ret(buffer, len);
@@ -103,6 +106,7 @@ std::string b64encode(std::string data)
 
 std::string b64decode(std::string data)
 {
+	xrstats::timer t(xrstats::PHASE_BASE64);
 	char* buffer = nullptr;
 	size_t len = base64_decode(data.c_str(), data.length(), &buffer);
 	std::string ret(buffer, len);
@@ -0,0 +1,324 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "xmlreg.h"
+#include "log.h"
+#include "registry.h"
+#include "batch.h"
+#include "stats.h"
+#include "progress.h"
+#include "regfile.h"
+#include "jsonfile.h"
+
+#include <pugixml.hpp>
+
+#include <map>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <windows.h>
+#include <Shlwapi.h>
+
+using namespace std;
+
+static bool readTarget(const pugi::xml_node& node, const wstring& prefix, fragment_target& target)
+{
+	auto ahive = node.attribute((prefix + L"hive").c_str());
+	auto akey = node.attribute((prefix + L"key").c_str());
+	auto aredir = node.attribute((prefix + L"redirection").c_str());
+
+	target.has_hive = !ahive.empty();
+	target.has_key = !akey.empty();
+	target.has_redirection = !aredir.empty();
+	if (target.has_hive) target.hive = xrutils::stringToHive(ahive.value());
+	if (target.has_key) target.key = akey.value();
+	if (target.has_redirection) target.redirection = xrutils::stringToRedirection(aredir.value());
+	return target.has_hive;
+}
+
+static void readReplacements(const pugi::xml_node& node, map<wstring, wstring>& replacements)
+{
+	for (pugi::xml_node child : node.children(L"replace"))
+		replacements[child.attribute(L"match").value()] = child.text().as_string();
+}
+
+static bool isPrefixKey(const wstring& prefix, const wstring& key)
+{
+	if (prefix.length() == 0) return true;
+	if (key.length() < prefix.length()) return false;
+	if (_wcsicmp(prefix.c_str(), key.substr(0, prefix.length()).c_str()) != 0) return false;
+	return key.length() == prefix.length() || key[prefix.length()] == L'\\';
+}
+
+// a .reg file names its own keys, the hive and key of its import or wipe job are not used
+static bool writesAnywhere(const batchJob& job)
+{
+	return job.kind != JOB_EXPORT && regfile::selected(job.format, job.file);
+}
+
+// jobs that cannot be proven to touch disjoint registry roots must not run concurrently
+static bool jobsConflict(const batchJob& a, const batchJob& b)
+{
+	if (_wcsicmp(a.file.c_str(), b.file.c_str()) == 0) return a.kind == JOB_EXPORT || b.kind == JOB_EXPORT;
+	if (a.kind == JOB_EXPORT && b.kind == JOB_EXPORT) return false;
+	if (writesAnywhere(a) || writesAnywhere(b)) return true;
+	if (!a.target.has_hive || !b.target.has_hive) return true;
+	if (!winreg::hivesOverlap(a.target.hive, b.target.hive)) return false;
+	if (a.target.hive != b.target.hive) return true;
+	return isPrefixKey(a.target.key, b.target.key) || isPrefixKey(b.target.key, a.target.key);
+}
+
+wstring jobKindToString(batchJobKind kind)
+{
+	switch (kind)
+	{
+	case JOB_IMPORT: return L"import";
+	case JOB_EXPORT: return L"export";
+	case JOB_WIPE: return L"wipe";
+	}
+	return L"";
+}
+
+// jobs with the same replacements reuse the same compiled rules, null for jobs that only use the shared ones
+static shared_ptr<const replacement_rules> rulesFor(const batchJob& job, jobContext& context)
+{
+	if (job.replacements.size() == 0 && job.com_dll.length() == 0) return nullptr;
+
+	wstring signature = job.com_dll;
+	for (auto& repl : job.replacements) signature += L"\n" + repl.first + L"\n" + repl.second;
+
+	lock_guard<mutex> lock(context.mutex);
+	auto found = context.rules_cache.find(signature);
+	if (found != context.rules_cache.end())
+	{
+		context.rules_lru.splice(context.rules_lru.begin(), context.rules_lru, found->second);
+		return found->second->second;
+	}
+
+	auto rules = make_shared<replacement_rules>(context.shared_rules);
+	replacement_rules own = compile_replacements(job.replacements, job.com_dll);
+	rules->insert(rules->end(), own.begin(), own.end());
+
+	context.rules_lru.emplace_front(signature, rules);
+	context.rules_cache[signature] = context.rules_lru.begin();
+	if (context.rules_lru.size() > jobContext::rules_capacity)
+	{
+		context.rules_cache.erase(context.rules_lru.back().first);
+		context.rules_lru.pop_back();
+	}
+	return rules;
+}
+
+int readJob(const pugi::xml_node& node, const wstring& directory, batchJob& job)
+{
+	wstring elemname = node.name();
+	if (elemname == L"import") job.kind = JOB_IMPORT;
+	else if (elemname == L"export") job.kind = JOB_EXPORT;
+	else if (elemname == L"wipe") job.kind = JOB_WIPE;
+	else
+	{
+		xrlog::error() << "unknown job " << elemname;
+		return ERROR_XRBATCH_XMLSCHEMA;
+	}
+
+	job.file = node.attribute(L"file").value();
+	if (job.file.length() == 0)
+	{
+		xrlog::error() << elemname << " job has no file";
+		return ERROR_XRBATCH_XMLSCHEMA;
+	}
+	if (PathIsRelativeW(job.file.c_str()) && directory.length() > 0)
+		job.file = directory + L"\\" + job.file;
+
+	if (!readTarget(node, L"", job.target) && job.kind == JOB_EXPORT)
+	{
+		xrlog::error() << "export job has no hive";
+		return ERROR_XRBATCH_XMLSCHEMA;
+	}
+	if (job.kind == JOB_EXPORT) readTarget(node, L"output-", job.output);
+	job.com_dll = node.attribute(L"com-dll").value();
+	job.format = node.attribute(L"format").value();
+	job.hex_numbers = node.attribute(L"hex").as_bool();
+	readReplacements(node, job.replacements);
+	return 0;
+}
+
+int runJob(batchJob& job, jobContext& context, bool unattended, bool skip_errors, bool dry_run)
+{
+	bool regFormat = regfile::selected(job.format, job.file);
+	bool jsonFormat = jsonfile::selected(job.format, job.file);
+	// jobs always work on whole trees, and are not journaled
+	xrfilter::keyFilter filter;
+	journal_options journal;
+
+	switch (job.kind)
+	{
+	case JOB_IMPORT:
+	{
+		shared_ptr<const replacement_rules> own = rulesFor(job, context);
+		const replacement_rules& rules = own ? *own : context.shared_rules;
+		if (regFormat) return import_regfile(job.file, rules, job.target.redirection, filter, journal, skip_errors);
+		if (jsonFormat) return import_jsonfile(job.file, rules, job.target, filter, journal, unattended, skip_errors);
+		return import_reg(job.file, rules, job.target, filter, journal, unattended, skip_errors);
+	}
+
+	case JOB_EXPORT:
+	{
+		HKEY output_hive = job.output.has_hive ? job.output.hive : job.target.hive;
+		wstring output_key = job.output.has_key ? job.output.key : job.target.key;
+		REGSAM output_redirection = job.output.has_redirection ? job.output.redirection : job.target.redirection;
+		if (regFormat)
+			return export_regfile(job.file, job.target.hive, job.target.key, job.target.redirection,
+				output_hive, output_key, filter, unattended, skip_errors);
+		if (jsonFormat)
+			return export_jsonfile(job.file, job.target.hive, job.target.key, job.target.redirection,
+				output_hive, output_key, output_redirection, filter, unattended, skip_errors);
+		return export_reg(job.file, job.target.hive, job.target.key, job.target.redirection,
+			output_hive, output_key, output_redirection, filter, unattended, skip_errors, job.hex_numbers);
+	}
+
+	case JOB_WIPE:
+		if (regFormat) return wipe_regfile(job.file, job.target.redirection, filter, skip_errors, dry_run);
+		if (jsonFormat) return wipe_jsonfile(job.file, job.target, filter, unattended, skip_errors, dry_run);
+		return wipe_reg(job.file, job.target, filter, unattended, skip_errors, dry_run);
+	}
+	return ERROR_XRGENERAL_FAILURE;
+}
+
+// a job that throws (a bad <replace> regex, a failed allocation) fails like any other, on any thread
+static void runCaught(batchJob& job, jobContext& context, bool unattended, bool skip_errors, bool dry_run)
+{
+	try
+	{
+		job.result = runJob(job, context, unattended, skip_errors, dry_run);
+	}
+	catch (exception& ex)
+	{
+		xrlog::error() << "job threw: " << ex.what();
+		job.result = ERROR_XRBATCH_JOBFAILED;
+	}
+}
+
+int batch_reg(wstring file, bool unattended, bool skip_errors, bool dry_run)
+{
+	xrlog::info() << "running jobs defined in file " << file;
+
+	pugi::xml_document doc;
+	pugi::xml_parse_result parse_result;
+	{
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		parse_result = doc.load_file(file.c_str());
+	}
+	if (parse_result.status != pugi::status_ok)
+	{
+		xrlog::error() << parse_result.description();
+		return ERROR_XRBATCH_PARSEXML;
+	}
+
+	auto root = doc.first_element_by_path(L"batch");
+	if (root.name() != wstring(L"batch"))
+	{
+		xrlog::error() << "root element is not 'batch'";
+		return ERROR_XRBATCH_XMLSCHEMA;
+	}
+
+	// job files are relative to the manifest
+	wstring directory;
+	xrutils::getFullPath(file, directory);
+
+	vector<batchJob> jobs;
+	map<wstring, wstring> shared_replacements;
+	readReplacements(root, shared_replacements);
+
+	for (pugi::xml_node child : root.children())
+	{
+		wstring elemname = child.name();
+		if (elemname.length() == 0 || elemname == L"replace") continue;
+
+		if (elemname != L"import" && elemname != L"export" && elemname != L"wipe")
+		{
+			xrlog::warning() << "ignoring unknown element " << elemname;
+			continue;
+		}
+
+		batchJob job;
+		int r = readJob(child, directory, job);
+		if (r) return r;
+
+		for (size_t i = 0; i < jobs.size(); ++i)
+			if (jobsConflict(jobs[i], job)) job.wave = max(job.wave, jobs[i].wave + 1);
+
+		jobs.push_back(job);
+	}
+
+	// compiled once, shared by every import job
+	jobContext context;
+	context.shared_rules = compile_replacements(shared_replacements, L"");
+
+	// prompts cannot be answered by several jobs at once
+	unsigned parallel = root.attribute(L"parallel").as_uint(1);
+	if (parallel == 0) parallel = thread::hardware_concurrency();
+	if (!unattended || dry_run) parallel = 1;
+
+	size_t waves = 0;
+	for (auto& job : jobs) waves = max(waves, job.wave + 1);
+
+	// one status line for the whole manifest, the displays of the jobs nest inside it
+	xrprogress::display progress(L"batch", xrprogress::MEASURE_ITEMS);
+
+	int failed = 0, first_error = 0;
+	for (size_t wave = 0; wave < waves; ++wave)
+	{
+		vector<batchJob*> ready;
+		for (auto& job : jobs) if (job.wave == wave) ready.push_back(&job);
+
+		for (size_t i = 0; i < ready.size(); i += parallel)
+		{
+			vector<thread> workers;
+			size_t end = min(ready.size(), i + parallel);
+			for (size_t j = i; j < end; ++j)
+			{
+				batchJob* job = ready[j];
+				xrlog::info() << "job: " << jobKindToString(job->kind) << " " << job->file;
+				if (parallel == 1) runCaught(*job, context, unattended, skip_errors, dry_run);
+				else workers.push_back(thread([job, &context, unattended, skip_errors, dry_run]() {
+					runCaught(*job, context, unattended, skip_errors, dry_run);
+				}));
+			}
+			for (auto& worker : workers) worker.join();
+
+			for (size_t j = i; j < end; ++j)
+			{
+				if (!ready[j]->result) continue;
+				++failed;
+				if (!first_error) first_error = ready[j]->result;
+				xrlog::error() << "job failed: " << jobKindToString(ready[j]->kind) << " " << ready[j]->file
+					<< "\n\t" << xrutils::errorToString(ready[j]->result);
+			}
+			if (first_error && !skip_errors) return first_error;
+		}
+	}
+
+	xrlog::info() << "batch: " << jobs.size() << " job(s), " << failed << " failed";
+	return failed ? ERROR_XRBATCH_JOBFAILED : 0;
+}
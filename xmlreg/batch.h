@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include "xmlreg.h"
+
+#include <pugixml.hpp>
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <windows.h>
+
+enum batchJobKind { JOB_IMPORT, JOB_EXPORT, JOB_WIPE };
+
+// one <import>, <export> or <wipe> element of a batch manifest or a service request
+struct batchJob
+{
+	batchJobKind kind = JOB_IMPORT;
+	std::wstring file;
+	fragment_target target;		// import/wipe destination override, or export input
+	fragment_target output;		// export only
+	std::map<std::wstring, std::wstring> replacements;
+	std::wstring com_dll;
+	std::wstring format;
+	bool hex_numbers = false;	// export only
+	size_t wave = 0;
+	int result = 0;
+};
+
+// state kept across jobs run by the same process
+struct jobContext
+{
+	// compiled rules of the jobs with their own replacements, keyed by the replacements, the least recently used
+	// are dropped past 'rules_capacity' (jobs still running with them keep their copy alive)
+	typedef std::pair<std::wstring, std::shared_ptr<const replacement_rules>> cachedRules;
+	static const size_t rules_capacity = 64;
+
+	replacement_rules shared_rules;
+	std::list<cachedRules> rules_lru;
+	std::unordered_map<std::wstring, std::list<cachedRules>::iterator> rules_cache;
+	std::mutex mutex;
+};
+
+int readJob(const pugi::xml_node& node, const std::wstring& directory, batchJob& job);
+int runJob(batchJob& job, jobContext& context, bool unattended, bool skip_errors, bool dry_run);
+std::wstring jobKindToString(batchJobKind kind);
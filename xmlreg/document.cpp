@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "document.h"
+#include "stats.h"
+#include "gzip.h"
+#include "log.h"
+
+#include <windows.h>
+
+using namespace std;
+
+mappedFile::mappedFile(const wstring& path)
+{
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return;
+
+	// empty files cannot be mapped, and files larger than the address space are left to load_file
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || length.QuadPart == 0 || (unsigned long long)length.QuadPart > (size_t)-1) return;
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) return;
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view) size = (size_t)length.QuadPart;
+}
+
+mappedFile::~mappedFile()
+{
+	if (view) UnmapViewOfFile(view);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+}
+
+pugi::xml_parse_result loadDocument(pugi::xml_document& doc, const wstring& file)
+{
+	pugi::xml_parse_result result;
+
+	switch (gzip::detect(file))
+	{
+	case gzip::CODEC_NONE:
+	{
+		// pugi decodes straight from the mapped pages into its own wchar_t buffer,
+		// instead of reading the whole file into memory first
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		mappedFile mapped(file);
+		if (mapped.view) result = doc.load_buffer(mapped.view, mapped.size);
+		else result = doc.load_file(file.c_str());
+	}
+		break;
+
+	case gzip::CODEC_GZIP:
+	{
+		string data;
+		wstring error;
+		if (!gzip::readFile(file, data, error))
+		{
+			xrlog::error() << error;
+			result.status = pugi::status_io_error;
+			break;
+		}
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		result = doc.load_buffer(data.data(), data.size());
+	}
+		break;
+
+	case gzip::CODEC_ZSTD:
+		xrlog::error() << "zstd compressed files are not supported, decompress or recompress with gzip";
+		result.status = pugi::status_io_error;
+		break;
+	}
+
+	return result;
+}
+
+pugi::xml_parse_result loadDocument(pugi::xml_document& doc, const void* data, size_t size)
+{
+	pugi::xml_parse_result result;
+
+	switch (gzip::detect(data, size))
+	{
+	case gzip::CODEC_NONE:
+	{
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		result = doc.load_buffer(data, size);
+	}
+		break;
+
+	case gzip::CODEC_GZIP:
+	{
+		string inflated;
+		wstring error;
+		if (!gzip::inflate(data, size, inflated, error))
+		{
+			xrlog::error() << error;
+			result.status = pugi::status_io_error;
+			break;
+		}
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		result = doc.load_buffer(inflated.data(), inflated.size());
+	}
+		break;
+
+	case gzip::CODEC_ZSTD:
+		xrlog::error() << "zstd compressed data is not supported, decompress or recompress with gzip";
+		result.status = pugi::status_io_error;
+		break;
+	}
+
+	return result;
+}
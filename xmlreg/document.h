@@ -0,0 +1,46 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+
+#include <pugixml.hpp>
+
+#include <windows.h>
+
+// read only view of a whole file, empty if the file cannot be mapped
+struct mappedFile
+{
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const void* view = nullptr;
+	size_t size = 0;
+
+	mappedFile(const std::wstring& path);
+	~mappedFile();
+};
+
+// loads 'file' into 'doc', inflating it first if it is gzip compressed
+// compressed files are recognized by their content, not by their name
+pugi::xml_parse_result loadDocument(pugi::xml_document& doc, const std::wstring& file);
+// the same for a file that is already in memory
+pugi::xml_parse_result loadDocument(pugi::xml_document& doc, const void* data, size_t size);
+
@@ -19,12 +19,27 @@ freely, subject to the following restrictions:
 */
 
 #include "xmlreg.h"
+#include "log.h"
 #include "registry.h"
+#include "stats.h"
+#include "trace.h"
+#include "regfile.h"
+#include "jsonfile.h"
+#include "base64.h"
+#include "xmlfile.h"
+#include "gzip.h"
+#include "pipeline.hpp"
+#include "keystack.hpp"
+#include "winefile.h"
+#include "progress.h"
+#include "libxmlreg.h"
 
-#include <pugixml.hpp>
-
+#include <atomic>
+#include <memory>
 #include <string>
-#include <sstream>
+#include <thread>
+#include <exception>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 
@@ -32,175 +47,1170 @@ freely, subject to the following restrictions:
 
 using namespace std;
 
-// recursive function
-int convertKey(HKEY hive, const wstring& key, REGSAM redirection, pugi::xml_node &node, bool skip_errors)
+// export runs as three stages connected by queues, each on its own thread:
+// the reader walks the registry, the encoder formats numbers and base64, and the serializer writes xml
+// (the file itself is written by a fourth thread, inside xmlfile::writer)
+enum exportItemKind { ITEM_KEY, ITEM_END_KEY, ITEM_VALUE, ITEM_DONE };
+
+struct exportItem
+{
+	exportItemKind kind = ITEM_DONE;
+	wstring name;
+	unsigned long type = REG_NONE;
+	string bytes;				// raw data, from the reader
+	wstring text;				// from the encoder
+	vector<wstring> list;		// multi-string items, from the encoder
+	bool has_text = true;
+	bool is_number = false;		// dword, qword and dword-be, kept as bits until they are serialized
+	unsigned long long number = 0;
+};
+
+static const size_t export_queue_size = 4096;
+
+// traversals hold an open handle per level and only keep the path for messages,
+// this appends 'name' to it and returns the length to restore it to
+static size_t appendKey(wstring& path, const wstring& name)
+{
+	size_t mark = path.length();
+	if (mark > 0) path += L'\\';
+	path += name;
+	return mark;
+}
+
+// one level of walkKeys
+template<class Handle>
+struct walkFrame
+{
+	Handle handle;
+	const Handle* key = nullptr;		// 'handle', or the root the caller opened
+	vector<wstring> subkeys;
+	size_t next = 0;					// index of the next subkey to walk into
+	size_t mark = 0;					// length of the path before this key was appended
+	xrfilter::position position;
+	xrtrace::keySpan span;
+};
+
+// 'frame.position' is set by the caller
+template<class Handle>
+static void enterFrame(walkFrame<Handle>& frame, const Handle& key, const wstring& path, size_t mark,
+	const xrfilter::keyFilter& filter, xrfilter::position& scratch)
+{
+	frame.key = &key;
+	frame.next = 0;
+	frame.mark = mark;
+	frame.span.begin(path);
+	key.subkeys(frame.subkeys);
+	// excluded subkeys are dropped before anything opens them, visitors only see the ones that are walked
+	if (filter.filtersKeys())
+		frame.subkeys.erase(remove_if(frame.subkeys.begin(), frame.subkeys.end(),
+			[&](const wstring& name) { return !filter.enter(frame.position, name, scratch); }), frame.subkeys.end());
+}
+
+template<class Handle>
+static void leaveFrame(keyStack<walkFrame<Handle>>& stack, wstring& path)
+{
+	walkFrame<Handle>& frame = stack.top();
+	frame.span.end();
+	frame.handle.close();
+	path.resize(frame.mark);
+	stack.pop();
+}
+
+// one key of treeCount
+template<class Handle>
+struct countFrame
 {
-	wstringstream ss;
+	Handle handle;
+	vector<wstring> subkeys;
+	size_t next = 0;
+	xrfilter::position position;
+};
 
-	auto properties = winreg::enumerateProperties(hive, key, redirection);
-	for (auto property : properties)
+// sizes an export for --progress while it runs, from the subkey and value counts of every key, without reading any value
+// the subkeys of the root are shared by 'workers' threads that walk their part depth first, or with no workers
+// the whole tree is counted before the constructor returns
+template<class Handle>
+class treeCount
+{
+	const Handle& root;
+	const xrfilter::keyFilter& filter;
+	xrfilter::position position;
+	vector<wstring> tops;
+	atomic<size_t> next_top{ 0 };
+	atomic<unsigned> running{ 0 };
+	atomic<bool> cancelled{ false };
+	vector<thread> threads;
+
+	void enter(countFrame<Handle>& frame, const Handle& parent, const wstring& name)
 	{
-		auto elem = node.append_child(L"value");
-		elem.append_attribute(L"name").set_value(property.c_str());
-		auto type = winreg::getPropertyType(hive, key, property, redirection);
-		elem.append_attribute(L"type").set_value(xrutils::propTypeToString(type).c_str());
-		switch (type)
+		frame.next = 0;
+		frame.subkeys.clear();
+		unsigned long subkeys = 0, values = 0;
+		// a key that cannot be opened is still walked by the export, as an empty key
+		if (frame.handle.open(parent, name) && frame.handle.info(subkeys, values) && subkeys > 0)
+			frame.handle.subkeys(frame.subkeys);
+		xrprogress::addTotal(1, frame.position.included ? values : 0);
+	}
+
+	void countBelow(const wstring& name, const xrfilter::position& p)
+	{
+		keyStack<countFrame<Handle>> stack;
+		countFrame<Handle>& first = stack.push();
+		first.position = p;
+		enter(first, root, name);
+
+		while (!stack.empty() && !cancelled.load(memory_order_relaxed))
 		{
-			case REG_QWORD:
+			countFrame<Handle>& top = stack.top();
+			if (top.next == top.subkeys.size())
 			{
-				ss.str(L"");
-				auto value = winreg::getQword(hive, key, property, 0, redirection);
-				ss << value;
-				elem.append_child(pugi::node_pcdata).set_value(ss.str().c_str());
+				top.handle.close();
+				stack.pop();
+				continue;
 			}
-			break;
 
-			case REG_DWORD:
+			const wstring& subkey = top.subkeys[top.next++];
+			countFrame<Handle>& child = stack.push();
+			if (!filter.enter(top.position, subkey, child.position))
 			{
-				ss.str(L"");
-				auto value = winreg::getDword(hive, key, property, 0, redirection);
-				ss << value;
-				elem.append_child(pugi::node_pcdata).set_value(ss.str().c_str());
+				stack.pop();
+				continue;
 			}
-			break;
+			enter(child, top.handle, subkey);
+		}
+	}
+
+	void work()
+	{
+		xrfilter::position p;
+		size_t i;
+		while (!cancelled.load(memory_order_relaxed) && (i = next_top++) < tops.size())
+			if (filter.enter(position, tops[i], p)) countBelow(tops[i], p);
+	}
+
+	void run()
+	{
+		work();
+		if (--running == 0 && !cancelled) xrprogress::totalKnown();
+	}
+
+public:
+	treeCount(const Handle& root, const xrfilter::keyFilter& filter, const xrfilter::position& position, unsigned workers)
+		: root(root), filter(filter), position(position)
+	{
+		unsigned long subkeys = 0, values = 0;
+		root.info(subkeys, values);
+		xrprogress::addTotal(1, position.included ? values : 0);
+		root.subkeys(tops);
+
+		if (workers == 0)
+		{
+			work();
+			xrprogress::totalKnown();
+			return;
+		}
+		running = workers;
+		for (unsigned i = 0; i < workers; ++i) threads.emplace_back(&treeCount::run, this);
+	}
+
+	// an export that stops early does not wait for the whole count
+	~treeCount()
+	{
+		cancelled = true;
+		for (auto& t : threads) t.join();
+	}
+};
+
+// registry calls wait on the kernel, so a few threads keep the count ahead of the export
+// a wine registry is in memory and counted before the export starts
+static unsigned countWorkers(const winreg::keyHandle&)
+{
+	return max(1u, min(4u, thread::hardware_concurrency()));
+}
 
-			case REG_DWORD_BIG_ENDIAN:
+static unsigned countWorkers(const winefile::keyHandle&)
+{
+	return 0;
+}
+
+// depth first walk of the tree below 'root', with an explicit stack instead of recursion
+// 'Handle' is winreg::keyHandle or winefile::keyHandle, they have the same interface, and 'Visitor' has:
+//   int enterKey(const wstring& name)							before a subkey is opened
+//   int visitKey(const Handle& key, const vector<wstring>& subkeys, const xrfilter::position& position)
+//																every key, the root too, 'path' names it
+//   int leaveKey(const vector<wstring>& subkeys)				after everything below a subkey
+// a nonzero return stops the walk and is returned, 'path' is back to the root by then
+// keys left out by 'filter' are not walked, and visitors only read values when 'position.included' is set
+// with --progress, the walk counts keys and the visitors count the values they read
+template<class Handle, class Visitor>
+static int walkKeys(const Handle& root, wstring& path, const xrfilter::keyFilter& filter, Visitor& visitor)
+{
+	keyStack<walkFrame<Handle>> stack;
+	xrfilter::position scratch;
+	walkFrame<Handle>& first = stack.push();
+	if (!filter.start(first.position)) return 0;
+
+	xrprogress::display progress(L"exporting", xrprogress::MEASURE_ITEMS);
+	unique_ptr<treeCount<Handle>> count;
+	if (xrprogress::enabled()) count.reset(new treeCount<Handle>(root, filter, first.position, countWorkers(root)));
+
+	enterFrame(first, root, path, path.length(), filter, scratch);
+	int r = visitor.visitKey(root, first.subkeys, first.position);
+	xrprogress::addKeys(1);
+
+	while (!r && !stack.empty())
+	{
+		walkFrame<Handle>& top = stack.top();
+		if (top.next == top.subkeys.size())
+		{
+			// a popped frame keeps its contents until the next push
+			leaveFrame(stack, path);
+			if (!stack.empty()) r = visitor.leaveKey(top.subkeys);
+			continue;
+		}
+
+		// the deque behind the stack does not move 'top' when the child is pushed
+		const wstring& subkey = top.subkeys[top.next++];
+		r = visitor.enterKey(subkey);
+		if (r) break;
+		walkFrame<Handle>& child = stack.push();
+		filter.enter(top.position, subkey, child.position);
+		size_t mark = appendKey(path, subkey);
+		// a subkey that fails to open is walked as an empty key
+		child.handle.open(*top.key, subkey);
+		enterFrame(child, child.handle, path, mark, filter, scratch);
+		r = visitor.visitKey(child.handle, child.subkeys, child.position);
+		xrprogress::addKeys(1);
+	}
+
+	while (!stack.empty()) leaveFrame(stack, path);
+	return r;
+}
+
+// reader stage, turns the walk into items for the encoder
+template<class Handle>
+class keyReader
+{
+	const wstring& path;
+	spscQueue<exportItem>& queue;
+	const xrfilter::keyFilter& filter;
+	bool skip_errors;
+	vector<wstring> properties;
+
+public:
+	keyReader(const wstring& path, spscQueue<exportItem>& queue, const xrfilter::keyFilter& filter, bool skip_errors)
+		: path(path), queue(queue), filter(filter), skip_errors(skip_errors) {}
+
+	int enterKey(const wstring& name)
+	{
+		exportItem item;
+		item.kind = ITEM_KEY;
+		item.name = name;
+		queue.push(move(item));
+		return 0;
+	}
+
+	int visitKey(const Handle& key, const vector<wstring>&, const xrfilter::position& position)
+	{
+		if (!position.included) return 0;
+		key.values(properties);
+		xrprogress::addValues(properties.size());
+		for (auto& property : properties)
+		{
+			exportItem item;
+			item.kind = ITEM_VALUE;
+			item.name = property;
+			if (!key.read(property, item.bytes, item.type))
 			{
-				ss.str(L"");
-				auto value = winreg::getDwordBE(hive, key, property, 0, redirection);
-				ss << value;
-				elem.append_child(pugi::node_pcdata).set_value(ss.str().c_str());
+				xrlog::error() << "failed to read value " << property << "\n\tat " << path;
+				if (!skip_errors) return ERROR_XREXPORT_READVALUE;
+				continue;
 			}
-			break;
+			if (!filter.wantsType(item.type)) continue;
+			queue.push(move(item));
+		}
+		return 0;
+	}
+
+	int leaveKey(const vector<wstring>&)
+	{
+		exportItem item;
+		item.kind = ITEM_END_KEY;
+		queue.push(move(item));
+		return 0;
+	}
+};
+
+template<class Handle>
+static int readKey(const Handle& key, wstring& path, spscQueue<exportItem>& queue, const xrfilter::keyFilter& filter, bool skip_errors)
+{
+	keyReader<Handle> reader(path, queue, filter, skip_errors);
+	return walkKeys(key, path, filter, reader);
+}
 
-			case REG_SZ:
-			case REG_EXPAND_SZ:
+// the same text the winreg getters would return for each type
+static void encodeValue(exportItem& item)
+{
+	const unsigned char* data = (const unsigned char*)item.bytes.data();
+	size_t length = item.bytes.length();
+
+	switch (item.type)
+	{
+		case REG_QWORD:
+			item.is_number = true;
+			if (length >= sizeof(item.number)) memcpy(&item.number, data, sizeof(item.number));
+		break;
+
+		case REG_DWORD:
+		case REG_DWORD_BIG_ENDIAN:
+			item.is_number = true;
+			if (length >= 4)
 			{
-				auto value = winreg::getString(hive, key, property, L"", redirection);
-				elem.append_child(pugi::node_pcdata).set_value(value.c_str());
+				if (item.type == REG_DWORD) item.number = data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned long)data[3] << 24);
+				else item.number = data[3] | (data[2] << 8) | (data[1] << 16) | ((unsigned long)data[0] << 24);
 			}
-			break;
+		break;
 
-			case REG_MULTI_SZ:
+		case REG_SZ:
+		case REG_EXPAND_SZ:
+		{
+			const wchar_t* text = (const wchar_t*)data;
+			size_t count = length / sizeof(wchar_t);
+			size_t end = 0;
+			while (end < count && text[end] != L'\0') ++end;
+			item.text.assign(text, end);
+		}
+		break;
+
+		case REG_MULTI_SZ:
+		{
+			// empty items are dropped
+			item.has_text = false;
+			const wchar_t* text = (const wchar_t*)data;
+			size_t count = length / sizeof(wchar_t);
+			size_t start = 0;
+			for (size_t i = 0; i <= count; ++i)
 			{
-				vector<wstring> list;
-				if (winreg::getMultiString(hive, key, property, list, redirection))
-				{
-					for (auto item : list)
-					{
-						auto li = elem.append_child(L"li");
-						li.append_child(pugi::node_pcdata).set_value(item.c_str());
-					}
-				}
+				if (i < count && text[i] != L'\0') continue;
+				if (i > start) item.list.push_back(wstring(text + start, i - start));
+				start = i + 1;
 			}
+		}
+		break;
+
+		//case REG_BINARY:
+		//case REG_NONE:
+		//case REG_LINK:
+		//case REG_RESOURCE_LIST:
+		//case REG_FULL_RESOURCE_DESCRIPTOR:
+		//case REG_RESOURCE_REQUIREMENTS_LIST:
+		default:
+			item.text = wstring_from_utf8(b64encode(item.bytes.data(), item.bytes.length()));
+		break;
+	}
+
+	item.bytes.clear();
+	item.bytes.shrink_to_fit();
+}
+
+// encoder stage
+void encodeLoop(spscQueue<exportItem>& input, spscQueue<exportItem>& output)
+{
+	exportItem item;
+	do
+	{
+		input.pop(item);
+		if (item.kind == ITEM_VALUE)
+		{
+			xrstats::timer t(xrstats::PHASE_ENCODING);
+			encodeValue(item);
+		}
+		exportItemKind kind = item.kind;
+		output.push(move(item));
+		if (kind == ITEM_DONE) return;
+	} while (true);
+}
+
+// serializer stage
+// numbers are written as signed decimals (like the winreg getters return them), or as unsigned hexadecimal
+void serializeLoop(spscQueue<exportItem>& input, xmlfile::writer& out, bool hex_numbers)
+{
+	exportItem item;
+	while (true)
+	{
+		input.pop(item);
+		if (item.kind == ITEM_DONE) return;
+
+		xrstats::timer t(xrstats::PHASE_SERIALIZATION);
+		switch (item.kind)
+		{
+		case ITEM_KEY:
+			out.start(L"key");
+			out.attribute(L"name", item.name);
 			break;
 
-			case REG_BINARY:
-			{
-				auto value = winreg::getBinaryAsBase64(hive, key, property, "", redirection);
-				elem.append_child(pugi::node_pcdata).set_value(wstring_from_utf8(value).c_str());
-			}
+		case ITEM_END_KEY:
+			out.end();
 			break;
 
-			//case REG_NONE:
-			//case REG_LINK:
-			//case REG_RESOURCE_LIST:
-			//case REG_FULL_RESOURCE_DESCRIPTOR:
-			//case REG_RESOURCE_REQUIREMENTS_LIST:
-			default:
+		case ITEM_VALUE:
+			out.start(L"value");
+			out.attribute(L"name", item.name);
+			out.attribute(L"type", xrutils::propTypeToString(item.type));
+			if (item.is_number && hex_numbers) out.hexadecimal(item.number, item.type == REG_QWORD ? 16 : 8);
+			else if (item.is_number && item.type == REG_QWORD) out.integer((long long)item.number);
+			else if (item.is_number) out.integer((long)(unsigned long)item.number);
+			else if (item.has_text) out.text(item.text);
+			for (auto& li : item.list)
 			{
-				unsigned long ulType;
-				auto value = winreg::getAsBase64ByteArray(hive, key, property, "", ulType, redirection);
-				elem.append_child(pugi::node_pcdata).set_value(wstring_from_utf8(value).c_str());
+				out.start(L"li");
+				out.text(li);
+				out.end();
 			}
+			out.end();
 			break;
 		}
 	}
+}
+
+// refuses directories, and asks before overwriting an existing file
+int checkOutputFile(const wstring& file, bool unattended)
+{
+	if (xrutils::isDirectory(file))
+	{
+		xrlog::error() << "path already exists and is a directory";
+		return ERROR_XREXPORT_FILEISDIRECTORY;
+	}
+
+	if (xrutils::isFile(file))
+	{
+		if (unattended)
+		{
+			xrlog::warning() << "overwritting " << file;
+		}
+		else
+		{
+			wstring option;
+			xrlog::flush();
+			wcout << "file already exists, overwrite? (y/N) ";
+			wcin >> option;
+			transform(option.begin(), option.end(), option.begin(), tolower);
+			bool ok_to_go = option == L"1" || option == L"y" || option == L"yes" || option == L"true";
+			if (!ok_to_go) return ERROR_XREXPORT_DONTOVERWRITE;
+		}
+	}
+
+	return 0;
+}
 
-	auto subkeys = winreg::enumerateSubkeys(hive, key, redirection);
-	for (auto subkey : subkeys)
+// writes the tree below 'key' (open on 'input_key') as an xml fragment to 'out', which is open and empty, and closes it
+template<class Handle>
+static int writeFragment(xmlfile::writer& out, const Handle& key, const wstring& input_key,
+	HKEY output_hive, const wstring& output_key, REGSAM output_redirection, const xrfilter::keyFilter& filter, bool skip_errors, bool hex_numbers)
+{
+	out.start(L"fragment");
+	out.attribute(L"hive", xrutils::hiveToString(output_hive));
+	if (output_key.length() > 0) out.attribute(L"key", output_key);
+	if (output_redirection) out.attribute(L"redirection", xrutils::redirectionToString(output_redirection));
+
+	spscQueue<exportItem> raw(export_queue_size), encoded(export_queue_size);
+	thread encoder(encodeLoop, ref(raw), ref(encoded));
+	thread serializer(serializeLoop, ref(encoded), ref(out), hex_numbers);
+
+	int r;
+	try
 	{
-		auto elem = node.append_child(L"key");
-		elem.append_attribute(L"name").set_value(subkey.c_str());
-		if (key.length() == 0) convertKey(hive, subkey, redirection, elem, skip_errors);
-		else convertKey(hive, key + L"\\" + subkey, redirection, elem, skip_errors);
+		wstring path = input_key;
+		r = readKey(key, path, raw, filter, skip_errors);
 	}
+	catch (...)
+	{
+		raw.push(exportItem());
+		encoder.join();
+		serializer.join();
+		throw;
+	}
+	raw.push(exportItem());
+	encoder.join();
+	serializer.join();
+
+	out.end();
 
+	bool saved = out.close();
+	if (r && !skip_errors) return r;
+	if (!saved)
+	{
+		xrlog::error() << "failed to save output file (second attempt)";
+		return ERROR_XREXPORT_WRITEOUTPUT2;
+	}
 	return 0;
 }
 
-int export_reg(wstring file, HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key, REGSAM output_redirection, bool unattended, bool skip_errors)
+template<class Handle>
+static int exportFragment(const wstring& file, const Handle& key, const wstring& input_key,
+	HKEY output_hive, const wstring& output_key, REGSAM output_redirection, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool hex_numbers)
 {
-	std::wcout << "exporting to file " << file << "\nfrom (" << xrutils::redirectionToString(input_redirection) << ") "
-		<< xrutils::hiveToString(input_hive) << ":\\" << input_key << std::endl;
+	int r = checkOutputFile(file, unattended);
+	if (r) return r;
+
+	// opening the output is the permission check, and the file is written while the registry is read
+	xmlfile::writer out;
+	if (!out.open(file, gzip::selected(file)))
+	{
+		xrlog::error() << "failed to save output file";
+		return ERROR_XREXPORT_WRITEOUTPUT1;
+	}
 
-	if (winreg::keyExists(input_hive, input_key, input_redirection))
+	try
 	{
-		if (xrutils::isDirectory(file))
+		r = writeFragment(out, key, input_key, output_hive, output_key, output_redirection, filter, skip_errors, hex_numbers);
+	}
+	catch (...)
+	{
+		out.close();
+		DeleteFileW(file.c_str());
+		throw;
+	}
+
+	// a file that could not be closed is left for the user to look at
+	if (r && r != ERROR_XREXPORT_WRITEOUTPUT2) DeleteFileW(file.c_str());
+	return r;
+}
+
+int export_reg(wstring file, HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key, REGSAM output_redirection, bool unattended, bool skip_errors, bool hex_numbers)
+{
+	return export_reg(file, input_hive, input_key, input_redirection, output_hive, output_key, output_redirection,
+		xrfilter::keyFilter(), unattended, skip_errors, hex_numbers);
+}
+
+int export_reg(wstring file, HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors, bool hex_numbers)
+{
+	xrlog::info() << "exporting to file " << file << "\nfrom (" << xrutils::redirectionToString(input_redirection) << ") "
+		<< xrutils::hiveToString(input_hive) << ":\\" << input_key;
+
+	if (!winreg::keyExists(input_hive, input_key, input_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XREXPORT_NOKEY;
+	}
+
+	winreg::keyHandle key;
+	key.open(input_hive, input_key, KEY_READ | input_redirection);
+	return exportFragment(file, key, input_key, output_hive, output_key, output_redirection, filter, unattended, skip_errors, hex_numbers);
+}
+
+int export_stream(const function<bool(const void*, size_t)>& sink,
+	HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool skip_errors, bool hex_numbers)
+{
+	if (!winreg::keyExists(input_hive, input_key, input_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XREXPORT_NOKEY;
+	}
+
+	xmlfile::writer out;
+	if (!out.open(sink)) return ERROR_XREXPORT_WRITEOUTPUT1;
+
+	winreg::keyHandle key;
+	key.open(input_hive, input_key, KEY_READ | input_redirection);
+	try
+	{
+		return writeFragment(out, key, input_key, output_hive, output_key, output_redirection, filter, skip_errors, hex_numbers);
+	}
+	catch (...)
+	{
+		out.close();
+		throw;
+	}
+}
+
+// the reader stage alone, on its own thread, with the visitor taking the raw items on the calling thread
+int export_visit(libxmlreg::visitor& visitor, HKEY input_hive, wstring input_key, REGSAM input_redirection,
+	const xrfilter::keyFilter& filter, bool skip_errors)
+{
+	if (!winreg::keyExists(input_hive, input_key, input_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XREXPORT_NOKEY;
+	}
+
+	spscQueue<exportItem> raw(export_queue_size);
+	int r = 0;
+	exception_ptr failure;
+	thread reader([&]() {
+		try
+		{
+			winreg::keyHandle key;
+			key.open(input_hive, input_key, KEY_READ | input_redirection);
+			wstring path = input_key;
+			r = readKey(key, path, raw, filter, skip_errors);
+		}
+		catch (...)
+		{
+			failure = current_exception();
+		}
+		raw.push(exportItem());
+	});
+
+	// once the visitor fails the rest is only drained, the reader has no way to stop early
+	int visited = 0;
+	exportItem item;
+	while (true)
+	{
+		raw.pop(item);
+		if (item.kind == ITEM_DONE) break;
+		if (visited) continue;
+
+		switch (item.kind)
 		{
-			wcout << "error: path already exists and is a directory" << endl;
-			return ERROR_XREXPORT_FILEISDIRECTORY;
+		case ITEM_KEY: visited = visitor.enterKey(item.name); break;
+		case ITEM_END_KEY: visited = visitor.leaveKey(); break;
+		case ITEM_VALUE: visited = visitor.value(item.name, item.type, item.bytes.data(), item.bytes.size()); break;
+		default: break;
 		}
+	}
+	reader.join();
+
+	if (failure) rethrow_exception(failure);
+	return visited ? visited : r;
+}
+
+int export_wine(wstring file, wstring wine_file, HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors, bool hex_numbers)
+{
+	xrlog::info() << "exporting to file " << file << "\nfrom wine registry " << wine_file << " (" << xrutils::redirectionToString(input_redirection) << ") "
+		<< xrutils::hiveToString(input_hive) << ":\\" << input_key;
+
+	winefile::registry registry;
+	wstring error;
+	if (!registry.load(wine_file, error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_LOAD;
+	}
+
+	winefile::keyHandle key;
+	if (!key.open(registry, input_hive, input_key, input_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XREXPORT_NOKEY;
+	}
+	return exportFragment(file, key, input_key, output_hive, output_key, output_redirection, filter, unattended, skip_errors, hex_numbers);
+}
+
+// .reg files name every key in full, so the output path is kept alongside the input one
+class regFileWriter
+{
+	const wstring& path;
+	HKEY output_hive;
+	wstring& output_key;
+	regfile::writer& out;
+	const xrfilter::keyFilter& filter;
+	bool skip_errors;
+	vector<size_t> marks;
+	vector<wstring> properties;
+	string bytes;
+
+public:
+	regFileWriter(const wstring& path, HKEY output_hive, wstring& output_key, regfile::writer& out, const xrfilter::keyFilter& filter, bool skip_errors)
+		: path(path), output_hive(output_hive), output_key(output_key), out(out), filter(filter), skip_errors(skip_errors) {}
 
-		if (xrutils::isFile(file))
+	int enterKey(const wstring& name)
+	{
+		marks.push_back(appendKey(output_key, name));
+		return 0;
+	}
+
+	int visitKey(const winreg::keyHandle& key, const vector<wstring>&, const xrfilter::position& position)
+	{
+		out.key(output_hive, output_key);
+		if (!position.included) return 0;
+
+		key.values(properties);
+		xrprogress::addValues(properties.size());
+		for (auto& property : properties)
 		{
-			if (unattended)
+			unsigned long type;
+			if (key.read(property, bytes, type))
 			{
-				wcout << "warning: overwritting " << file << endl;
+				if (filter.wantsType(type)) out.value(property, type, bytes.data(), bytes.length());
 			}
 			else
 			{
-				wstring option;
-				wcout << "file already exists, overwrite? (y/N) ";
-				wcin >> option;
-				transform(option.begin(), option.end(), option.begin(), tolower);
-				bool ok_to_go = option == L"1" || option == L"y" || option == L"yes" || option == L"true";
-				if (!ok_to_go) return ERROR_XREXPORT_DONTOVERWRITE;
+				xrlog::error() << "failed to read value " << property << "\n\tat " << path;
+				if (!skip_errors) return ERROR_XREXPORT_READVALUE;
 			}
 		}
+		return 0;
+	}
+
+	int leaveKey(const vector<wstring>&)
+	{
+		output_key.resize(marks.back());
+		marks.pop_back();
+		return 0;
+	}
+
+	// back to the output key of the root, when the walk stops early
+	void rewind()
+	{
+		if (marks.size() > 0) output_key.resize(marks.front());
+		marks.clear();
+	}
+};
+
+int convertKeyToRegFile(const winreg::keyHandle& key, wstring& path, HKEY output_hive, wstring& output_key, regfile::writer& out,
+	const xrfilter::keyFilter& filter, bool skip_errors)
+{
+	regFileWriter writer(path, output_hive, output_key, out, filter, skip_errors);
+	int r = walkKeys(key, path, filter, writer);
+	writer.rewind();
+	return r;
+}
+
+int export_regfile(wstring file, HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors)
+{
+	xrlog::info() << "exporting to file " << file << "\nfrom (" << xrutils::redirectionToString(input_redirection) << ") "
+		<< xrutils::hiveToString(input_hive) << ":\\" << input_key;
+
+	if (!winreg::keyExists(input_hive, input_key, input_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XREXPORT_NOKEY;
+	}
+
+	int r = checkOutputFile(file, unattended);
+	if (r) return r;
+
+	regfile::writer out;
+	if (!out.open(file))
+	{
+		xrlog::error() << "failed to save output file";
+		return ERROR_XREXPORT_WRITEOUTPUT1;
+	}
+
+	winreg::keyHandle key;
+	key.open(input_hive, input_key, KEY_READ | input_redirection);
+	r = convertKeyToRegFile(key, input_key, output_hive, output_key, out, filter, skip_errors);
+	bool saved = out.close();
+	if (r && !skip_errors)
+	{
+		DeleteFileW(file.c_str());
+		return r;
+	}
+	if (!saved)
+	{
+		xrlog::error() << "failed to save output file (second attempt)";
+		return ERROR_XREXPORT_WRITEOUTPUT2;
+	}
+	return 0;
+}
+// writes one value from the raw bytes, so each value is read from the registry only once
+static void writeJsonValue(jsonfile::writer& out, unsigned long type, const string& bytes)
+{
+	out.key(L"type");
+	out.string(xrutils::propTypeToString(type));
+	out.key(L"data");
 
-		pugi::xml_document doc;
+	const unsigned char* data = (const unsigned char*)bytes.data();
+	switch (type)
+	{
+	case REG_QWORD:
+	{
+		long long value = 0;
+		if (bytes.length() >= sizeof(value)) memcpy(&value, data, sizeof(value));
+		out.number(value);
+	}
+		break;
+
+	case REG_DWORD:
+	case REG_DWORD_BIG_ENDIAN:
+	{
+		unsigned long value = 0;
+		if (bytes.length() >= 4)
+		{
+			if (type == REG_DWORD) value = data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned long)data[3] << 24);
+			else value = data[3] | (data[2] << 8) | (data[1] << 16) | ((unsigned long)data[0] << 24);
+		}
+		out.number((long)value);
+	}
+		break;
 
-		pugi::xml_node decl = doc.prepend_child(pugi::node_declaration);
-		decl.append_attribute(L"version") = L"1.0";
-		decl.append_attribute(L"encoding") = L"utf-8";
+	case REG_SZ:
+	case REG_EXPAND_SZ:
+	{
+		wstring value((const wchar_t*)data, bytes.length() / sizeof(wchar_t));
+		while (value.length() > 0 && value.back() == L'\0') value.pop_back();
+		out.string(value);
+	}
+		break;
 
-		//save empty document now to quickly detect filesystem permission denial
-		if (!doc.save_file(file.c_str(), L"\t", 1, pugi::encoding_utf8))
+	case REG_MULTI_SZ:
+	{
+		const wchar_t* text = (const wchar_t*)data;
+		size_t length = bytes.length() / sizeof(wchar_t);
+		out.beginArray();
+		size_t start = 0;
+		for (size_t i = 0; i < length; ++i)
 		{
-			wcout << "error: failed to save output file" << endl;
-			return ERROR_XREXPORT_WRITEOUTPUT1;
+			if (text[i] != L'\0') continue;
+			// the list ends with an empty string
+			if (i == start) break;
+			out.string(wstring(text + start, i - start));
+			start = i + 1;
 		}
+		out.endArray();
+	}
+		break;
 
-		try
+	default:
+		out.string(wstring_from_utf8(b64encode(bytes.data(), bytes.length())));
+		break;
+	}
+}
+
+// every key is an object with "values" and "keys" members, both left out when empty
+class jsonFileWriter
+{
+	const wstring& path;
+	jsonfile::writer& out;
+	const xrfilter::keyFilter& filter;
+	bool skip_errors;
+	vector<wstring> properties;
+	string bytes;
+	size_t depth = 0;
+	bool root_keys = false;
+
+public:
+	jsonFileWriter(const wstring& path, jsonfile::writer& out, const xrfilter::keyFilter& filter, bool skip_errors)
+		: path(path), out(out), filter(filter), skip_errors(skip_errors) {}
+
+	int enterKey(const wstring& name)
+	{
+		++depth;
+		out.key(name);
+		out.beginObject();
+		return 0;
+	}
+
+	int visitKey(const winreg::keyHandle& key, const vector<wstring>& subkeys, const xrfilter::position& position)
+	{
+		if (position.included) key.values(properties);
+		else properties.clear();
+		xrprogress::addValues(properties.size());
+		if (properties.size() > 0)
 		{
-			auto root = doc.append_child(L"fragment");
-			root.append_attribute(L"hive").set_value(xrutils::hiveToString(output_hive).c_str());
-			if (output_key.length() > 0) root.append_attribute(L"key").set_value(output_key.c_str());
-			if (output_redirection) root.append_attribute(L"redirection").set_value(xrutils::redirectionToString(output_redirection).c_str());
-			int r = convertKey(input_hive, input_key, input_redirection, root, skip_errors);
-			if (r && !skip_errors)
+			out.key(L"values");
+			out.beginObject();
+			for (auto& property : properties)
 			{
-				DeleteFileW(file.c_str());
-				return r;
-			}
-			if (!doc.save_file(file.c_str(), L"\t", 1, pugi::encoding_utf8))
-			{
-				wcout << "error: failed to save output file (second attempt)" << endl;
-				return ERROR_XREXPORT_WRITEOUTPUT2;
+				unsigned long type;
+				if (!key.read(property, bytes, type))
+				{
+					xrlog::error() << "failed to read value " << property << "\n\tat " << path;
+					if (!skip_errors) return ERROR_XREXPORT_READVALUE;
+					continue;
+				}
+				if (!filter.wantsType(type)) continue;
+				out.key(property);
+				out.beginObject();
+				writeJsonValue(out, type, bytes);
+				out.endObject();
 			}
-			return 0;
+			out.endObject();
 		}
-		catch (...)
+
+		// closed by leaveKey, or by finish for the root
+		if (subkeys.size() > 0)
 		{
-			DeleteFileW(file.c_str());
-			throw;
+			if (depth == 0) root_keys = true;
+			out.key(L"keys");
+			out.beginObject();
 		}
+		return 0;
+	}
+
+	int leaveKey(const vector<wstring>& subkeys)
+	{
+		--depth;
+		if (subkeys.size() > 0) out.endObject();
+		out.endObject();
+		return 0;
 	}
-	else
+
+	void finish()
 	{
-		wcout << "error: input key does not exist" << endl;
+		if (root_keys) out.endObject();
+	}
+};
+
+int convertKeyToJson(const winreg::keyHandle& key, wstring& path, jsonfile::writer& out, const xrfilter::keyFilter& filter, bool skip_errors)
+{
+	jsonFileWriter writer(path, out, filter, skip_errors);
+	int r = walkKeys(key, path, filter, writer);
+	if (!r) writer.finish();
+	return r;
+}
+
+int export_jsonfile(wstring file, HKEY input_hive, wstring input_key, REGSAM input_redirection, HKEY output_hive, wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors)
+{
+	xrlog::info() << "exporting to file " << file << "\nfrom (" << xrutils::redirectionToString(input_redirection) << ") "
+		<< xrutils::hiveToString(input_hive) << ":\\" << input_key;
+
+	if (!winreg::keyExists(input_hive, input_key, input_redirection))
+	{
+		xrlog::error() << "input key does not exist";
 		return ERROR_XREXPORT_NOKEY;
 	}
-	return ERROR_XRGENERAL_FAILURE;
-}
\ No newline at end of file
+
+	int r = checkOutputFile(file, unattended);
+	if (r) return r;
+
+	jsonfile::writer out;
+	if (!out.open(file))
+	{
+		xrlog::error() << "failed to save output file";
+		return ERROR_XREXPORT_WRITEOUTPUT1;
+	}
+
+	out.beginObject();
+	out.key(L"hive");
+	out.string(xrutils::hiveToString(output_hive));
+	if (output_key.length() > 0)
+	{
+		out.key(L"key");
+		out.string(output_key);
+	}
+	if (output_redirection)
+	{
+		out.key(L"redirection");
+		out.string(xrutils::redirectionToString(output_redirection));
+	}
+	winreg::keyHandle key;
+	key.open(input_hive, input_key, KEY_READ | input_redirection);
+	r = convertKeyToJson(key, input_key, out, filter, skip_errors);
+	if (!r) out.endObject();
+
+	bool saved = out.close();
+	if (r && !skip_errors)
+	{
+		DeleteFileW(file.c_str());
+		return r;
+	}
+	if (!saved)
+	{
+		xrlog::error() << "failed to save output file (second attempt)";
+		return ERROR_XREXPORT_WRITEOUTPUT2;
+	}
+	return 0;
+}
+
+// writes the walk into another key as it goes, for --copy when RegCopyTreeW cannot be used
+// 'Writer' is winreg::keyWriter or winefile::keyWriter, the caller opens destination() on the copy of the root
+template<class Handle, class Writer>
+class keyCopier
+{
+	const wstring& path;
+	const replacement_rules& rules;
+	const xrfilter::keyFilter& filter;
+	bool skip_errors;
+	// one open destination key per level of the walk
+	keyStack<Writer> writers;
+	// depth of the first key that could not be created, nothing below it is written
+	size_t failed_depth = 0;
+	vector<wstring> properties;
+	vector<winreg::valueRecord> values;
+	vector<size_t> failed;
+
+public:
+	keyCopier(const wstring& path, const replacement_rules& rules, const xrfilter::keyFilter& filter, bool skip_errors)
+		: path(path), rules(rules), filter(filter), skip_errors(skip_errors)
+	{
+		writers.push();
+	}
+
+	Writer& destination() { return writers.top(); }
+
+	int enterKey(const wstring& name)
+	{
+		Writer& parent = writers.top();
+		Writer& child = writers.push();
+		if (failed_depth || child.open(parent, name)) return 0;
+
+		xrlog::error() << "failed to create the copy of " << path << L"\\" << name;
+		if (!skip_errors) return ERROR_XRCOPY_CREATEKEY;
+		failed_depth = writers.size();
+		return 0;
+	}
+
+	int visitKey(const Handle& key, const vector<wstring>&, const xrfilter::position& position)
+	{
+		if (failed_depth || !position.included) return 0;
+
+		key.values(properties);
+		xrprogress::addValues(properties.size());
+		size_t count = 0;
+		for (auto& property : properties)
+		{
+			if (count == values.size()) values.emplace_back();
+			winreg::valueRecord& value = values[count];
+			if (!key.read(property, value.data, value.type))
+			{
+				xrlog::error() << "failed to read value " << property << "\n\tat " << path;
+				if (!skip_errors) return ERROR_XRCOPY_READVALUE;
+				continue;
+			}
+			if (!filter.wantsType(value.type)) continue;
+			value.name = property;
+			replace_value(rules, value.type, value.data);
+			++count;
+		}
+		values.resize(count);
+
+		if (writers.top().write(values, failed)) return 0;
+		for (size_t i : failed)
+			xrlog::error() << "failed to write " << xrutils::propTypeToString(values[i].type) << ": " << values[i].name << "\n\tcopied from " << path;
+		return skip_errors ? 0 : ERROR_XRCOPY_WRITEVALUE;
+	}
+
+	int leaveKey(const vector<wstring>&)
+	{
+		if (failed_depth == writers.size()) failed_depth = 0;
+		writers.top().close();
+		writers.pop();
+		return 0;
+	}
+};
+
+// a key copied into itself or into one of its subkeys would copy its own copy, and the other way around
+static bool nestedKeys(HKEY a_hive, const wstring& a, HKEY b_hive, const wstring& b)
+{
+	if (!winreg::hivesOverlap(a_hive, b_hive)) return false;
+	size_t common = min(a.length(), b.length());
+	if (_wcsnicmp(a.c_str(), b.c_str(), common) != 0) return false;
+	const wstring& longer = a.length() > b.length() ? a : b;
+	return common == 0 || common == longer.length() || longer[common] == L'\\';
+}
+
+static int checkCopyTarget(bool exists, bool unattended)
+{
+	if (!exists) return 0;
+	xrlog::warning() << "target key already exists, trees will be merged and some values might be overwritten";
+	if (unattended) return 0;
+
+	wstring option;
+	xrlog::flush();
+	wcout << "continue? (y/N): ";
+	wcin >> option;
+	transform(option.begin(), option.end(), option.begin(), ::tolower);
+	bool ok_to_go = option == L"1" || option == L"y" || option == L"yes" || option == L"true";
+	return ok_to_go ? 0 : ERROR_XRGENERAL_FAILURE;
+}
+
+static void describeCopy(const wchar_t* where, HKEY src_hive, const wstring& src_key, REGSAM src_redirection,
+	HKEY dst_hive, const wstring& dst_key, REGSAM dst_redirection)
+{
+	xrlog::info() << "copying" << where << "\nfrom (" << xrutils::redirectionToString(src_redirection) << ") "
+		<< xrutils::hiveToString(src_hive) << ":\\" << src_key
+		<< "\nto (" << xrutils::redirectionToString(dst_redirection) << ") " << xrutils::hiveToString(dst_hive) << ":\\" << dst_key;
+}
+
+int copy_reg(HKEY src_hive, wstring src_key, REGSAM src_redirection, HKEY dst_hive, wstring dst_key, REGSAM dst_redirection,
+	const replacement_rules& rules, const xrfilter::keyFilter& filter, bool unattended, bool skip_errors)
+{
+	describeCopy(L"", src_hive, src_key, src_redirection, dst_hive, dst_key, dst_redirection);
+
+	if (!winreg::keyExists(src_hive, src_key, src_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XRCOPY_NOKEY;
+	}
+	if (nestedKeys(src_hive, src_key, dst_hive, dst_key))
+	{
+		xrlog::error() << "cannot copy a key into itself, one of its subkeys or one of its parents";
+		return ERROR_XRCOPY_NESTED;
+	}
+	int r = checkCopyTarget(winreg::keyExists(dst_hive, dst_key, dst_redirection), unattended);
+	if (r) return r;
+
+	xrfilter::position position;
+	if (!filter.start(position)) return 0;
+
+	// a tree that goes over unchanged, within one view, is copied by the registry itself in a single call
+	if (rules.empty() && !filter.filtersKeys() && !filter.filtersTypes() && src_redirection == dst_redirection)
+	{
+		xrtrace::keySpan span(src_key);
+		if (winreg::copyKey(src_hive, src_key, dst_hive, dst_key, src_redirection, dst_redirection)) return 0;
+		// what was copied is merged again, and the key that fails is reported
+		xrlog::warning() << "RegCopyTree failed, copying key by key";
+	}
+
+	winreg::keyHandle source;
+	source.open(src_hive, src_key, KEY_READ | src_redirection);
+	keyCopier<winreg::keyHandle, winreg::keyWriter> copier(src_key, rules, filter, skip_errors);
+	if (!copier.destination().open(dst_hive, dst_key, dst_redirection))
+	{
+		xrlog::error() << "failed to create key: " << xrutils::redirectionToString(dst_redirection) << dst_key;
+		return ERROR_XRCOPY_CREATEKEY;
+	}
+
+	xrprogress::display progress(L"copying", xrprogress::MEASURE_ITEMS);
+	return walkKeys(source, src_key, filter, copier);
+}
+
+int copy_wine(wstring wine_file, HKEY src_hive, wstring src_key, REGSAM src_redirection, HKEY dst_hive, wstring dst_key, REGSAM dst_redirection,
+	const replacement_rules& rules, const xrfilter::keyFilter& filter, bool unattended, bool skip_errors)
+{
+	describeCopy((L" in wine registry " + wine_file).c_str(), src_hive, src_key, src_redirection, dst_hive, dst_key, dst_redirection);
+
+	winefile::registry registry;
+	wstring error;
+	if (!registry.load(wine_file, error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_LOAD;
+	}
+
+	winefile::keyHandle source;
+	if (!source.open(registry, src_hive, src_key, src_redirection))
+	{
+		xrlog::error() << "input key does not exist";
+		return ERROR_XRCOPY_NOKEY;
+	}
+	if (nestedKeys(src_hive, src_key, dst_hive, dst_key))
+	{
+		xrlog::error() << "cannot copy a key into itself, one of its subkeys or one of its parents";
+		return ERROR_XRCOPY_NESTED;
+	}
+	int r = checkCopyTarget(registry.keyExists(dst_hive, dst_key, dst_redirection), unattended);
+	if (r) return r;
+
+	xrfilter::position position;
+	if (!filter.start(position)) return 0;
+
+	// keys of the in-memory tree do not move when others are added, the source stays valid while the copy grows
+	keyCopier<winefile::keyHandle, winefile::keyWriter> copier(src_key, rules, filter, skip_errors);
+	if (!copier.destination().open(registry, dst_hive, dst_key, dst_redirection))
+	{
+		xrlog::error() << xrutils::hiveToString(dst_hive) << " is not in " << wine_file;
+		return ERROR_XRCOPY_CREATEKEY;
+	}
+
+	// the file is only written if the whole tree could be copied
+	{
+		xrprogress::display progress(L"copying", xrprogress::MEASURE_ITEMS);
+		r = walkKeys(source, src_key, filter, copier);
+	}
+	if (r) return r;
+	if (!registry.save(error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_SAVE;
+	}
+	return 0;
+}
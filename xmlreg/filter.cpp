@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "filter.h"
+
+#include <cwctype>
+#include <algorithm>
+
+using namespace std;
+
+namespace xrfilter {
+
+	struct node
+	{
+		map<wstring, unique_ptr<node>> names;				// plain components, lowercase
+		vector<pair<wstring, unique_ptr<node>>> globs;		// components with * or ?, lowercase
+		unique_ptr<node> any;								// a ** component
+		bool star = false;									// this node is a **, it matches any number of keys
+		bool include_end = false;
+		bool exclude_end = false;
+	};
+
+	static wstring lower(const wstring& text)
+	{
+		wstring ret = text;
+		transform(ret.begin(), ret.end(), ret.begin(), ::towlower);
+		return ret;
+	}
+
+	// * matches any run of characters and ? one character, both within a single key name
+	static bool globMatch(const wstring& pattern, const wstring& name)
+	{
+		size_t p = 0, n = 0;
+		size_t star = wstring::npos, resume = 0;
+		while (n < name.length())
+		{
+			if (p < pattern.length() && (pattern[p] == L'?' || pattern[p] == name[n]))
+			{
+				++p;
+				++n;
+			}
+			else if (p < pattern.length() && pattern[p] == L'*')
+			{
+				star = p++;
+				resume = n;
+			}
+			else if (star != wstring::npos)
+			{
+				p = star + 1;
+				n = ++resume;
+			}
+			else return false;
+		}
+		while (p < pattern.length() && pattern[p] == L'*') ++p;
+		return p == pattern.length();
+	}
+
+	// a node and the ** nodes that follow it, since those also match zero keys
+	static void reach(position& p, const node* n)
+	{
+		while (n)
+		{
+			if (find(p.nodes.begin(), p.nodes.end(), n) == p.nodes.end()) p.nodes.push_back(n);
+			n = n->any.get();
+		}
+	}
+
+	// the included flag of a position that has just been reached, false if it is excluded
+	static bool settle(position& p)
+	{
+		for (const node* n : p.nodes)
+		{
+			if (n->exclude_end) return false;
+			if (n->include_end) p.included = true;
+		}
+		return true;
+	}
+
+	keyFilter::keyFilter() : root(new node())
+	{
+	}
+
+	keyFilter::keyFilter(keyFilter&&) = default;
+	keyFilter& keyFilter::operator=(keyFilter&&) = default;
+
+	keyFilter::~keyFilter()
+	{
+	}
+
+	void keyFilter::add(const wstring& pattern, bool include)
+	{
+		node* current = root.get();
+		size_t start = 0;
+		while (start <= pattern.length())
+		{
+			size_t end = pattern.find(L'\\', start);
+			if (end == wstring::npos) end = pattern.length();
+			wstring name = lower(pattern.substr(start, end - start));
+			start = end + 1;
+			if (name.length() == 0) continue;
+
+			if (name == L"**")
+			{
+				if (!current->any)
+				{
+					current->any.reset(new node());
+					current->any->star = true;
+				}
+				current = current->any.get();
+			}
+			else if (name.find_first_of(L"*?") != wstring::npos)
+			{
+				auto it = find_if(current->globs.begin(), current->globs.end(),
+					[&name](const pair<wstring, unique_ptr<node>>& glob) { return glob.first == name; });
+				if (it == current->globs.end())
+				{
+					current->globs.emplace_back(name, unique_ptr<node>(new node()));
+					it = current->globs.end() - 1;
+				}
+				current = it->second.get();
+			}
+			else
+			{
+				unique_ptr<node>& next = current->names[name];
+				if (!next) next.reset(new node());
+				current = next.get();
+			}
+		}
+
+		if (include) current->include_end = has_includes = true;
+		else current->exclude_end = has_excludes = true;
+	}
+
+	void keyFilter::include(const wstring& pattern)
+	{
+		add(pattern, true);
+	}
+
+	void keyFilter::exclude(const wstring& pattern)
+	{
+		add(pattern, false);
+	}
+
+	void keyFilter::allowType(unsigned long type)
+	{
+		types.push_back(type);
+	}
+
+	bool keyFilter::start(position& p) const
+	{
+		p.nodes.clear();
+		p.included = !has_includes;
+		if (!has_includes && !has_excludes) return true;
+		reach(p, root.get());
+		return settle(p);
+	}
+
+	bool keyFilter::enter(const position& parent, const wstring& name, position& child) const
+	{
+		child.nodes.clear();
+		child.included = parent.included;
+		// nothing left to match, the whole subtree is in or out
+		if (parent.nodes.empty()) return child.included;
+
+		wstring lname = lower(name);
+		for (const node* n : parent.nodes)
+		{
+			if (n->star) reach(child, n);
+			auto it = n->names.find(lname);
+			if (it != n->names.end()) reach(child, it->second.get());
+			for (auto& glob : n->globs)
+				if (globMatch(glob.first, lname)) reach(child, glob.second.get());
+		}
+
+		if (!settle(child)) return false;
+		return child.included || child.nodes.size() > 0;
+	}
+
+	bool keyFilter::locate(const wstring& path, position& p) const
+	{
+		if (!start(p)) return false;
+		position parent;
+		size_t begin = 0;
+		while (begin < path.length())
+		{
+			size_t end = path.find(L'\\', begin);
+			if (end == wstring::npos) end = path.length();
+			if (end > begin)
+			{
+				swap(parent, p);
+				if (!enter(parent, path.substr(begin, end - begin), p)) return false;
+			}
+			begin = end + 1;
+		}
+		return true;
+	}
+
+	bool keyFilter::wantsType(unsigned long type) const
+	{
+		return types.empty() || find(types.begin(), types.end(), type) != types.end();
+	}
+}
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// --include/--exclude patterns and --value-types, compiled into a trie of path components
+// traversals keep a position per level and ask the filter before opening a subkey, so excluded subtrees are never read
+//
+// patterns are key paths relative to the root of the operation (the key of the fragment, or the input key of an export),
+// or relative to the hive for .reg files, which name every key in full; components are matched without case,
+// can use * and ?, and a ** component matches any number of keys; a pattern applies to the key it names and everything below it
+namespace xrfilter {
+
+	struct node;
+
+	// where a traversal is in the trie
+	struct position
+	{
+		std::vector<const node*> nodes;		// patterns that can still match something below
+		bool included = true;				// the values of the key are wanted
+	};
+
+	class keyFilter
+	{
+		std::unique_ptr<node> root;
+		bool has_includes = false;
+		bool has_excludes = false;
+		std::vector<unsigned long> types;
+
+		void add(const std::wstring& pattern, bool include);
+
+	public:
+		keyFilter();
+		keyFilter(keyFilter&&);
+		keyFilter& operator=(keyFilter&&);
+		~keyFilter();
+
+		// with includes, keys that are not below one of them are only walked through on the way to one, their values are left out
+		void include(const std::wstring& pattern);
+		// wins over include
+		void exclude(const std::wstring& pattern);
+		// values of other types are left out, all types are kept if this is never called
+		void allowType(unsigned long type);
+		bool filtersKeys() const { return has_includes || has_excludes; }
+		bool filtersTypes() const { return !types.empty(); }
+
+		// false if the root itself is excluded
+		bool start(position& p) const;
+		// the position of subkey 'name', false if it is excluded or cannot lead to an included key
+		bool enter(const position& parent, const std::wstring& name, position& child) const;
+		// the same for a path below the root, one component at a time
+		bool locate(const std::wstring& path, position& p) const;
+
+		bool wantsType(unsigned long type) const;
+		bool wantsValue(const position& p, unsigned long type) const { return p.included && wantsType(type); }
+	};
+}
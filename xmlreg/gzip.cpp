@@ -0,0 +1,633 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "gzip.h"
+#include "stats.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <windows.h>
+
+using namespace std;
+
+namespace gzip {
+
+	static const size_t window_size = 32768;
+
+	// deflate length and distance codes (rfc 1951, 3.2.5)
+	static const unsigned short length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const unsigned char length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const unsigned short distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const unsigned char distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	struct crcTable
+	{
+		unsigned long entries[256];
+
+		crcTable()
+		{
+			for (unsigned long n = 0; n < 256; ++n)
+			{
+				unsigned long c = n;
+				for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+				entries[n] = c;
+			}
+		}
+	};
+
+	static unsigned long crc32(unsigned long crc, const unsigned char* data, size_t length)
+	{
+		static const crcTable table;
+		crc = crc ^ 0xFFFFFFFFUL;
+		for (size_t i = 0; i < length; ++i) crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return crc ^ 0xFFFFFFFFUL;
+	}
+
+	static bool endsWith(const wstring& text, const wchar_t* suffix)
+	{
+		size_t length = wcslen(suffix);
+		return text.length() > length && _wcsicmp(text.c_str() + text.length() - length, suffix) == 0;
+	}
+
+	codec detect(const wstring& file)
+	{
+		FILE* f = nullptr;
+		if (_wfopen_s(&f, file.c_str(), L"rb") || !f) return CODEC_NONE;
+		unsigned char magic[4] = { 0 };
+		size_t read = fread(magic, 1, sizeof(magic), f);
+		fclose(f);
+		return detect(magic, read);
+	}
+
+	codec detect(const void* data, size_t size)
+	{
+		const unsigned char* magic = (const unsigned char*)data;
+		if (size >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) return CODEC_GZIP;
+		if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) return CODEC_ZSTD;
+		return CODEC_NONE;
+	}
+
+	bool selected(const wstring& file)
+	{
+		return endsWith(file, L".gz");
+	}
+
+	// canonical huffman code, with a lookup table for codes up to 9 bits
+	struct huffman
+	{
+		unsigned short count[16];
+		unsigned short symbol[288];
+		unsigned short fast[512];		// symbol | length << 12, 0 if the code is longer
+
+		bool build(const unsigned char* lengths, int n)
+		{
+			memset(count, 0, sizeof(count));
+			memset(fast, 0, sizeof(fast));
+			for (int i = 0; i < n; ++i) count[lengths[i]]++;
+			count[0] = 0;
+
+			int left = 1;
+			for (int len = 1; len < 16; ++len)
+			{
+				left <<= 1;
+				left -= count[len];
+				if (left < 0) return false;
+			}
+
+			unsigned short offsets[16];
+			offsets[1] = 0;
+			for (int len = 1; len < 15; ++len) offsets[len + 1] = offsets[len] + count[len];
+			for (int i = 0; i < n; ++i)
+				if (lengths[i]) symbol[offsets[lengths[i]]++] = (unsigned short)i;
+
+			// codes are stored most significant bit first, the stream is read least significant bit first
+			int code = 0, index = 0;
+			for (int len = 1; len <= 9; ++len)
+			{
+				for (int k = 0; k < count[len]; ++k, ++code, ++index)
+				{
+					int reversed = 0;
+					for (int b = 0; b < len; ++b) reversed |= ((code >> b) & 1) << (len - 1 - b);
+					for (int fill = reversed; fill < 512; fill += 1 << len)
+						fast[fill] = (unsigned short)(symbol[index] | (len << 12));
+				}
+				code <<= 1;
+			}
+			return true;
+		}
+	};
+
+	// the codes used by blocks of type 1 (rfc 1951, 3.2.6)
+	struct fixedTables
+	{
+		huffman literals, distances;
+
+		fixedTables()
+		{
+			unsigned char lengths[288];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			literals.build(lengths, 288);
+			memset(lengths, 5, 30);
+			distances.build(lengths, 30);
+		}
+	};
+
+	class inflater
+	{
+		// reads 'file' in chunks, or walks 'input' when it is already in memory
+		FILE* file;
+		unsigned char chunk[65536];
+		const unsigned char* input = chunk;
+		size_t pos = 0, size = 0;
+		unsigned long long bitbuf = 0;
+		int bitcnt = 0;
+
+	public:
+		string& out;
+		wstring error;
+
+		inflater(FILE* file, string& out) : file(file), out(out) {}
+		inflater(const void* data, size_t length, string& out) : file(nullptr), input((const unsigned char*)data), size(length), out(out) {}
+
+		bool fail(const wchar_t* message)
+		{
+			if (error.length() == 0) error = message;
+			return false;
+		}
+
+		void fill()
+		{
+			while (bitcnt <= 56)
+			{
+				if (pos == size)
+				{
+					if (!file) return;
+					size = fread(chunk, 1, sizeof(chunk), file);
+					pos = 0;
+					if (size == 0) return;
+				}
+				bitbuf |= (unsigned long long)input[pos++] << bitcnt;
+				bitcnt += 8;
+			}
+		}
+
+		bool bits(int n, unsigned& value)
+		{
+			if (bitcnt < n) fill();
+			if (bitcnt < n) return fail(L"unexpected end of compressed data");
+			value = (unsigned)(bitbuf & ((1ULL << n) - 1));
+			bitbuf >>= n;
+			bitcnt -= n;
+			return true;
+		}
+
+		bool atEnd()
+		{
+			fill();
+			return bitcnt == 0;
+		}
+
+		void align()
+		{
+			bitbuf >>= bitcnt % 8;
+			bitcnt -= bitcnt % 8;
+		}
+
+		bool decode(const huffman& h, int& symbol)
+		{
+			if (bitcnt < 15) fill();
+
+			unsigned short entry = h.fast[bitbuf & 511];
+			if (entry && (entry >> 12) <= bitcnt)
+			{
+				bitbuf >>= entry >> 12;
+				bitcnt -= entry >> 12;
+				symbol = entry & 0xFFF;
+				return true;
+			}
+
+			int code = 0, first = 0, index = 0;
+			for (int len = 1; len < 16 && len <= bitcnt; ++len)
+			{
+				code |= (bitbuf >> (len - 1)) & 1;
+				int count = h.count[len];
+				if (code - count < first)
+				{
+					bitbuf >>= len;
+					bitcnt -= len;
+					symbol = h.symbol[index + (code - first)];
+					return true;
+				}
+				index += count;
+				first += count;
+				first <<= 1;
+				code <<= 1;
+			}
+			return fail(L"invalid huffman code");
+		}
+
+		bool stored()
+		{
+			align();
+			unsigned length, complement;
+			if (!bits(16, length) || !bits(16, complement)) return false;
+			if (length != (~complement & 0xFFFF)) return fail(L"corrupt stored block");
+			for (unsigned i = 0; i < length; ++i)
+			{
+				unsigned c;
+				if (!bits(8, c)) return false;
+				out += (char)c;
+			}
+			return true;
+		}
+
+		bool codes(const huffman& literals, const huffman& distances)
+		{
+			while (true)
+			{
+				int symbol;
+				if (!decode(literals, symbol)) return false;
+				if (symbol < 256)
+				{
+					out += (char)symbol;
+					continue;
+				}
+				if (symbol == 256) return true;
+
+				symbol -= 257;
+				if (symbol >= 29) return fail(L"invalid length code");
+				unsigned extra;
+				if (!bits(length_extra[symbol], extra)) return false;
+				size_t length = length_base[symbol] + extra;
+
+				if (!decode(distances, symbol)) return false;
+				if (symbol >= 30) return fail(L"invalid distance code");
+				if (!bits(distance_extra[symbol], extra)) return false;
+				size_t distance = distance_base[symbol] + extra;
+				if (distance > out.length()) return fail(L"distance too far back");
+
+				size_t from = out.length() - distance;
+				for (size_t i = 0; i < length; ++i) out += out[from + i];
+			}
+		}
+
+		bool fixed()
+		{
+			static const fixedTables tables;
+			return codes(tables.literals, tables.distances);
+		}
+
+		bool dynamic()
+		{
+			static const unsigned char order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+			unsigned nlen, ndist, ncode;
+			if (!bits(5, nlen) || !bits(5, ndist) || !bits(4, ncode)) return false;
+			nlen += 257;
+			ndist += 1;
+			ncode += 4;
+			if (nlen > 286 || ndist > 30) return fail(L"bad counts in dynamic block");
+
+			unsigned char lengths[320] = { 0 };
+			for (unsigned i = 0; i < ncode; ++i)
+			{
+				unsigned value;
+				if (!bits(3, value)) return false;
+				lengths[order[i]] = (unsigned char)value;
+			}
+
+			huffman lencode;
+			if (!lencode.build(lengths, 19)) return fail(L"bad code lengths in dynamic block");
+
+			memset(lengths, 0, sizeof(lengths));
+			unsigned index = 0;
+			while (index < nlen + ndist)
+			{
+				int symbol;
+				if (!decode(lencode, symbol)) return false;
+				if (symbol < 16)
+				{
+					lengths[index++] = (unsigned char)symbol;
+					continue;
+				}
+
+				unsigned char repeat = 0;
+				unsigned times;
+				if (symbol == 16)
+				{
+					if (index == 0) return fail(L"repeat with no previous length");
+					repeat = lengths[index - 1];
+					if (!bits(2, times)) return false;
+					times += 3;
+				}
+				else if (symbol == 17)
+				{
+					if (!bits(3, times)) return false;
+					times += 3;
+				}
+				else
+				{
+					if (!bits(7, times)) return false;
+					times += 11;
+				}
+				if (index + times > nlen + ndist) return fail(L"too many lengths in dynamic block");
+				while (times--) lengths[index++] = repeat;
+			}
+			if (lengths[256] == 0) return fail(L"no end of block code");
+
+			huffman literals, distances;
+			if (!literals.build(lengths, nlen) || !distances.build(lengths + nlen, ndist))
+				return fail(L"bad literal or distance lengths");
+			return codes(literals, distances);
+		}
+
+		bool deflate()
+		{
+			unsigned last, type;
+			do
+			{
+				if (!bits(1, last) || !bits(2, type)) return false;
+				bool ok = type == 0 ? stored() : type == 1 ? fixed() : type == 2 ? dynamic() : fail(L"invalid block type");
+				if (!ok) return false;
+			} while (!last);
+			return true;
+		}
+
+		bool readLE(int bytes, unsigned long& value)
+		{
+			value = 0;
+			for (int i = 0; i < bytes; ++i)
+			{
+				unsigned c;
+				if (!bits(8, c)) return false;
+				value |= (unsigned long)c << (8 * i);
+			}
+			return true;
+		}
+
+		bool skipString()
+		{
+			unsigned c;
+			do
+			{
+				if (!bits(8, c)) return false;
+			} while (c);
+			return true;
+		}
+
+		// one gzip member (rfc 1952, 2.3), files may hold several of them back to back
+		bool member()
+		{
+			unsigned id1, id2, method, flags, ignored;
+			if (!bits(8, id1) || !bits(8, id2) || !bits(8, method) || !bits(8, flags)) return false;
+			if (id1 != 0x1F || id2 != 0x8B) return fail(L"not a gzip file");
+			if (method != 8) return fail(L"unknown compression method");
+			for (int i = 0; i < 6; ++i)
+				if (!bits(8, ignored)) return false;		// mtime, xfl, os
+
+			if (flags & 4)
+			{
+				unsigned long length;
+				if (!readLE(2, length)) return false;
+				while (length--)
+					if (!bits(8, ignored)) return false;
+			}
+			if ((flags & 8) && !skipString()) return false;
+			if ((flags & 16) && !skipString()) return false;
+			if ((flags & 2) && !bits(16, ignored)) return false;
+
+			size_t start = out.length();
+			if (!deflate()) return false;
+
+			align();
+			unsigned long crc, length;
+			if (!readLE(4, crc) || !readLE(4, length)) return false;
+			if (crc != crc32(0, (const unsigned char*)out.data() + start, out.length() - start)) return fail(L"crc mismatch");
+			if (length != ((out.length() - start) & 0xFFFFFFFFUL)) return fail(L"length mismatch");
+			return true;
+		}
+
+		bool run()
+		{
+			do
+			{
+				if (!member()) return false;
+			} while (!atEnd() && (bitbuf & 0xFF) == 0x1F);
+			return true;
+		}
+	};
+
+	// the trailer holds the uncompressed size (modulo 4 GB) of the last member, but anyone can write it:
+	// it is only a hint, capped to what text registry dumps usually compress from, and the string grows past it
+	static void reserveFor(string& data, const unsigned char* trailer, unsigned long long compressed)
+	{
+		unsigned long long claimed = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned long long)trailer[3] << 24);
+		data.reserve((size_t)min(claimed, compressed * 16));
+	}
+
+	bool readFile(const wstring& file, string& data, wstring& error)
+	{
+		FILE* f = nullptr;
+		if (_wfopen_s(&f, file.c_str(), L"rb") || !f)
+		{
+			error = L"cannot open " + file;
+			return false;
+		}
+
+		unsigned char trailer[4];
+		if (_fseeki64(f, -4, SEEK_END) == 0 && fread(trailer, 1, 4, f) == 4)
+			reserveFor(data, trailer, (unsigned long long)_ftelli64(f));
+		_fseeki64(f, 0, SEEK_SET);
+
+		xrstats::timer t(xrstats::PHASE_COMPRESSION);
+		inflater in(f, data);
+		bool ok = in.run();
+		fclose(f);
+		if (!ok) error = in.error + L" in " + file;
+		return ok;
+	}
+
+	bool inflate(const void* compressed, size_t size, string& data, wstring& error)
+	{
+		if (size >= 4) reserveFor(data, (const unsigned char*)compressed + size - 4, size);
+
+		xrstats::timer t(xrstats::PHASE_COMPRESSION);
+		inflater in(compressed, size, data);
+		bool ok = in.run();
+		if (!ok) error = in.error;
+		return ok;
+	}
+
+	static unsigned hash(const unsigned char* p)
+	{
+		return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & 0x7FFF;
+	}
+
+	deflater::deflater() : head(1 << 15)
+	{
+		// no file name, no modification time, os = ntfs
+		static const unsigned char header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 11 };
+		out.assign((const char*)header, sizeof(header));
+	}
+
+	void deflater::put(unsigned value, int n)
+	{
+		bitbuf |= (unsigned long long)value << bitcnt;
+		bitcnt += n;
+		while (bitcnt >= 8)
+		{
+			out += (char)(bitbuf & 0xFF);
+			bitbuf >>= 8;
+			bitcnt -= 8;
+		}
+	}
+
+	void deflater::putCode(unsigned code, int n)
+	{
+		unsigned reversed = 0;
+		for (int b = 0; b < n; ++b) reversed |= ((code >> b) & 1) << (n - 1 - b);
+		put(reversed, n);
+	}
+
+	void deflater::literal(int symbol)
+	{
+		if (symbol < 144) putCode(0x30 + symbol, 8);
+		else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+		else if (symbol < 280) putCode(symbol - 256, 7);
+		else putCode(0xC0 + symbol - 280, 8);
+	}
+
+	void deflater::match(size_t length, size_t distance)
+	{
+		int code = 28;
+		while (length_base[code] > length) --code;
+		literal(257 + code);
+		put((unsigned)(length - length_base[code]), length_extra[code]);
+
+		code = 29;
+		while (distance_base[code] > distance) --code;
+		putCode(code, 5);
+		put((unsigned)(distance - distance_base[code]), distance_extra[code]);
+	}
+
+	void deflater::block(const string& chunk)
+	{
+		crc = crc32(crc, (const unsigned char*)chunk.data(), chunk.length());
+		total += chunk.length();
+
+		string buffer = history + chunk;
+		const unsigned char* data = (const unsigned char*)buffer.data();
+		size_t n = buffer.length();
+		fill(head.begin(), head.end(), -1);
+		prev.assign(n, -1);
+
+		auto insert = [&](size_t i) {
+			if (i + 3 > n) return;
+			unsigned h = hash(data + i);
+			prev[i] = head[h];
+			head[h] = (int)i;
+		};
+
+		for (size_t i = 0; i < history.length(); ++i) insert(i);
+
+		// incompressible data is kept in stored blocks instead
+		size_t mark = out.length();
+		unsigned long long mark_bitbuf = bitbuf;
+		int mark_bitcnt = bitcnt;
+
+		put(0, 1);		// not the last block
+		put(1, 2);		// fixed huffman codes
+
+		size_t i = history.length();
+		while (i < n)
+		{
+			size_t best_length = 0, best_distance = 0;
+			if (i + 3 <= n)
+			{
+				size_t limit = min((size_t)258, n - i);
+				int candidate = head[hash(data + i)];
+				for (int chain = 0; candidate >= 0 && chain < 64 && i - candidate <= window_size; ++chain)
+				{
+					const unsigned char* a = data + candidate;
+					const unsigned char* b = data + i;
+					if (a[best_length] == b[best_length] || best_length == 0)
+					{
+						size_t length = 0;
+						while (length < limit && a[length] == b[length]) ++length;
+						if (length > best_length)
+						{
+							best_length = length;
+							best_distance = i - candidate;
+							if (length == limit) break;
+						}
+					}
+					candidate = prev[candidate];
+				}
+			}
+
+			if (best_length >= 3)
+			{
+				match(best_length, best_distance);
+				for (size_t k = 0; k < best_length; ++k) insert(i + k);
+				i += best_length;
+			}
+			else
+			{
+				literal(data[i]);
+				insert(i);
+				++i;
+			}
+		}
+
+		literal(256);
+
+		if (out.length() - mark > chunk.length() + 5 * (chunk.length() / 65535 + 1))
+		{
+			out.resize(mark);
+			bitbuf = mark_bitbuf;
+			bitcnt = mark_bitcnt;
+			for (size_t start = 0; start < chunk.length(); start += 65535)
+			{
+				unsigned length = (unsigned)min((size_t)65535, chunk.length() - start);
+				put(0, 3);
+				if (bitcnt > 0) put(0, 8 - bitcnt);
+				put(length, 16);
+				put(~length & 0xFFFF, 16);
+				out.append(chunk, start, length);
+			}
+		}
+
+		history = buffer.substr(n > window_size ? n - window_size : 0);
+	}
+
+	void deflater::finish()
+	{
+		put(1, 1);		// last block, empty
+		put(1, 2);
+		literal(256);
+		if (bitcnt > 0) put(0, 8 - bitcnt);
+		for (int i = 0; i < 4; ++i) out += (char)((crc >> (8 * i)) & 0xFF);
+		for (int i = 0; i < 4; ++i) out += (char)((total >> (8 * i)) & 0xFF);
+	}
+}
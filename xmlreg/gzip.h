@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// gzip (rfc 1952) reading and writing, with a bundled deflate implementation
+namespace gzip {
+
+	enum codec { CODEC_NONE, CODEC_GZIP, CODEC_ZSTD };
+
+	// looks at the magic bytes at the start of the file
+	codec detect(const std::wstring& file);
+	codec detect(const void* data, size_t size);
+
+	// true if 'file' has the .gz extension, output files are compressed based on their name
+	bool selected(const std::wstring& file);
+
+	// inflates the whole file into 'data', without a temporary file
+	// returns false and sets 'error' if the file cannot be read or is corrupt
+	bool readFile(const std::wstring& file, std::string& data, std::wstring& error);
+	// the same for compressed data already in memory
+	bool inflate(const void* compressed, size_t size, std::string& data, std::wstring& error);
+
+	// lz77 with hash chains, coded with the fixed huffman tables
+	// the last 32 kB of each block are kept so matches can reach across blocks
+	class deflater
+	{
+		std::string history;
+		std::vector<int> head;
+		std::vector<int> prev;
+		unsigned long long bitbuf = 0;
+		int bitcnt = 0;
+		unsigned long crc = 0;
+		unsigned long long total = 0;
+
+		void put(unsigned value, int n);
+		void putCode(unsigned code, int n);
+		void literal(int symbol);
+		void match(size_t length, size_t distance);
+
+	public:
+		// compressed bytes not taken by the caller yet, starting with the gzip header
+		std::string out;
+
+		deflater();
+		void block(const std::string& chunk);
+		// appends the last block and the gzip trailer
+		void finish();
+	};
+}
@@ -19,12 +19,26 @@ freely, subject to the following restrictions:
 */
 
 #include "xmlreg.h"
+#include "log.h"
 #include "registry.h"
+#include "stats.h"
+#include "trace.h"
+#include "regfile.h"
+#include "jsonfile.h"
+#include "document.h"
+#include "base64.h"
+#include "winefile.h"
+#include "progress.h"
+#include "journal.h"
+#include "undo.h"
+#include "keystack.hpp"
 
 #include <pugixml.hpp>
 
 #include <map>
+#include <set>
 #include <regex>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -32,255 +46,1061 @@ freely, subject to the following restrictions:
 
 using namespace std;
 
-int workOnProperty(HKEY hive, const wstring& key, REGSAM redirection, const vector<pair<wregex, wstring>>& replacements, pugi::xml_node& node, bool skip_errors)
+// like pugi's as_llong, 0 if the text is not a number
+static long long parseInteger(const wstring& text)
 {
-	wstring name = node.attribute(L"name").value();
-	wstring stype = node.attribute(L"type").value();
-	pugi::xml_text svalue = node.text();
+	long long value;
+	xrutils::parseInteger(text.c_str(), value);
+	return value;
+}
+
+// the bytes stored in the registry for the text form of a value, as found in xml and json files
+static void encodeProperty(DWORD type, const wstring& text, const vector<wstring>& list, string& data)
+{
+	data.clear();
+	switch (type)
+	{
+	case REG_SZ:
+	case REG_EXPAND_SZ:
+		data.assign((const char*)text.c_str(), (text.length() + 1) * sizeof(wchar_t));
+		break;
+	case REG_MULTI_SZ:
+		// empty items would end the list early
+		for (auto& item : list)
+			if (item.length() > 0) data.append((const char*)item.c_str(), (item.length() + 1) * sizeof(wchar_t));
+		data.append(sizeof(wchar_t), '\0');
+		break;
+	case REG_QWORD:
+	{
+		long long number = parseInteger(text);
+		data.assign((const char*)&number, sizeof(number));
+	}
+		break;
+	case REG_DWORD:
+	{
+		long number = (long)parseInteger(text);
+		data.assign((const char*)&number, sizeof(number));
+	}
+		break;
+	case REG_DWORD_BIG_ENDIAN:
+	{
+		unsigned long number = (unsigned long)parseInteger(text);
+		for (int shift = 24; shift >= 0; shift -= 8) data += (char)((number >> shift) & 0xFF);
+	}
+		break;
+
+	//case REG_BINARY:
+	//case REG_NONE:
+	//case REG_LINK:
+	//case REG_RESOURCE_LIST:
+	//case REG_FULL_RESOURCE_DESCRIPTOR:
+	//case REG_RESOURCE_REQUIREMENTS_LIST:
+	default:
+		data = b64decode(utf8_from_wstring(text));
+		break;
+	}
+}
+
+DWORD encode_value(const replacement_rules& rules, const wstring& type, wstring text, const vector<wstring>& list, string& data)
+{
+	if (rules.size() > 0)
+	{
+		xrstats::timer t(xrstats::PHASE_REPLACEMENT);
+		for (auto& par : rules) text = regex_replace(text, par.first, par.second);
+	}
+	DWORD dwType = xrutils::stringToPropType(type);
+	encodeProperty(dwType, text, list, data);
+	return dwType;
+}
 
+// applies the replacements and fills 'value', 'writer' must be open on 'key'
+// 'Writer' is winreg::keyWriter or winefile::keyWriter, they have the same interface
+template<class Writer>
+static void readProperty(Writer& writer, const wstring& key, const vector<pair<wregex, wstring>>& replacements,
+	const wstring& name, const wstring& stype, wstring text, const vector<wstring>& list, winreg::valueRecord& value)
+{
 	if (replacements.size() > 0)
 	{
-		for (auto par : replacements)
-		{
-			wstring r = regex_replace(svalue.as_string(), par.first, par.second);
-			if (r != svalue.as_string()) svalue.set(r.c_str());
-		}
+		xrstats::timer t(xrstats::PHASE_REPLACEMENT);
+		for (auto& par : replacements) text = regex_replace(text, par.first, par.second);
 	}
-	
-	DWORD type = xrutils::stringToPropType(stype);
 
-	if (winreg::propertyExists(hive, key, name, redirection))
+	value.name = name;
+	value.type = xrutils::stringToPropType(stype);
+	encodeProperty(value.type, text, list, value.data);
+
+	// the lookup is skipped when the warning would not be written or counted
+	if (xrlog::enabled(xrlog::LEVEL_WARNING) && writer.exists(name) && xrlog::repeat(xrlog::REPEAT_REPLACED_VALUE))
 	{
-		if (type != REG_MULTI_SZ)
-			wcout << "warning: replacing existing value " << name << " with " << xrutils::propTypeToString(type) << " = " << svalue.as_string()
-				<< "\n\t at " << key << endl;
-		else wcout << "warning: replacing existing value " << name << " with milti-string\n\t at " << key << endl;
+		if (value.type != REG_MULTI_SZ)
+			xrlog::warning() << "replacing existing value " << name << " with " << xrutils::propTypeToString(value.type) << " = " << text
+				<< "\n\t at " << key;
+		else xrlog::warning() << "replacing existing value " << name << " with milti-string\n\t at " << key;
 	}
-	else if (!winreg::keyExists(hive, key, redirection) && !winreg::createKey(hive, key, redirection))
+}
+
+// --undo-log, what 'values' are about to overwrite, on disk before they are written
+// wine files are saved whole at the end and have no undo log, the overloads keep the templates compiling
+static bool saveUndo(winreg::keyWriter& writer, xrundo::undoLog& undo, const wstring& key, const vector<winreg::valueRecord>& values)
+{
+	string data;
+	unsigned long type;
+	for (auto& value : values)
 	{
-		wcout << "error: failed to create key\n\tat " << xrutils::redirectionToString(redirection) << key << endl;
-		return ERROR_XRIMPORT_CREATEKEY;
+		if (writer.read(value.name, data, type)) undo.value(key, value.name, type, data);
+		else undo.absent(key, value.name);
 	}
+	return undo.commit();
+}
+static bool saveUndo(winefile::keyWriter&, xrundo::undoLog&, const wstring&, const vector<winreg::valueRecord>&) { return false; }
 
-	switch (type)
+static void saveCreated(winreg::keyWriter& writer, xrundo::undoLog& undo, const wstring& key)
+{
+	if (writer.created()) undo.keyCreated(key);
+}
+static void saveCreated(winefile::keyWriter&, xrundo::undoLog&, const wstring&) {}
+
+// the first key of 'key' that does not exist yet, rollback deletes it with everything the import puts below it
+static void saveMissingKey(xrundo::undoLog& undo, HKEY hive, const wstring& key, REGSAM redirection)
+{
+	for (size_t end = key.find(L'\\'); ; end = key.find(L'\\', end + 1))
 	{
-	case REG_SZ:
-		if (!winreg::setString(hive, key, name, svalue.as_string(), redirection))
-		{
-			wcout << "error: failed to write string: " << name << ":" << svalue << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
-		}
-		break;
-	case REG_EXPAND_SZ:
-		if (!winreg::setExpandString(hive, key, name, svalue.as_string(), redirection))
+		wstring prefix = key.substr(0, end);
+		if (!winreg::keyExists(hive, prefix, redirection))
 		{
-			wcout << "error: failed to write expand-string: " << name << ":" << svalue << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			undo.keyCreated(prefix);
+			return;
 		}
-		break;
-	case REG_MULTI_SZ:
+		if (end == wstring::npos) return;
+	}
+}
+
+// a key a .reg file deletes, with every value and subkey in it
+static void saveTree(xrundo::undoLog& undo, HKEY hive, const wstring& key, REGSAM redirection)
+{
+	vector<wstring> pending(1, key);
+	vector<wstring> names;
+	string data;
+	unsigned long type;
+	while (!pending.empty())
+	{
+		wstring path = pending.back();
+		pending.pop_back();
+		winreg::keyHandle handle;
+		if (!handle.open(hive, path, KEY_READ | redirection)) continue;
+
+		undo.keyDeleted(path);
+		handle.values(names);
+		for (auto& name : names)
+			if (handle.read(name, data, type)) undo.value(path, name, type, data);
+		handle.subkeys(names);
+		for (auto& name : names) pending.push_back(path + L"\\" + name);
+	}
+}
+
+template<class Writer>
+static int writeProperties(Writer& writer, const wstring& key, const vector<winreg::valueRecord>& values, xrundo::undoLog* undo, bool skip_errors)
+{
+	xrprogress::addValues(values.size());
+	if (undo && !values.empty() && !saveUndo(writer, *undo, key, values))
+	{
+		xrlog::error() << "failed to write the undo log, stopping before " << key;
+		return ERROR_XRIMPORT_UNDO;
+	}
+	vector<size_t> failed;
+	if (writer.write(values, failed)) return 0;
+
+	for (size_t i : failed)
+		xrlog::error() << "failed to write " << xrutils::propTypeToString(values[i].type) << ": " << values[i].name << "\n\ton " << key;
+	return skip_errors ? 0 : ERROR_XRIMPORT_SETPROPERTY;
+}
+
+template<class Writer>
+static void workOnProperty(Writer& writer, const wstring& key, const vector<pair<wregex, wstring>>& replacements, pugi::xml_node& node, winreg::valueRecord& value)
+{
+	wstring name = node.attribute(L"name").value();
+	wstring stype = node.attribute(L"type").value();
+
+	vector<wstring> list;
+	if (xrutils::stringToPropType(stype) == REG_MULTI_SZ)
 	{
-		vector<wstring> list;
 		for (pugi::xml_node child : node.children())
 		{
 			wstring cname = child.name();
 			if (cname != L"li")
 			{
-				wcout << "warning: ignoring unrecognized child element (" << cname << ") of multi-string " << name << "\n\ton " << key << endl;
+				xrlog::warning() << "ignoring unrecognized child element (" << cname << ") of multi-string " << name << "\n\ton " << key;
 				continue;
 			}
-			svalue = child.text();
-			list.push_back(svalue.as_string());
-		}
-		if (!winreg::setMultiString(hive, key, name, list, redirection))
-		{
-			wcout << "error: failed to write multi-string: " << name << ", length: " << list.size() << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			list.push_back(child.text().as_string());
 		}
 	}
-		break;
-	case REG_QWORD:
+
+	readProperty(writer, key, replacements, name, stype, node.text().as_string(), list, value);
+}
+
+// one <key> element of convertNode
+template<class Writer>
+struct nodeFrame
+{
+	Writer writer;
+	Writer* open = nullptr;			// 'writer', or the root the caller opened
+	pugi::xml_node child;			// next child element to look at
+	size_t keys = 0;				// <key> children seen so far, the index of the next one for the journal
+	size_t mark = 0;				// length of the key before this level appended its name
+	int ret = 0;					// what the level returns to its parent
+	xrfilter::position position;
+	xrtrace::keySpan span;
+};
+
+// the values of 'node' that pass the filter, written in one call, 'values' is scratch space shared by all levels
+template<class Writer>
+static int convertValues(Writer& writer, const wstring& key, const vector<pair<wregex, wstring>>& replacements, pugi::xml_node& node,
+	const xrfilter::keyFilter& filter, const xrfilter::position& position, vector<winreg::valueRecord>& values, xrundo::undoLog* undo,
+	bool skip_errors)
+{
+	if (!position.included) return 0;
+
+	size_t count = 0;
+	for (pugi::xml_node child : node.children(L"value"))
+	{
+		if (filter.filtersTypes() && !filter.wantsType(xrutils::stringToPropType(child.attribute(L"type").value()))) continue;
+		if (count == values.size()) values.emplace_back();
+		workOnProperty(writer, key, replacements, child, values[count++]);
+	}
+	values.resize(count);
+	return writeProperties(writer, key, values, undo, skip_errors);
+}
+
+// where the last node of the document starts, as the length of the document for --progress
+static unsigned long long documentEnd(const pugi::xml_node& node)
+{
+	pugi::xml_node last = node;
+	while (last.last_child()) last = last.last_child();
+	ptrdiff_t offset = last.offset_debug();
+	return offset > 0 ? (unsigned long long)offset : 0;
+}
+
+// the registry below 'writer' is flushed first, so the journal is never ahead of it
+template<class Writer>
+static int saveCheckpoint(Writer& writer, xrjournal::journal& journal, const vector<size_t>& indexes, const wstring& key)
+{
+	if (writer.flush() && journal.checkpoint(indexes, key)) return 0;
+	xrlog::error() << "failed to write a checkpoint to the journal";
+	return ERROR_XRIMPORT_JOURNAL;
+}
+
+// with --resume, opens the keys down to the last checkpoint without writing anything, and leaves 'stack' on it
+// keys are written in document order, so every <key> before it is done, and so are its values
+// whether the <key> at the resume point of the journal still has the path the journal recorded for it
+static bool checkpointMatches(const pugi::xml_node& node, const wstring& key, const xrjournal::journal& journal)
+{
+	wstring path = key;
+	pugi::xml_node parent = node;
+	for (size_t index : journal.resumePoint())
 	{
-		if (!winreg::setQword(hive, key, name, svalue.as_llong(), redirection))
+		size_t keys = 0;
+		pugi::xml_node child = parent.first_child();
+		for (; child; child = child.next_sibling())
+			if (wstring(child.name()) == L"key" && keys++ == index) break;
+		if (!child) return false;
+		path += L"\\";
+		path += child.attribute(L"name").value();
+		parent = child;
+	}
+	return _wcsicmp(path.c_str(), journal.resumeKey().c_str()) == 0;
+}
+
+// stops early if the fragment no longer has the keys the journal names
+template<class Writer>
+static void seekCheckpoint(keyStack<nodeFrame<Writer>>& stack, wstring& key, const xrfilter::keyFilter& filter,
+	const xrjournal::journal& journal, vector<size_t>& indexes)
+{
+	for (size_t index : journal.resumePoint())
+	{
+		nodeFrame<Writer>& frame = stack.top();
+		pugi::xml_node child = frame.child;
+		for (; child; child = child.next_sibling())
+			if (wstring(child.name()) == L"key" && frame.keys++ == index) break;
+		if (!child) break;
+		frame.child = child.next_sibling();
+
+		wstring name = child.attribute(L"name").value();
+		nodeFrame<Writer>& sub = stack.push();
+		if (!filter.enter(frame.position, name, sub.position) || !sub.writer.open(*frame.open, name))
 		{
-			wcout << "error: failed to write qword: " << name << ":" << svalue.as_string() << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			stack.pop();
+			break;
 		}
+		sub.open = &sub.writer;
+		sub.child = child.first_child();
+		sub.keys = 0;
+		sub.ret = 0;
+		sub.mark = key.length();
+		key += L"\\";
+		key += name;
+		sub.span.begin(key);
+		indexes.push_back(index);
 	}
-		break;
-	case REG_DWORD:
+
+	if (indexes.size() != journal.resumePoint().size() || _wcsicmp(key.c_str(), journal.resumeKey().c_str()) != 0)
+		xrlog::warning() << "the fragment changed since the journal was written, resuming at " << key;
+	else xrlog::info() << "resuming at " << key;
+}
+
+// 'writer' is open on 'key', subkeys are created relative to it
+// 'key' is only kept for messages, each level appends its name and restores it when done
+// the tree is walked depth first with an explicit stack, one frame per open <key>
+// <key> elements left out by 'filter' are skipped before their keys are created
+// with a journal, a checkpoint is written every few keys, and the walk can start from the last one
+// with an undo log, the keys it creates and the values it overwrites are recorded before the change
+template<class Writer>
+static int convertNode(Writer& writer, wstring& key, const vector<pair<wregex, wstring>>& replacements, pugi::xml_node& node,
+	const xrfilter::keyFilter& filter, xrjournal::journal* journal, xrundo::undoLog* undo, bool skip_errors)
+{
+	keyStack<nodeFrame<Writer>> stack;
+	vector<winreg::valueRecord> values;
+	// index of every open <key> below the fragment, what a checkpoint records
+	vector<size_t> indexes;
+	bool resuming = journal && journal->resumePoint().size() > 0;
+
+	// nothing is written when the fragment changed under the journal, unless the user insists
+	if (resuming && !checkpointMatches(node, key, *journal))
 	{
-		if (!winreg::setDword(hive, key, name, (long)svalue.as_llong(), redirection))
+		if (!journal->isForced())
 		{
-			wcout << "error: failed to write dword: " << name << ":" << svalue.as_string() << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			xrlog::error() << "the fragment changed since the journal was written, " << journal->resumeKey()
+				<< " is no longer at the checkpoint (--force-resume resumes there anyway)";
+			return ERROR_XRIMPORT_JOURNAL;
 		}
+		xrlog::warning() << "the fragment changed since the journal was written, resuming anyway";
 	}
-		break;
-	case REG_DWORD_BIG_ENDIAN:
+
+	nodeFrame<Writer>* frame = &stack.push();
+	if (!filter.start(frame->position)) return 0;
+
+	// the document is already in memory, progress is measured by how far into it the walk is
+	xrprogress::display progress(L"importing", xrprogress::MEASURE_OFFSET);
+	bool tracked = xrprogress::enabled();
+	if (tracked) xrprogress::setLength(documentEnd(node));
+
+	frame->open = &writer;
+	frame->child = node.first_child();
+	frame->keys = 0;
+	frame->mark = key.length();
+	frame->span.begin(key);
+	int ret = frame->ret = resuming ? 0 : convertValues(writer, key, replacements, node, filter, frame->position, values, undo, skip_errors);
+	if (resuming) seekCheckpoint(stack, key, filter, *journal, indexes);
+
+	// with skip_errors a level returns the result of its last <key>
+	while (!(ret && !skip_errors) && !stack.empty())
 	{
-		if (!winreg::setDwordBE(hive, key, name, (long)svalue.as_llong(), redirection))
+		frame = &stack.top();
+		if (!frame->child)
 		{
-			wcout << "error: failed to write dword-be: " << name << ":" << svalue.as_string() << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			ret = frame->ret;
+			frame->span.end();
+			frame->writer.close();
+			key.resize(frame->mark);
+			stack.pop();
+			if (!stack.empty())
+			{
+				stack.top().ret = ret;
+				indexes.pop_back();
+			}
+			continue;
 		}
-	}
-		break;
-	case REG_BINARY:
-		if (!winreg::setBinaryFromBase64(hive, key, name, utf8_from_wstring(svalue.as_string()), redirection))
+
+		pugi::xml_node child = frame->child;
+		frame->child = child.next_sibling();
+		wstring s = child.name();
+		if (s.length() == 0 || s == L"value") continue;
+		if (s != L"key")
 		{
-			wcout << "error: failed to write binary: " << name << ":" << svalue.as_string() << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			if (xrlog::repeat(xrlog::REPEAT_UNKNOWN_ELEMENT)) xrlog::warning() << "ignoring unknown element " << s;
+			continue;
 		}
-		break;
 
-	//case REG_NONE:
-	//case REG_LINK:
-	//case REG_RESOURCE_LIST:
-	//case REG_FULL_RESOURCE_DESCRIPTOR:
-	//case REG_RESOURCE_REQUIREMENTS_LIST:
-	default:
-		if (!winreg::setByteArrayFromBase64(hive, key, name, utf8_from_wstring(svalue.as_string()), type, redirection))
+		s = child.attribute(L"name").value();
+		if (tracked) xrprogress::setOffset(child.offset_debug());
+		size_t index = frame->keys++;
+		nodeFrame<Writer>& sub = stack.push();
+		if (!filter.enter(frame->position, s, sub.position))
 		{
-			wcout << "error: failed to write " << xrutils::propTypeToString(type) << ": "
-				<< name << ":" << svalue.as_string() << "\n\ton " << key;
-			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+			stack.pop();
+			continue;
 		}
-		break;
+
+		size_t mark = key.length();
+		key += L"\\";
+		key += s;
+		if (!sub.writer.open(*frame->open, s))
+		{
+			xrlog::error() << "failed to create key: " << key;
+			stack.pop();
+			key.resize(mark);
+			ret = frame->ret = ERROR_XRIMPORT_CREATEKEY;
+			continue;
+		}
+		if (undo) saveCreated(sub.writer, *undo, key);
+		sub.open = &sub.writer;
+		sub.child = child.first_child();
+		sub.keys = 0;
+		sub.mark = mark;
+		sub.span.begin(key);
+		indexes.push_back(index);
+		ret = sub.ret = convertValues(sub.writer, key, replacements, child, filter, sub.position, values, undo, skip_errors);
+		if (!ret && journal && journal->step()) ret = sub.ret = saveCheckpoint(writer, *journal, indexes, key);
 	}
 
-	return 0;
+	// the walk only ends with an empty stack if it got through the whole fragment
+	if (journal && stack.empty() && !(ret && !skip_errors) && !journal->complete())
+	{
+		xrlog::error() << "failed to write the end of the import to the journal";
+		ret = ERROR_XRIMPORT_JOURNAL;
+	}
+
+	// an error stops the walk with the levels above it still open
+	while (!stack.empty())
+	{
+		frame = &stack.top();
+		frame->span.end();
+		frame->writer.close();
+		key.resize(frame->mark);
+		stack.pop();
+	}
+	return ret;
 }
 
-int convertNode(HKEY hive, const wstring& key, REGSAM redirection, const vector<pair<wregex, wstring>>& replacements, pugi::xml_node& node, bool skip_errors)
+replacement_rules compile_replacements(map<wstring, wstring> replacements, wstring com_dll)
 {
-	int ret = 0;
-	for (pugi::xml_node child : node.children())
+	replacement_rules rgxmap;
+	for (auto repl : replacements)
 	{
-		wstring s = child.name();
-		if (s.length() == 0) continue;
-		if (s == L"value")
+		xrlog::info() << "replacing " << repl.first << " with " << repl.second;
+		pair<wregex, wstring> p(wregex(repl.first), repl.second);
+		rgxmap.push_back(p);
+	}
+
+	if (com_dll.length() > 0)
+	{
+		// if this parameter was specified in command line, we create four special replacements:
+		// %dir% => is replaced with the parent path of com_dll
+		// %file% => is replaced with the value of com_dll
+		// %dir83% => is replaced with the short (dos 8.3) version of %dir%
+		// %file83% => is replaced with the short (dos 8.3) version of %file%
+
+		wstring directory;
+		wstring filepath = xrutils::getFullPath(com_dll, directory);
+		if (filepath.length() == 0 && directory.length() == 0)
+			xrlog::warning() << "invalid value for --com-dll, ignoring";
+		else
+		{
+			wstring file83 = xrutils::getShorPath(filepath);
+			wstring dir83 = xrutils::getShorPath(directory);
+
+			xrlog::info() << "replacing %dir% with " << directory;
+			xrlog::info() << "replacing %dir83% with " << dir83;
+			xrlog::info() << "replacing %file% with " << filepath;
+			xrlog::info() << "replacing %file83% with " << file83;
+
+			pair<wregex, wstring> p1(wregex(L"%dir%"), directory);
+			pair<wregex, wstring> p2(wregex(L"%dir83%"), dir83);
+			pair<wregex, wstring> p3(wregex(L"%file%"), filepath);
+			pair<wregex, wstring> p4(wregex(L"%file83%"), file83);
+			rgxmap.push_back(p1);
+			rgxmap.push_back(p2);
+			rgxmap.push_back(p3);
+			rgxmap.push_back(p4);
+		}
+	}
+
+	return rgxmap;
+}
+
+int import_reg(wstring file, map<wstring, wstring> replacements, wstring com_dll, bool unattended, bool skip_errors)
+{
+	return import_reg(file, compile_replacements(replacements, com_dll), fragment_target(), xrfilter::keyFilter(), journal_options(),
+		unattended, skip_errors);
+}
+
+// the --journal and --undo-log of an import, either can be left out
+// 'finished' is set when the journal says a previous run already got to the end, there is nothing left to write
+static int openLogs(const journal_options& options, const wstring& file, xrjournal::journal& journal, xrundo::undoLog& undo, bool& finished)
+{
+	finished = false;
+	wstring error;
+	if (options.file.length() > 0)
+	{
+		if (!journal.open(options.file, file, options.resume, options.force_resume, error))
 		{
-			ret = workOnProperty(hive, key, redirection, replacements, child, skip_errors);
-			if (ret && !skip_errors) return ret;
+			xrlog::error() << error;
+			return ERROR_XRIMPORT_JOURNAL;
 		}
-		else if (s == L"key")
+		if (journal.isComplete())
 		{
-			s = child.attribute(L"name").value();
-			wstring subkey = key + L"\\" + s;
-			if (winreg::createKey(hive, subkey, redirection))
-			{
-				ret = convertNode(hive, subkey, redirection, replacements, child, skip_errors);
-				if (ret && !skip_errors) return ret;
-			}
-			else
-			{
-				wcout << "error: failed to create key: " << subkey << endl;
-				if (!skip_errors) return ERROR_XRIMPORT_CREATEKEY;
-			}
+			xrlog::info() << "journal " << options.file << " shows the import already finished, nothing to resume";
+			finished = true;
+			return 0;
 		}
-		else wcout << "warning: ignoring unknown element " << s << endl;
 	}
-	return ret;
+
+	// a resumed import adds to the undo log of the run it continues
+	if (options.undo_file.length() > 0 && !undo.open(options.undo_file, options.resume, error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRIMPORT_UNDO;
+	}
+	return 0;
 }
 
-int import_reg(wstring file, map<wstring, wstring> replacements, wstring com_dll, bool unattended, bool skip_errors)
+static int fragmentRoot(const pugi::xml_document& doc, pugi::xml_node& root)
+{
+	root = doc.first_element_by_path(L"fragment");
+	if (root.name() != wstring(L"fragment"))
+	{
+		xrlog::error() << "root element is not 'fragment'";
+		return ERROR_XRIMPORT_XMLSCHEMA;
+	}
+	return 0;
+}
+
+// the <fragment> root of an xml file
+static int loadFragment(const wstring& file, pugi::xml_document& doc, pugi::xml_node& root)
+{
+	pugi::xml_parse_result parse_result = loadDocument(doc, file);
+	if (parse_result.status != pugi::status_ok)
+	{
+		xrlog::error() << parse_result.description();
+		return ERROR_XRIMPORT_PARSEXML;
+	}
+	return fragmentRoot(doc, root);
+}
+
+// where the fragment goes, 'target' overrides its attributes
+static void locateFragment(const pugi::xml_node& root, const fragment_target& target, HKEY& hive, wstring& key, REGSAM& redirection)
+{
+	wstring ahive = root.attribute(L"hive").value();
+	wstring akey = root.attribute(L"key").value();
+	wstring aredir = root.attribute(L"redirection").value();
+
+	if (ahive.length() == 0 && !target.has_hive)
+		xrlog::warning() << "no hive, assuming HKCU";
+
+	key = target.has_key ? target.key : akey;
+	hive = target.has_hive ? target.hive : xrutils::stringToHive(ahive);
+	redirection = target.has_redirection ? target.redirection : xrutils::stringToRedirection(aredir);
+
+	xrlog::info() << "to ("
+		<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
+		<< L"): " << xrutils::hiveToString(hive) << L":\\" << key;
+}
+
+static bool confirmMerge(bool exists, bool unattended)
+{
+	if (!exists) return true;
+	xrlog::warning() << "target key already exists, trees will be merged and some values might be overwritten";
+	if (unattended) return true;
+
+	wstring option;
+	xrlog::flush();
+	wcout << "continue? (y/N): ";
+	wcin >> option;
+	transform(option.begin(), option.end(), option.begin(), ::tolower);
+	return option == L"1" || option == L"y" || option == L"yes" || option == L"true";
+}
+
+static int applyFragment(const pugi::xml_document& doc, const replacement_rules& rules, const fragment_target& target,
+	const xrfilter::keyFilter& filter, xrjournal::journal* journal, xrundo::undoLog* undo, bool unattended, bool skip_errors);
+
+int import_reg(wstring file, const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+	const journal_options& journal, bool unattended, bool skip_errors)
+{
+	xrlog::info() << "importing from file " << file;
+
+	xrjournal::journal log;
+	xrundo::undoLog undo;
+	bool finished;
+	int r = openLogs(journal, file, log, undo, finished);
+	if (r || finished) return r;
+
+	pugi::xml_document doc;
+	pugi::xml_parse_result parse_result = loadDocument(doc, file);
+	if (parse_result.status != pugi::status_ok)
+	{
+		xrlog::error() << parse_result.description();
+		return ERROR_XRIMPORT_PARSEXML;
+	}
+	return applyFragment(doc, rules, target, filter, log.isOpen() ? &log : nullptr, undo.isOpen() ? &undo : nullptr,
+		unattended, skip_errors);
+}
+
+int import_fragment(const pugi::xml_document& doc, const replacement_rules& rules, const fragment_target& target,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors)
+{
+	return applyFragment(doc, rules, target, filter, nullptr, nullptr, unattended, skip_errors);
+}
+
+static int applyFragment(const pugi::xml_document& doc, const replacement_rules& rules, const fragment_target& target,
+	const xrfilter::keyFilter& filter, xrjournal::journal* journal, xrundo::undoLog* undo, bool unattended, bool skip_errors)
+{
+	pugi::xml_node root;
+	int r = fragmentRoot(doc, root);
+	if (r) return r;
+
+	HKEY hive;
+	wstring key;
+	REGSAM redirection;
+	locateFragment(root, target, hive, key, redirection);
+	if (!confirmMerge(winreg::keyExists(hive, key, redirection), unattended)) return ERROR_XRGENERAL_FAILURE;
+
+	if (undo)
+	{
+		undo->at(hive, redirection);
+		saveMissingKey(*undo, hive, key, redirection);
+	}
+	winreg::keyWriter writer;
+	if (!writer.open(hive, key, redirection))
+	{
+		xrlog::error() << "failed to create key: " << xrutils::redirectionToString(redirection) << key;
+		return ERROR_XRIMPORT_CREATEKEY;
+	}
+	return convertNode(writer, key, rules, root, filter, journal, undo, skip_errors);
+}
+
+int import_wine(wstring file, wstring wine_file, const replacement_rules& rules, const fragment_target& target,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors)
 {
-	std::wcout << "importing from file " << file << std::endl;
+	xrlog::info() << "importing from file " << file << " into wine registry " << wine_file;
 
 	pugi::xml_document doc;
-	auto parse_result = doc.load_file(file.c_str());
-	if (parse_result.status == pugi::status_ok)
+	pugi::xml_node root;
+	int r = loadFragment(file, doc, root);
+	if (r) return r;
+
+	winefile::registry registry;
+	wstring error;
+	if (!registry.load(wine_file, error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_LOAD;
+	}
+
+	HKEY hive;
+	wstring key;
+	REGSAM redirection;
+	locateFragment(root, target, hive, key, redirection);
+	if (!confirmMerge(registry.keyExists(hive, key, redirection), unattended)) return ERROR_XRGENERAL_FAILURE;
+
+	winefile::keyWriter writer;
+	if (!writer.open(registry, hive, key, redirection))
+	{
+		xrlog::error() << xrutils::hiveToString(hive) << " is not in " << wine_file;
+		return ERROR_XRIMPORT_CREATEKEY;
+	}
+
+	// the file is only written if everything could be applied
+	r = convertNode(writer, key, rules, root, filter, nullptr, nullptr, skip_errors);
+	if (r) return r;
+	if (!registry.save(error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_SAVE;
+	}
+	return 0;
+}
+
+// replacements only apply to the text of string values
+static void replaceInString(const replacement_rules& rules, string& data)
+{
+	if (data.length() < 2) return;
+	wstring text((const wchar_t*)data.data(), data.length() / 2);
+	while (text.length() > 0 && text.back() == L'\0') text.pop_back();
+
+	wstring replaced = text;
+	{
+		xrstats::timer t(xrstats::PHASE_REPLACEMENT);
+		for (auto& par : rules) replaced = regex_replace(replaced, par.first, par.second);
+	}
+	if (replaced == text) return;
+
+	data.assign((const char*)replaced.c_str(), (replaced.length() + 1) * sizeof(wchar_t));
+}
+
+// --undo-log for one record of a .reg file, on disk before the record is applied
+// 'section' is open on the key of a value record, its old value is read through it
+static bool saveRecord(xrundo::undoLog& undo, const regfile::record& rec, REGSAM redirection, const winreg::keyWriter* section = nullptr)
+{
+	undo.at(rec.hive, redirection);
+	string data;
+	unsigned long type;
+	switch (rec.kind)
+	{
+	case regfile::RECORD_KEY:
+		saveMissingKey(undo, rec.hive, rec.key, redirection);
+		break;
+	case regfile::RECORD_DELETE_KEY:
+		saveTree(undo, rec.hive, rec.key, redirection);
+		break;
+	case regfile::RECORD_DELETE_VALUE:
+	case regfile::RECORD_VALUE:
+		if (section ? section->read(rec.name, data, type) : winreg::getAsByteArray(rec.hive, rec.key, rec.name, data, type, redirection))
+			undo.value(rec.key, rec.name, type, data);
+		else if (rec.kind == regfile::RECORD_VALUE) undo.absent(rec.key, rec.name);
+		break;
+	}
+	if (undo.commit()) return true;
+	xrlog::error() << "failed to write the undo log, stopping before " << rec.key;
+	return false;
+}
+
+void replace_value(const replacement_rules& rules, DWORD type, string& data)
+{
+	if (rules.size() > 0 && (type == REG_SZ || type == REG_EXPAND_SZ)) replaceInString(rules, data);
+}
+
+// the [key] the records of a .reg file are in, kept open until a record names another one
+struct regSection
+{
+	HKEY hive = NULL;
+	wstring key;
+	bool opened = false;
+	winreg::keyWriter writer;
+	winreg::valueRecord value;
+	// one span per section, inside the span of the file
+	xrtrace::keySpan span;
+
+	// creates the key of 'rec' unless it is the one already open
+	bool open(const regfile::record& rec, REGSAM redirection)
 	{
-		auto root = doc.first_element_by_path(L"fragment");
-		bool isFragment = root.name() == wstring(L"fragment");
+		if (opened && hive == rec.hive && key == rec.key) return true;
+		hive = rec.hive;
+		key = rec.key;
+		span.begin(key);
+		opened = writer.open(rec.hive, rec.key, redirection);
+		return opened;
+	}
 
-		if (isFragment)
+	void close()
+	{
+		writer.close();
+		span.end();
+		opened = false;
+	}
+};
+
+// keys are matched by 'filter' relative to their hive, a key that is only on the way to an include is created
+// but its values and delete records are left alone
+static int workOnRecord(const regfile::record& rec, const replacement_rules& rules, REGSAM redirection, const xrfilter::keyFilter& filter,
+	regSection& section, xrundo::undoLog* undo, bool skip_errors)
+{
+	xrfilter::position position;
+	if (filter.filtersKeys() && !filter.locate(rec.key, position)) return 0;
+
+	switch (rec.kind)
+	{
+	case regfile::RECORD_KEY:
+		if (undo && !saveRecord(*undo, rec, redirection)) return ERROR_XRIMPORT_UNDO;
+		if (!section.open(rec, redirection))
+		{
+			xrlog::error() << "failed to create key: " << rec.key;
+			if (!skip_errors) return ERROR_XRIMPORT_CREATEKEY;
+		}
+		break;
+
+	case regfile::RECORD_DELETE_KEY:
+		if (!position.included) break;
+		// the open key may be the one deleted, or below it
+		section.close();
+		if (undo && !saveRecord(*undo, rec, redirection)) return ERROR_XRIMPORT_UNDO;
+		if (!winreg::deleteTree(rec.hive, rec.key, redirection))
+		{
+			xrlog::error() << "failed to delete key: " << rec.key;
+			if (!skip_errors) return ERROR_XRIMPORT_DELETE;
+		}
+		break;
+
+	case regfile::RECORD_DELETE_VALUE:
+		if (!position.included) break;
+		if (undo && !saveRecord(*undo, rec, redirection)) return ERROR_XRIMPORT_UNDO;
+		if (!winreg::deleteProperty(rec.hive, rec.key, rec.name, redirection))
+		{
+			xrlog::error() << "failed to delete value: " << rec.name << "\n\ton " << rec.key;
+			if (!skip_errors) return ERROR_XRIMPORT_DELETE;
+		}
+		break;
+
+	case regfile::RECORD_VALUE:
+	{
+		if (!filter.wantsValue(position, rec.type)) break;
+		xrprogress::addValues(1);
+		if (!section.open(rec, redirection))
 		{
-			wstring ahive = root.attribute(L"hive").value();
-			wstring akey = root.attribute(L"key").value();
-			wstring aredir = root.attribute(L"redirection").value();
+			xrlog::error() << "failed to create key: " << rec.key;
+			if (!skip_errors) return ERROR_XRIMPORT_CREATEKEY;
+			break;
+		}
+		if (xrlog::enabled(xrlog::LEVEL_WARNING) && section.writer.exists(rec.name) && xrlog::repeat(xrlog::REPEAT_REPLACED_VALUE))
+			xrlog::warning() << "replacing existing value " << rec.name << " with " << xrutils::propTypeToString(rec.type)
+				<< "\n\t at " << rec.key;
+
+		winreg::valueRecord& value = section.value;
+		value.name = rec.name;
+		value.type = rec.type;
+		value.data = rec.data;
+		replace_value(rules, value.type, value.data);
+
+		if (undo && !saveRecord(*undo, rec, redirection, &section.writer)) return ERROR_XRIMPORT_UNDO;
+		if (!section.writer.write(value))
+		{
+			xrlog::error() << "failed to write " << xrutils::propTypeToString(rec.type) << ": " << rec.name << "\n\ton " << rec.key;
+			if (!skip_errors) return ERROR_XRIMPORT_SETPROPERTY;
+		}
+	}
+		break;
+	}
+	return 0;
+}
+
+// the record or value at a checkpoint must still be in the key the journal recorded, unless the user insists
+// 'key' is empty when the file ended before the checkpoint
+static bool checkpointStillThere(const xrjournal::journal& log, const wstring& key, bool ended)
+{
+	if (!ended && _wcsicmp(key.c_str(), log.resumeKey().c_str()) == 0) return true;
+	if (log.isForced())
+	{
+		xrlog::warning() << "the file changed since the journal was written, resuming anyway";
+		return true;
+	}
+	xrlog::error() << "the file changed since the journal was written, " << log.resumeKey()
+		<< " is no longer at the checkpoint (--force-resume resumes there anyway)";
+	return false;
+}
 
-			if (ahive.length() == 0)
-				wcout << "warning: no hive, assuming HKCU" << endl;
+// a checkpoint is the number of records read, every hive written since the last one is flushed first
+int import_regfile(wstring file, const replacement_rules& rules, REGSAM redirection, const xrfilter::keyFilter& filter,
+	const journal_options& journal, bool skip_errors)
+{
+	xrlog::info() << "importing from file " << file;
+
+	xrjournal::journal log;
+	xrundo::undoLog undo;
+	bool finished;
+	int r = openLogs(journal, file, log, undo, finished);
+	if (r || finished) return r;
 
-			wstring key = akey;
-			HKEY hive = xrutils::stringToHive(ahive);
-			REGSAM redirection = xrutils::stringToRedirection(aredir);
+	size_t ordinal = 0;
+	size_t resume = log.resumePoint().size() > 0 ? log.resumePoint()[0] : 0;
+	if (resume) xrlog::info() << "resuming after record " << resume << " (" << log.resumeKey() << ")";
+	set<HKEY> written;
+	regSection section;
 
-			wcout << "to ("
-				<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
-				<< L"): " << xrutils::hiveToString(hive) << L":\\" << key << endl;
+	wstring error;
+	{
+		xrprogress::display progress(L"importing", xrprogress::MEASURE_OFFSET);
+		xrtrace::keySpan span(file);
+		r = regfile::parse(file, [&](const regfile::record& rec) {
+			if (++ordinal < resume) return 0;
+			if (ordinal == resume) return checkpointStillThere(log, rec.key, false) ? 0 : ERROR_XRIMPORT_JOURNAL;
+			int ret = workOnRecord(rec, rules, redirection, filter, section, undo.isOpen() ? &undo : nullptr, skip_errors);
+			if (ret || !log.isOpen()) return ret;
 
-			bool ok_to_go = true;
-			if (winreg::keyExists(hive, key, redirection))
+			written.insert(rec.hive);
+			if (!log.step()) return 0;
+			for (HKEY hive : written)
+				if (!winreg::flushHive(hive)) ret = ERROR_XRIMPORT_JOURNAL;
+			written.clear();
+			if (ret || !log.checkpoint({ ordinal }, rec.key))
 			{
-				wcout << "warning: target key already exists, trees will be merged and some values might be overwritten" << endl;
-				if (!unattended)
-				{
-					wstring option;
-					wcout << "continue? (y/N): ";
-					wcin >> option;
-					transform(option.begin(), option.end(), option.begin(), ::tolower);
-					ok_to_go = option == L"1" || option == L"y" || option == L"yes" || option == L"true";
-				}
+				xrlog::error() << "failed to write a checkpoint to the journal";
+				return ERROR_XRIMPORT_JOURNAL;
 			}
+			return 0;
+		}, error);
+		section.close();
+	}
+
+	if (r == -1)
+	{
+		xrlog::error() << error;
+		return ERROR_XRIMPORT_PARSEREG;
+	}
+	if (!r && ordinal < resume && !checkpointStillThere(log, L"", true)) return ERROR_XRIMPORT_JOURNAL;
+	if (!r && log.isOpen() && !log.complete())
+	{
+		xrlog::error() << "failed to write the end of the import to the journal";
+		return ERROR_XRIMPORT_JOURNAL;
+	}
+	return r;
+}
+// mirrors import_reg/convertNode for the json representation, without loading the whole file
+class jsonImporter : public jsonfile::fragmentVisitor
+{
+	const replacement_rules& rules;
+	const fragment_target& target;
+	const xrfilter::keyFilter& filter;
+	xrjournal::journal* journal;
+	xrundo::undoLog* undo;
+	bool unattended;
+	bool skip_errors;
 
-			if (ok_to_go)
+	HKEY hive = HKEY_CURRENT_USER;
+	REGSAM redirection = 0;
+	// path of the current key for messages, and where each level starts in it
+	wstring path;
+	vector<size_t> marks;
+	// one open handle per level, values can come before or after the subkeys
+	vector<unique_ptr<winreg::keyWriter>> writers;
+	vector<xrfilter::position> positions;
+	// one trace span per level, ended when the key is left
+	vector<unique_ptr<xrtrace::keySpan>> spans;
+	// depth of the first key that could not be created or was left out by the filter, its subtree is ignored
+	size_t failed_depth = 0;
+	// values read so far, a checkpoint of the journal is one of these and everything up to it is skipped on resume
+	size_t ordinal = 0;
+	size_t resume = 0;
+
+public:
+	jsonImporter(const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+		xrjournal::journal* journal, xrundo::undoLog* undo, bool unattended, bool skip_errors)
+		: rules(rules), target(target), filter(filter), journal(journal), undo(undo), unattended(unattended), skip_errors(skip_errors)
+	{
+		if (journal && journal->resumePoint().size() > 0) resume = journal->resumePoint()[0];
+	}
+
+	int location(const wstring& ahive, const wstring& akey, const wstring& aredir) override
+	{
+		if (ahive.length() == 0 && !target.has_hive)
+			xrlog::warning() << "no hive, assuming HKCU";
+
+		wstring key = target.has_key ? target.key : akey;
+		hive = target.has_hive ? target.hive : xrutils::stringToHive(ahive);
+		redirection = target.has_redirection ? target.redirection : xrutils::stringToRedirection(aredir);
+		path = key;
+
+		xrlog::info() << "to ("
+			<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
+			<< L"): " << xrutils::hiveToString(hive) << L":\\" << key;
+
+		if (winreg::keyExists(hive, key, redirection))
+		{
+			xrlog::warning() << "target key already exists, trees will be merged and some values might be overwritten";
+			if (!unattended)
 			{
-				vector<pair<wregex, wstring>> rgxmap;
-				for (auto repl : replacements)
-				{
-					wcout << "replacing " << repl.first << " with " << repl.second << endl;
-					pair<wregex, wstring> p(wregex(repl.first), repl.second);
-					rgxmap.push_back(p);
-				}
-
-				if (com_dll.length() > 0)
-				{
-					// if this parameter was specified in command line, we create four special replacements:
-					// %dir% => is replaced with the parent path of com_dll
-					// %file% => is replaced with the value of com_dll
-					// %dir83% => is replaced with the short (dos 8.3) version of %dir%
-					// %file83% => is replaced with the short (dos 8.3) version of %file%
-
-					wstring directory;
-					wstring filepath = xrutils::getFullPath(com_dll, directory);
-					if (filepath.length() == 0 && directory.length() == 0)
-						wcout << "warning: invalid value for --com-dll, ignoring" << endl;
-					else
-					{
-						wstring file83 = xrutils::getShorPath(filepath);
-						wstring dir83 = xrutils::getShorPath(directory);
-
-						wcout << "replacing %dir% with " << directory << endl;
-						wcout << "replacing %dir83% with " << dir83 << endl;
-						wcout << "replacing %file% with " << filepath << endl;
-						wcout << "replacing %file83% with " << file83 << endl;
-
-						pair<wregex, wstring> p1(wregex(L"%dir%"), directory);
-						pair<wregex, wstring> p2(wregex(L"%dir83%"), dir83);
-						pair<wregex, wstring> p3(wregex(L"%file%"), filepath);
-						pair<wregex, wstring> p4(wregex(L"%file83%"), file83);
-						rgxmap.push_back(p1);
-						rgxmap.push_back(p2);
-						rgxmap.push_back(p3);
-						rgxmap.push_back(p4);
-					}
-				}
-				return convertNode(hive, key, redirection, rgxmap, root, skip_errors);
+				wstring option;
+				xrlog::flush();
+				wcout << "continue? (y/N): ";
+				wcin >> option;
+				transform(option.begin(), option.end(), option.begin(), ::tolower);
+				if (!(option == L"1" || option == L"y" || option == L"yes" || option == L"true"))
+					return ERROR_XRGENERAL_FAILURE;
 			}
 		}
-		else
+		if (undo)
+		{
+			undo->at(hive, redirection);
+			saveMissingKey(*undo, hive, path, redirection);
+		}
+		return openKey(path);
+	}
+
+	// the root key is opened from the hive, every other key relative to its parent
+	int openKey(const wstring& name)
+	{
+		writers.emplace_back(new winreg::keyWriter());
+		positions.emplace_back();
+		spans.emplace_back(new xrtrace::keySpan());
+		if (failed_depth) return 0;
+
+		bool wanted = positions.size() == 1 ? filter.start(positions.back()) : filter.enter(positions[positions.size() - 2], name, positions.back());
+		if (!wanted)
 		{
-			wcout << "error: root element is not 'fragment'" << endl;
-			return ERROR_XRIMPORT_XMLSCHEMA;
+			failed_depth = writers.size();
+			return 0;
 		}
+
+		spans.back()->begin(path);
+		bool opened = writers.size() == 1 ? writers.back()->open(hive, path, redirection) : writers.back()->open(*writers[writers.size() - 2], name);
+		if (!opened)
+		{
+			xrlog::error() << "failed to create key: " << xrutils::redirectionToString(redirection) << path;
+			if (!skip_errors) return ERROR_XRIMPORT_CREATEKEY;
+			failed_depth = writers.size();
+		}
+		else if (undo && writers.size() > 1) saveCreated(*writers.back(), *undo, path);
+		return 0;
 	}
-	else
+
+	int enterKey(const wstring& name) override
 	{
-		wcout << "error: " << parse_result.description() << endl;
-		return ERROR_XRIMPORT_PARSEXML;
+		marks.push_back(path.length());
+		path += L"\\";
+		path += name;
+		return openKey(name);
 	}
-	return ERROR_XRGENERAL_FAILURE;
-}
\ No newline at end of file
+
+	int leaveKey() override
+	{
+		if (failed_depth == writers.size()) failed_depth = 0;
+		writers.pop_back();
+		positions.pop_back();
+		spans.pop_back();
+		path.resize(marks.back());
+		marks.pop_back();
+		return 0;
+	}
+
+	// the file ended before the checkpoint
+	bool shortOfResume() const { return ordinal < resume; }
+
+	int value(const wstring& name, const wstring& type, const wstring& text, const vector<wstring>& list) override
+	{
+		if (++ordinal < resume) return 0;
+		if (ordinal == resume) return checkpointStillThere(*journal, path, false) ? 0 : ERROR_XRIMPORT_JOURNAL;
+		if (failed_depth || !filter.wantsValue(positions.back(), xrutils::stringToPropType(type))) return 0;
+		vector<winreg::valueRecord> values(1);
+		readProperty(*writers.back(), path, rules, name, type, text, list, values[0]);
+		int ret = writeProperties(*writers.back(), path, values, undo, skip_errors);
+		if (ret || !journal || !journal->step()) return ret;
+
+		if (!writers.front()->flush() || !journal->checkpoint({ ordinal }, path))
+		{
+			xrlog::error() << "failed to write a checkpoint to the journal";
+			return ERROR_XRIMPORT_JOURNAL;
+		}
+		return 0;
+	}
+};
+
+int import_jsonfile(wstring file, const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+	const journal_options& journal, bool unattended, bool skip_errors)
+{
+	xrlog::info() << "importing from file " << file;
+
+	xrjournal::journal log;
+	xrundo::undoLog undo;
+	bool finished;
+	int r = openLogs(journal, file, log, undo, finished);
+	if (r || finished) return r;
+	if (log.resumePoint().size() > 0) xrlog::info() << "resuming after value " << log.resumePoint()[0] << " (" << log.resumeKey() << ")";
+
+	jsonImporter importer(rules, target, filter, log.isOpen() ? &log : nullptr, undo.isOpen() ? &undo : nullptr, unattended, skip_errors);
+	wstring error;
+	{
+		xrprogress::display progress(L"importing", xrprogress::MEASURE_OFFSET);
+		r = jsonfile::parseFragment(file, importer, error);
+	}
+
+	if (r == -1)
+	{
+		xrlog::error() << error;
+		return ERROR_XRIMPORT_PARSEJSON;
+	}
+	if (!r && importer.shortOfResume() && !checkpointStillThere(log, L"", true)) return ERROR_XRIMPORT_JOURNAL;
+	if (!r && log.isOpen() && !log.complete())
+	{
+		xrlog::error() << "failed to write the end of the import to the journal";
+		return ERROR_XRIMPORT_JOURNAL;
+	}
+	return r;
+}
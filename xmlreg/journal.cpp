@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "journal.h"
+#include "xmlreg.h"
+
+using namespace std;
+
+namespace xrjournal {
+
+	static const wchar_t* header = L"xmlreg journal";
+
+	static string toUtf8(const wstring& text)
+	{
+		if (text.empty()) return string();
+		int size = WideCharToMultiByte(CP_UTF8, 0, text.data(), (int)text.length(), nullptr, 0, nullptr, nullptr);
+		string ret(size, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, text.data(), (int)text.length(), &ret[0], size, nullptr, nullptr);
+		return ret;
+	}
+
+	static wstring fromUtf8(const string& text)
+	{
+		if (text.empty()) return wstring();
+		int size = MultiByteToWideChar(CP_UTF8, 0, text.data(), (int)text.length(), nullptr, 0);
+		wstring ret(size, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, text.data(), (int)text.length(), &ret[0], size);
+		return ret;
+	}
+
+	static bool readFile(const wstring& path, string& data)
+	{
+		HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (h == INVALID_HANDLE_VALUE) return false;
+		char chunk[65536];
+		DWORD read;
+		while (ReadFile(h, chunk, sizeof(chunk), &read, nullptr) && read > 0) data.append(chunk, read);
+		CloseHandle(h);
+		return true;
+	}
+
+	// "3.0.5"
+	static bool parsePosition(const wstring& text, vector<size_t>& position)
+	{
+		position.clear();
+		size_t start = 0;
+		while (start < text.length())
+		{
+			size_t end = text.find(L'.', start);
+			if (end == wstring::npos) end = text.length();
+			long long index;
+			if (!xrutils::parseInteger(text.substr(start, end - start).c_str(), index) || index < 0) return false;
+			position.push_back((size_t)index);
+			start = end + 1;
+		}
+		return true;
+	}
+
+	journal::~journal()
+	{
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	}
+
+	bool journal::open(const wstring& path, const wstring& source, bool resume, bool force, wstring& error)
+	{
+		forced = force;
+		wstring directory;
+		wstring full_source = xrutils::getFullPath(source, directory);
+
+		string data;
+		bool existing = resume && readFile(path, data);
+		if (existing)
+		{
+			// only complete lines count, the last one can be cut short by whatever stopped the import
+			size_t start = 0, end;
+			bool first = true;
+			while ((end = data.find('\n', start)) != string::npos)
+			{
+				wstring line = fromUtf8(data.substr(start, end - start));
+				start = end + 1;
+				size_t tab = line.find(L'\t');
+				wstring kind = line.substr(0, tab);
+				wstring rest = tab == wstring::npos ? wstring() : line.substr(tab + 1);
+
+				if (first)
+				{
+					if (kind != header || _wcsicmp(rest.c_str(), full_source.c_str()) != 0)
+					{
+						error = L"journal " + path + L" was not written for " + full_source;
+						return false;
+					}
+					first = false;
+				}
+				else if (kind == L"checkpoint")
+				{
+					// a line that does not parse leaves the previous checkpoint in place
+					tab = rest.find(L'\t');
+					vector<size_t> position;
+					if (parsePosition(rest.substr(0, tab), position))
+					{
+						resume_point = position;
+						resume_key = tab == wstring::npos ? wstring() : rest.substr(tab + 1);
+					}
+				}
+				else if (kind == L"done") completed = true;
+			}
+			existing = !first;
+		}
+
+		file = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, existing ? OPEN_ALWAYS : CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			error = L"cannot write journal " + path;
+			return false;
+		}
+		if (!existing && !append(wstring(header) + L"\t" + full_source))
+		{
+			error = L"cannot write journal " + path;
+			return false;
+		}
+		return true;
+	}
+
+	// the line is on disk when this returns
+	bool journal::append(const wstring& line)
+	{
+		string bytes = toUtf8(line);
+		bytes += '\n';
+		DWORD written;
+		return WriteFile(file, bytes.data(), (DWORD)bytes.size(), &written, nullptr) && written == bytes.size() && FlushFileBuffers(file);
+	}
+
+	bool journal::checkpoint(const vector<size_t>& position, const wstring& key)
+	{
+		wstring line = L"checkpoint\t";
+		for (size_t i = 0; i < position.size(); ++i)
+		{
+			if (i > 0) line += L'.';
+			line += to_wstring(position[i]);
+		}
+		line += L"\t";
+		line += key;
+		return append(line);
+	}
+
+	bool journal::complete()
+	{
+		return append(L"done");
+	}
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+// --journal: checkpoints of an import, appended to a text file and flushed to disk one by one,
+// so that --resume can go on from the last one instead of writing everything again
+//
+//   xmlreg journal	C:\full\path\of\fragment.xml
+//   checkpoint	3.0.5	Software\Vendor\App
+//   done
+//
+// a checkpoint is a position in the input: for xml, the index of each <key> among the <key> elements of its parent,
+// from the fragment down; for .reg and json, how many records or values were applied
+namespace xrjournal {
+
+	class journal
+	{
+		HANDLE file = INVALID_HANDLE_VALUE;
+		std::vector<size_t> resume_point;
+		std::wstring resume_key;
+		bool completed = false;
+		bool forced = false;
+		size_t steps = 0;
+
+		bool append(const std::wstring& line);
+
+	public:
+		// units of work (keys, records or values) between two checkpoints
+		static const size_t interval = 1000;
+
+		journal() {}
+		journal(const journal&) = delete;
+		journal& operator=(const journal&) = delete;
+		~journal();
+
+		// starts a new journal for 'source', or with 'resume' reads the last checkpoint of an existing one and appends to it
+		// a missing journal is started from the top, one written for another file is an error
+		// 'force' resumes at the checkpoint even if the key there is no longer the one it names
+		bool open(const std::wstring& path, const std::wstring& source, bool resume, bool force, std::wstring& error);
+		bool isOpen() const { return file != INVALID_HANDLE_VALUE; }
+
+		// empty when there is nothing to skip
+		const std::vector<size_t>& resumePoint() const { return resume_point; }
+		const std::wstring& resumeKey() const { return resume_key; }
+		// the import this journal was written for finished
+		bool isComplete() const { return completed; }
+		bool isForced() const { return forced; }
+
+		// counts a unit of work, true every 'interval' calls
+		bool step() { return ++steps % interval == 0; }
+		// the caller makes sure the registry is on disk up to 'position' first
+		bool checkpoint(const std::vector<size_t>& position, const std::wstring& key);
+		bool complete();
+	};
+}
@@ -0,0 +1,516 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "jsonfile.h"
+#include "xmlreg.h"
+#include "progress.h"
+
+#include <windows.h>
+
+using namespace std;
+
+namespace jsonfile {
+
+	bool selected(const wstring& format, const wstring& file)
+	{
+		if (format.length() > 0) return _wcsicmp(format.c_str(), L"json") == 0;
+		return file.length() > 5 && _wcsicmp(file.c_str() + file.length() - 5, L".json") == 0;
+	}
+
+	// reads the file in fixed size chunks and walks the schema as it goes
+	class parser
+	{
+		FILE* file = nullptr;
+		char chunk[65536];
+		size_t pos = 0, size = 0;
+		size_t line = 1;
+		// bytes of the file read so far, for --progress
+		unsigned long long consumed = 0;
+
+		fragmentVisitor& visitor;
+		bool located = false;
+		wstring hive, key, redirection;
+
+		// reused for every string, to avoid allocating per token
+		wstring text;
+
+	public:
+		int result = 0;
+		wstring error;
+
+		parser(fragmentVisitor& visitor) : visitor(visitor) {}
+		~parser()
+		{
+			if (file) fclose(file);
+		}
+
+		bool open(const wstring& path)
+		{
+			if (_wfopen_s(&file, path.c_str(), L"rb") || !file)
+			{
+				error = L"cannot open " + path;
+				return false;
+			}
+			if (xrprogress::enabled() && _fseeki64(file, 0, SEEK_END) == 0)
+			{
+				xrprogress::setLength(_ftelli64(file));
+				_fseeki64(file, 0, SEEK_SET);
+			}
+			// skip utf-8 bom
+			if (peek() == 0xEF)
+			{
+				get();
+				get();
+				get();
+			}
+			return true;
+		}
+
+		int peek()
+		{
+			if (pos == size)
+			{
+				size = fread(chunk, 1, sizeof(chunk), file);
+				pos = 0;
+				if (size == 0) return -1;
+				consumed += size;
+				xrprogress::setOffset(consumed);
+			}
+			return (unsigned char)chunk[pos];
+		}
+
+		int get()
+		{
+			int c = peek();
+			if (c >= 0) ++pos;
+			if (c == '\n') ++line;
+			return c;
+		}
+
+		bool fail(const wstring& message)
+		{
+			if (error.length() == 0) error = message + L" at line " + to_wstring(line);
+			result = -1;
+			return false;
+		}
+
+		bool check(int r)
+		{
+			result = r;
+			return r == 0;
+		}
+
+		void skipBlanks()
+		{
+			int c;
+			while ((c = peek()) == ' ' || c == '\t' || c == '\r' || c == '\n') get();
+		}
+
+		bool expect(char c)
+		{
+			skipBlanks();
+			if (get() != c) return fail(wstring(L"expected '") + (wchar_t)c + L"'");
+			return true;
+		}
+
+		// true if the container continues, false at its closing character
+		bool more(char close, bool& first)
+		{
+			skipBlanks();
+			if (peek() == close)
+			{
+				get();
+				return false;
+			}
+			if (!first && get() != ',')
+			{
+				fail(L"expected ','");
+				return false;
+			}
+			first = false;
+			skipBlanks();
+			return true;
+		}
+
+		bool hex4(unsigned& code)
+		{
+			code = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				int c = get();
+				int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+				if (digit < 0) return fail(L"invalid \\u escape");
+				code = code * 16 + digit;
+			}
+			return true;
+		}
+
+		// decodes utf-8 and escapes straight into 'out' (utf-16)
+		bool readString(wstring& out)
+		{
+			out.clear();
+			skipBlanks();
+			if (get() != '"') return fail(L"expected string");
+
+			while (true)
+			{
+				int c = get();
+				if (c < 0) return fail(L"unterminated string");
+				if (c == '"') return true;
+
+				if (c == '\\')
+				{
+					c = get();
+					switch (c)
+					{
+					case '"': case '\\': case '/': out += (wchar_t)c; break;
+					case 'b': out += L'\b'; break;
+					case 'f': out += L'\f'; break;
+					case 'n': out += L'\n'; break;
+					case 'r': out += L'\r'; break;
+					case 't': out += L'\t'; break;
+					case 'u':
+					{
+						unsigned code;
+						if (!hex4(code)) return false;
+						out += (wchar_t)code;
+					}
+					break;
+					default: return fail(L"invalid escape");
+					}
+					continue;
+				}
+
+				unsigned code = c;
+				int extra = 0;
+				if (c >= 0xF0) { code = c & 0x07; extra = 3; }
+				else if (c >= 0xE0) { code = c & 0x0F; extra = 2; }
+				else if (c >= 0xC0) { code = c & 0x1F; extra = 1; }
+				for (int i = 0; i < extra; ++i)
+				{
+					int next = get();
+					if (next < 0x80 || next > 0xBF) return fail(L"invalid utf-8");
+					code = (code << 6) | (next & 0x3F);
+				}
+
+				if (code >= 0x10000)
+				{
+					code -= 0x10000;
+					out += (wchar_t)(0xD800 + (code >> 10));
+					out += (wchar_t)(0xDC00 + (code & 0x3FF));
+				}
+				else out += (wchar_t)code;
+			}
+		}
+
+		// numbers and true/false/null are kept as text
+		bool readBare(wstring& out)
+		{
+			out.clear();
+			int c;
+			while ((c = peek()) == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+				out += (wchar_t)get();
+			if (out.length() == 0) return fail(L"unexpected character");
+			return true;
+		}
+
+		bool skipValue()
+		{
+			skipBlanks();
+			int c = peek();
+			if (c == '"') return readString(text);
+			if (c == '{' || c == '[')
+			{
+				char close = c == '{' ? '}' : ']';
+				get();
+				bool first = true;
+				while (more(close, first))
+				{
+					if (close == '}' && (!readString(text) || !expect(':'))) return false;
+					if (!skipValue()) return false;
+				}
+				return result == 0;
+			}
+			return readBare(text);
+		}
+
+		bool locate()
+		{
+			if (located) return true;
+			located = true;
+			return check(visitor.location(hive, key, redirection));
+		}
+
+		bool parseValue(const wstring& name)
+		{
+			wstring type, data;
+			vector<wstring> list;
+
+			if (!expect('{')) return false;
+			bool first = true;
+			wstring member;
+			while (more('}', first))
+			{
+				if (!readString(member) || !expect(':')) return false;
+				skipBlanks();
+				if (member == L"type")
+				{
+					if (!readString(type)) return false;
+				}
+				else if (member == L"data")
+				{
+					if (peek() == '"')
+					{
+						if (!readString(data)) return false;
+					}
+					else if (peek() == '[')
+					{
+						get();
+						bool first_item = true;
+						while (more(']', first_item))
+						{
+							if (!readString(text)) return false;
+							list.push_back(text);
+						}
+						if (result) return false;
+					}
+					else if (!readBare(data)) return false;
+				}
+				else if (!skipValue()) return false;
+			}
+			if (result) return false;
+
+			return check(visitor.value(name, type, data, list));
+		}
+
+		bool parseValues()
+		{
+			if (!expect('{')) return false;
+			bool first = true;
+			wstring name;
+			while (more('}', first))
+			{
+				if (!readString(name) || !expect(':')) return false;
+				if (!parseValue(name)) return false;
+			}
+			return result == 0;
+		}
+
+		bool parseKeys()
+		{
+			if (!expect('{')) return false;
+			bool first = true;
+			wstring name;
+			while (more('}', first))
+			{
+				if (!readString(name) || !expect(':')) return false;
+				if (!check(visitor.enterKey(name))) return false;
+				if (!parseKey(false)) return false;
+				if (!check(visitor.leaveKey())) return false;
+			}
+			return result == 0;
+		}
+
+		bool parseKey(bool root)
+		{
+			if (!expect('{')) return false;
+			bool first = true;
+			wstring member;
+			while (more('}', first))
+			{
+				if (!readString(member) || !expect(':')) return false;
+
+				if (root && (member == L"hive" || member == L"key" || member == L"redirection"))
+				{
+					if (located) return fail(L"hive, key and redirection must come before values and keys");
+					wstring& target = member == L"hive" ? hive : member == L"key" ? key : redirection;
+					if (!readString(target)) return false;
+				}
+				else if (member == L"values")
+				{
+					if (root && !locate()) return false;
+					if (!parseValues()) return false;
+				}
+				else if (member == L"keys")
+				{
+					if (root && !locate()) return false;
+					if (!parseKeys()) return false;
+				}
+				else if (!skipValue()) return false;
+			}
+			if (result) return false;
+			return !root || locate();
+		}
+	};
+
+	int parseFragment(const wstring& file, fragmentVisitor& visitor, wstring& error)
+	{
+		parser p(visitor);
+		if (!p.open(file) || !p.parseKey(true))
+		{
+			error = p.error;
+			return p.result ? p.result : -1;
+		}
+		return 0;
+	}
+
+	writer::~writer()
+	{
+		if (file) fclose(file);
+	}
+
+	bool writer::open(const wstring& path)
+	{
+		if (_wfopen_s(&file, path.c_str(), L"wb") || !file) return false;
+		buffer.reserve(1 << 16);
+		return true;
+	}
+
+	void writer::flush()
+	{
+		if (buffer.size() > 0 && fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) failed = true;
+		buffer.clear();
+	}
+
+	void writer::indent()
+	{
+		buffer += '\n';
+		buffer.append(first.size(), '\t');
+		if (buffer.size() >= (1 << 15)) flush();
+	}
+
+	// comma and new line before anything that is not the value of a key
+	void writer::separate()
+	{
+		if (after_key)
+		{
+			after_key = false;
+			return;
+		}
+		if (first.size() == 0) return;
+		if (!first.back()) buffer += ',';
+		first.back() = false;
+		indent();
+	}
+
+	void writer::quoted(const wstring& text)
+	{
+		static const char* digits = "0123456789abcdef";
+		buffer += '"';
+		for (size_t i = 0; i < text.length(); ++i)
+		{
+			unsigned c = text[i];
+			if (c == '"' || c == '\\')
+			{
+				buffer += '\\';
+				buffer += (char)c;
+			}
+			else if (c < 0x20)
+			{
+				buffer += "\\u00";
+				buffer += digits[c >> 4];
+				buffer += digits[c & 0xF];
+			}
+			else if (c < 0x80) buffer += (char)c;
+			else
+			{
+				if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.length() && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+					c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
+
+				if (c < 0x800)
+				{
+					buffer += (char)(0xC0 | (c >> 6));
+				}
+				else if (c < 0x10000)
+				{
+					buffer += (char)(0xE0 | (c >> 12));
+					buffer += (char)(0x80 | ((c >> 6) & 0x3F));
+				}
+				else
+				{
+					buffer += (char)(0xF0 | (c >> 18));
+					buffer += (char)(0x80 | ((c >> 12) & 0x3F));
+					buffer += (char)(0x80 | ((c >> 6) & 0x3F));
+				}
+				buffer += (char)(0x80 | (c & 0x3F));
+			}
+		}
+		buffer += '"';
+	}
+
+	void writer::beginObject()
+	{
+		separate();
+		buffer += '{';
+		first.push_back(true);
+	}
+
+	void writer::endObject()
+	{
+		bool empty = first.back();
+		first.pop_back();
+		if (!empty) indent();
+		buffer += '}';
+	}
+
+	void writer::beginArray()
+	{
+		separate();
+		buffer += '[';
+		first.push_back(true);
+	}
+
+	void writer::endArray()
+	{
+		endObject();
+		buffer.back() = ']';
+	}
+
+	void writer::key(const wstring& name)
+	{
+		separate();
+		quoted(name);
+		buffer += ": ";
+		after_key = true;
+	}
+
+	void writer::string(const wstring& text)
+	{
+		separate();
+		quoted(text);
+	}
+
+	void writer::number(long long number)
+	{
+		separate();
+		char digits[24];
+		buffer.append(digits, xrutils::formatDecimal(digits, number));
+	}
+
+	bool writer::close()
+	{
+		if (!file) return false;
+		buffer += '\n';
+		flush();
+		if (fclose(file)) failed = true;
+		file = nullptr;
+		return !failed;
+	}
+}
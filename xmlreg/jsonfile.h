@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+// json representation of the <fragment> schema:
+//
+// {
+//	"hive": "HKCU", "key": "Software\\Vendor", "redirection": "64",
+//	"values": { "Path": { "type": "string", "data": "c:\\tool" }, "List": { "type": "multi-string", "data": [ "a", "b" ] } },
+//	"keys": { "Child": { "values": { ... }, "keys": { ... } } }
+// }
+namespace jsonfile {
+
+	// true if 'format' is "json", or if it is empty and 'file' has the .json extension
+	bool selected(const std::wstring& format, const std::wstring& file);
+
+	// receives the fragment while it is being read, nothing is kept in memory
+	// every callback returns 0 to continue, anything else stops the parser and is returned by parseFragment
+	class fragmentVisitor
+	{
+	public:
+		virtual ~fragmentVisitor() {}
+		// called once, before any key or value (empty strings for missing attributes)
+		virtual int location(const std::wstring& hive, const std::wstring& key, const std::wstring& redirection) = 0;
+		virtual int enterKey(const std::wstring& name) = 0;
+		virtual int leaveKey() = 0;
+		// 'text' holds string, number and base64 data, 'list' holds multi-string items
+		virtual int value(const std::wstring& name, const std::wstring& type, const std::wstring& text, const std::vector<std::wstring>& list) = 0;
+	};
+
+	// returns -1 and sets 'error' if the file cannot be read or does not follow the schema
+	int parseFragment(const std::wstring& file, fragmentVisitor& visitor, std::wstring& error);
+
+	// streams a pretty printed (tab indented) utf-8 json document to a file
+	class writer
+	{
+		FILE* file = nullptr;
+		std::string buffer;
+		std::vector<bool> first;
+		bool after_key = false;
+		bool failed = false;
+
+		void separate();
+		void indent();
+		void quoted(const std::wstring& text);
+		void flush();
+
+	public:
+		~writer();
+		bool open(const std::wstring& path);
+		void beginObject();
+		void endObject();
+		void beginArray();
+		void endArray();
+		void key(const std::wstring& name);
+		void string(const std::wstring& text);
+		void number(long long number);
+		bool close();
+	};
+}
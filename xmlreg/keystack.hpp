@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <deque>
+#include <cstddef>
+
+// explicit stack for the depth first traversals of export, import and wipe
+// the registry allows 512 levels of keys, one native call per level would put all of them on the thread stack
+// frames are only constructed the first time a depth is reached, popping one keeps its vectors and strings
+// for the next key at the same depth, and the deque never moves them, so frames can hold handles and refer to their parent
+template <class Frame>
+class keyStack
+{
+	std::deque<Frame> frames;
+	size_t count = 0;
+
+public:
+	// the caller resets whatever the frame kept from its previous key
+	Frame& push()
+	{
+		if (count == frames.size()) frames.emplace_back();
+		return frames[count++];
+	}
+	void pop() { --count; }
+
+	Frame& top() { return frames[count - 1]; }
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+};
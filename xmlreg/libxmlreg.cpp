@@ -0,0 +1,265 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "libxmlreg.h"
+#include "xmlreg.h"
+#include "log.h"
+#include "progress.h"
+#include "regfile.h"
+#include "jsonfile.h"
+#include "document.h"
+
+#include <pugixml.hpp>
+
+#include <chrono>
+
+using namespace std;
+
+namespace libxmlreg {
+
+	static fragment_target targetOf(const options& opts)
+	{
+		fragment_target target;
+		target.has_hive = target.has_key = target.has_redirection = opts.has_target;
+		target.hive = opts.target.hive;
+		target.key = opts.target.key;
+		target.redirection = opts.target.redirection;
+		return target;
+	}
+
+	static xrfilter::keyFilter filterOf(const options& opts)
+	{
+		xrfilter::keyFilter filter;
+		for (auto& pattern : opts.include) filter.include(pattern);
+		for (auto& pattern : opts.exclude) filter.exclude(pattern);
+		for (auto type : opts.value_types) filter.allowType(type);
+		return filter;
+	}
+
+	static journal_options journalOf(const options& opts)
+	{
+		journal_options journal;
+		journal.file = opts.journal;
+		journal.resume = opts.resume || opts.force_resume;
+		journal.force_resume = opts.force_resume;
+		journal.undo_file = opts.undo_log;
+		return journal;
+	}
+
+	// runs 'work' and fills the rest of the result from its return code
+	// the summary of repeated warnings is written before returning
+	template<class Work>
+	static result measure(Work work)
+	{
+		result ret;
+		auto started = chrono::steady_clock::now();
+		ret.code = work();
+		ret.elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+		if (ret.code) ret.error = xrutils::errorToString(ret.code);
+		xrlog::finish();
+		return ret;
+	}
+
+	static int readAll(const reader& in, string& data)
+	{
+		if (!in) return ERROR_XRGENERAL_FAILURE;
+		char chunk[65536];
+		size_t read;
+		while ((read = in(chunk, sizeof(chunk))) > 0) data.append(chunk, read);
+		return 0;
+	}
+
+	// a wine registry file only takes xml fragments
+	static bool wineFormat(const wstring& file, const options& opts)
+	{
+		return opts.wine_file.length() == 0 || (!regfile::selected(opts.format, file) && !jsonfile::selected(opts.format, file));
+	}
+
+	void setLogging(verbosity v, bool json)
+	{
+		xrlog::setLevel(v == VERBOSITY_QUIET ? xrlog::LEVEL_ERROR : v == VERBOSITY_VERBOSE ? xrlog::LEVEL_DEBUG : xrlog::LEVEL_INFO);
+		xrlog::setJson(json);
+	}
+
+	void enableProgress()
+	{
+		xrprogress::enable();
+	}
+
+	result importFile(const wstring& file, const options& opts)
+	{
+		return measure([&]() {
+			if (!wineFormat(file, opts)) return ERROR_XRUSAGE_WINE_FORMAT;
+
+			replacement_rules rules = compile_replacements(opts.replacements, opts.com_dll);
+			if (opts.wine_file.length() > 0)
+				return import_wine(file, opts.wine_file, rules, targetOf(opts), filterOf(opts), opts.unattended, opts.skip_errors);
+			if (regfile::selected(opts.format, file))
+				return import_regfile(file, rules, opts.target.redirection, filterOf(opts), journalOf(opts), opts.skip_errors);
+			if (jsonfile::selected(opts.format, file))
+				return import_jsonfile(file, rules, targetOf(opts), filterOf(opts), journalOf(opts), opts.unattended, opts.skip_errors);
+			return import_reg(file, rules, targetOf(opts), filterOf(opts), journalOf(opts), opts.unattended, opts.skip_errors);
+		});
+	}
+
+	result wipeFile(const wstring& file, const options& opts)
+	{
+		return measure([&]() {
+			if (!wineFormat(file, opts)) return ERROR_XRUSAGE_WINE_FORMAT;
+
+			if (opts.wine_file.length() > 0)
+				return wipe_wine(file, opts.wine_file, targetOf(opts), filterOf(opts), opts.unattended, opts.skip_errors, opts.dry_run);
+			if (regfile::selected(opts.format, file))
+				return wipe_regfile(file, opts.target.redirection, filterOf(opts), opts.skip_errors, opts.dry_run);
+			if (jsonfile::selected(opts.format, file))
+				return wipe_jsonfile(file, targetOf(opts), filterOf(opts), opts.unattended, opts.skip_errors, opts.dry_run);
+			return wipe_reg(file, targetOf(opts), filterOf(opts), opts.unattended, opts.skip_errors, opts.dry_run);
+		});
+	}
+
+	result exportFile(const wstring& file, const location& input, const location& output, const options& opts)
+	{
+		return measure([&]() {
+			if (!wineFormat(file, opts)) return ERROR_XRUSAGE_WINE_FORMAT;
+
+			if (opts.wine_file.length() > 0)
+				return export_wine(file, opts.wine_file, input.hive, input.key, input.redirection,
+					output.hive, output.key, output.redirection, filterOf(opts), opts.unattended, opts.skip_errors, opts.hex_numbers);
+			if (regfile::selected(opts.format, file))
+				return export_regfile(file, input.hive, input.key, input.redirection,
+					output.hive, output.key, filterOf(opts), opts.unattended, opts.skip_errors);
+			if (jsonfile::selected(opts.format, file))
+				return export_jsonfile(file, input.hive, input.key, input.redirection,
+					output.hive, output.key, output.redirection, filterOf(opts), opts.unattended, opts.skip_errors);
+			return export_reg(file, input.hive, input.key, input.redirection,
+				output.hive, output.key, output.redirection, filterOf(opts), opts.unattended, opts.skip_errors, opts.hex_numbers);
+		});
+	}
+
+	result batchFile(const wstring& file, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+			return batch_reg(file, opts.unattended, opts.skip_errors, opts.dry_run);
+		});
+	}
+
+	result rollbackFile(const wstring& undo_log, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+			return rollback_reg(undo_log, opts.skip_errors, opts.dry_run);
+		});
+	}
+
+	result verifyFile(const wstring& file, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0 || regfile::selected(opts.format, file) || jsonfile::selected(opts.format, file))
+				return ERROR_XRUSAGE_VERIFY_FORMAT;
+			return verify_reg(file, compile_replacements(opts.replacements, opts.com_dll), targetOf(opts), filterOf(opts), opts.first_mismatch);
+		});
+	}
+
+	result copyKeys(const location& input, const location& output, const options& opts)
+	{
+		return measure([&]() {
+			replacement_rules rules = compile_replacements(opts.replacements, opts.com_dll);
+			if (opts.wine_file.length() > 0)
+				return copy_wine(opts.wine_file, input.hive, input.key, input.redirection, output.hive, output.key, output.redirection,
+					rules, filterOf(opts), opts.unattended, opts.skip_errors);
+			return copy_reg(input.hive, input.key, input.redirection, output.hive, output.key, output.redirection,
+				rules, filterOf(opts), opts.unattended, opts.skip_errors);
+		});
+	}
+
+	result serve(const wstring& pipe_name, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+			return serve_reg(pipe_name, opts.skip_errors);
+		});
+	}
+
+	result importBuffer(const void* data, size_t size, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+
+			pugi::xml_document doc;
+			pugi::xml_parse_result parse_result = loadDocument(doc, data, size);
+			if (parse_result.status != pugi::status_ok)
+			{
+				xrlog::error() << parse_result.description();
+				return ERROR_XRIMPORT_PARSEXML;
+			}
+			return import_fragment(doc, compile_replacements(opts.replacements, opts.com_dll), targetOf(opts), filterOf(opts),
+				opts.unattended, opts.skip_errors);
+		});
+	}
+
+	result importStream(const reader& in, const options& opts)
+	{
+		// pugi needs the whole document anyway
+		string data;
+		result ret = measure([&]() { return readAll(in, data); });
+		return ret.ok() ? importBuffer(data.data(), data.size(), opts) : ret;
+	}
+
+	result wipeBuffer(const void* data, size_t size, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+
+			pugi::xml_document doc;
+			pugi::xml_parse_result parse_result = loadDocument(doc, data, size);
+			if (parse_result.status != pugi::status_ok)
+			{
+				xrlog::error() << parse_result.description();
+				return ERROR_XRWIPE_PARSEXML;
+			}
+			return wipe_fragment(doc, targetOf(opts), filterOf(opts), opts.unattended, opts.skip_errors, opts.dry_run);
+		});
+	}
+
+	result wipeStream(const reader& in, const options& opts)
+	{
+		string data;
+		result ret = measure([&]() { return readAll(in, data); });
+		return ret.ok() ? wipeBuffer(data.data(), data.size(), opts) : ret;
+	}
+
+	result exportStream(const writer& out, const location& input, const location& output, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+			return export_stream(out, input.hive, input.key, input.redirection,
+				output.hive, output.key, output.redirection, filterOf(opts), opts.skip_errors, opts.hex_numbers);
+		});
+	}
+
+	result exportVisit(visitor& v, const location& input, const options& opts)
+	{
+		return measure([&]() {
+			if (opts.wine_file.length() > 0) return ERROR_XRUSAGE_WINE_FORMAT;
+			return export_visit(v, input.hive, input.key, input.redirection, filterOf(opts), opts.skip_errors);
+		});
+	}
+}
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <windows.h>
+
+// in-process api of the libxmlreg static library, the xmlreg command line is a thin wrapper over it
+// every call is synchronous and returns a result instead of exiting, messages still go to the console (see setLogging)
+namespace libxmlreg {
+
+	// a registry location, as the hive, key and redirection attributes of a <fragment>
+	struct location
+	{
+		HKEY hive = HKEY_CURRENT_USER;
+		std::wstring key;
+		REGSAM redirection = 0;
+	};
+
+	struct options
+	{
+		// --match/--replace pairs and --com-dll, applied to the values being imported
+		std::map<std::wstring, std::wstring> replacements;
+		std::wstring com_dll;
+		// overrides the location stored in the fragment when set
+		// target.redirection also applies to .reg files, which name their own hives and keys
+		bool has_target = false;
+		location target;
+		// xml, reg or json for the file functions, chosen by the file extension when empty
+		std::wstring format;
+		// a wine registry file to use instead of the registry (xml only)
+		std::wstring wine_file;
+		// false asks on the console before merging into existing keys or overwriting files
+		bool unattended = true;
+		bool skip_errors = false;
+		bool dry_run = false;
+		bool hex_numbers = false;
+		// --include/--exclude key patterns and --value-types (REG_* constants), see filter.h
+		// every key and value is kept when all three are empty
+		std::vector<std::wstring> include;
+		std::vector<std::wstring> exclude;
+		std::vector<unsigned long> value_types;
+		// --journal and --resume, checkpoints of importFile into the registry (not with wine_file)
+		std::wstring journal;
+		bool resume = false;
+		// --force-resume, resumes even if the input no longer has the key of the last checkpoint (sets resume too)
+		bool force_resume = false;
+		// --undo-log, the old values importFile overwrites, for rollbackFile (not with wine_file)
+		std::wstring undo_log;
+		// verifyFile stops at the first difference
+		bool first_mismatch = false;
+	};
+
+	struct result
+	{
+		int code = 0;			// 0, or one of the ERROR_XR* codes in xmlreg.h
+		std::wstring error;		// what 'code' means
+		double elapsed_ms = 0;
+
+		bool ok() const { return code == 0; }
+	};
+
+	// copies up to 'size' bytes of the input into 'buffer', 0 at the end
+	typedef std::function<size_t(void* buffer, size_t size)> reader;
+	// takes the next chunk of the output, false stops the export
+	typedef std::function<bool(const void* data, size_t size)> writer;
+
+	// receives an export as the registry is read, without any xml
+	// the root key is not announced, its values come first and then one enterKey/leaveKey pair per subkey
+	// a nonzero return stops the visit and becomes the result code
+	class visitor
+	{
+	public:
+		virtual ~visitor() {}
+		virtual int enterKey(const std::wstring& name) = 0;
+		virtual int leaveKey() = 0;
+		virtual int value(const std::wstring& name, unsigned long type, const void* data, size_t size) = 0;
+	};
+
+	enum verbosity
+	{
+		VERBOSITY_QUIET,		// errors only
+		VERBOSITY_NORMAL,		// repeated warnings (such as replaced values) are summed up after the first few
+		VERBOSITY_VERBOSE		// every message
+	};
+
+	// for the whole process, 'json' writes one json object per line instead of text
+	void setLogging(verbosity v, bool json);
+	// a status line with the values done and an eta while import, export and wipe calls run (--progress), for the whole process
+	void enableProgress();
+
+	// files of any supported format, as the command line
+	result importFile(const std::wstring& file, const options& opts);
+	result wipeFile(const std::wstring& file, const options& opts);
+	result exportFile(const std::wstring& file, const location& input, const location& output, const options& opts);
+	result batchFile(const std::wstring& file, const options& opts);
+	// undoes an importFile that had an undo_log, from the newest change back
+	result rollbackFile(const std::wstring& undo_log, const options& opts);
+	// checks that the registry has what an xml fragment names, without writing, ERROR_XRVERIFY_MISMATCH if not
+	result verifyFile(const std::wstring& file, const options& opts);
+	// copies input to output without a file, within wine_file if it is set (replacements, include/exclude and value_types apply)
+	result copyKeys(const location& input, const location& output, const options& opts);
+	// returns when a client sends <stop />
+	result serve(const std::wstring& pipe_name, const options& opts);
+
+	// xml fragments in memory (plain or gzip compressed) or read through a callback
+	result importBuffer(const void* data, size_t size, const options& opts);
+	result importStream(const reader& in, const options& opts);
+	result wipeBuffer(const void* data, size_t size, const options& opts);
+	result wipeStream(const reader& in, const options& opts);
+
+	// the xml text of a fragment, handed to 'out' in chunks from a worker thread
+	result exportStream(const writer& out, const location& input, const location& output, const options& opts);
+	// the keys and values below 'input', on the calling thread
+	result exportVisit(visitor& v, const location& input, const options& opts);
+}
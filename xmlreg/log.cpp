@@ -0,0 +1,287 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "log.h"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <iostream>
+#include <condition_variable>
+
+using namespace std;
+
+namespace xrlog {
+
+	// occurrences of a repeated warning written before the rest are only counted
+	static const unsigned long long repeat_limit = 10;
+
+	static atomic<int> current_level{ LEVEL_INFO };
+	static atomic<bool> json_lines{ false };
+	static atomic<unsigned long long> repeats[REPEAT_COUNT];
+
+	// lines are appended to 'pending' under the lock and the writer thread takes all of them at once,
+	// so a burst of messages costs one console write instead of one flush per line
+	class sink
+	{
+		mutex lock;
+		condition_variable wake;
+		condition_variable drained;
+		wstring pending;
+		unsigned long long queued = 0;
+		unsigned long long written = 0;
+		bool stopping = false;
+		thread writer;
+		// the status line, and whether it changed since it was last drawn
+		wstring status;
+		bool status_changed = false;
+		// characters of the status line on the console, only used by the writer thread
+		size_t status_shown = 0;
+
+		void run()
+		{
+			wstring batch, line;
+			unique_lock<mutex> guard(lock);
+			while (true)
+			{
+				wake.wait(guard, [this]() { return stopping || pending.length() > 0 || status_changed; });
+				if (pending.empty() && !status_changed) return;
+
+				batch.swap(pending);
+				unsigned long long taken = queued;
+				// messages go above the status line, so it is erased and drawn again after them
+				bool redraw = status_changed || (batch.length() > 0 && status_shown > 0);
+				if (redraw) line = status;
+				status_changed = false;
+				guard.unlock();
+				if (redraw && status_shown > 0)
+				{
+					wstring blank(status_shown, L' ');
+					batch.insert(0, L"\r" + blank + L"\r");
+				}
+				if (redraw)
+				{
+					batch += line;
+					status_shown = line.length();
+				}
+				wcout.write(batch.data(), batch.length());
+				wcout.flush();
+				batch.clear();
+				guard.lock();
+
+				written = taken;
+				drained.notify_all();
+			}
+		}
+
+	public:
+		~sink()
+		{
+			{
+				lock_guard<mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_one();
+			if (writer.joinable()) writer.join();
+		}
+
+		void push(const wstring& line)
+		{
+			lock_guard<mutex> guard(lock);
+			// started by the first message, runs until the process exits
+			if (!writer.joinable()) writer = thread(&sink::run, this);
+			if (pending.empty()) wake.notify_one();
+			pending += line;
+			++queued;
+		}
+
+		void setStatus(const wstring& text)
+		{
+			lock_guard<mutex> guard(lock);
+			if (!writer.joinable()) writer = thread(&sink::run, this);
+			status = text;
+			status_changed = true;
+			wake.notify_one();
+		}
+
+		void flush()
+		{
+			unique_lock<mutex> guard(lock);
+			drained.wait(guard, [this]() { return written == queued; });
+		}
+	};
+
+	static sink console;
+
+	static const wchar_t* levelName(level l)
+	{
+		switch (l)
+		{
+		case LEVEL_ERROR: return L"error";
+		case LEVEL_WARNING: return L"warning";
+		case LEVEL_INFO: return L"info";
+		default: return L"debug";
+		}
+	}
+
+	static const wchar_t* repeatedName(repeated r)
+	{
+		switch (r)
+		{
+		case REPEAT_REPLACED_VALUE: return L"replaced_value";
+		case REPEAT_KEPT_KEY: return L"kept_key";
+		default: return L"unknown_element";
+		}
+	}
+
+	// plain ascii, so the output does not depend on the code page of the console
+	static void appendQuoted(wstring& out, const wstring& text)
+	{
+		static const wchar_t* hex = L"0123456789abcdef";
+		out += L'"';
+		for (wchar_t c : text)
+		{
+			if (c == L'"' || c == L'\\')
+			{
+				out += L'\\';
+				out += c;
+			}
+			else if (c == L'\n') out += L"\\n";
+			else if (c == L'\t') out += L"\\t";
+			else if (c < 0x20 || c > 0x7e)
+			{
+				out += L"\\u";
+				for (int shift = 12; shift >= 0; shift -= 4) out += hex[(c >> shift) & 0xF];
+			}
+			else out += c;
+		}
+		out += L'"';
+	}
+
+	// errors and warnings are prefixed like they always were, other lines are written as they are
+	static void write(level l, const wstring& text, const wchar_t* repeated_name = nullptr, unsigned long long count = 0)
+	{
+		wstring line;
+		if (json_lines)
+		{
+			line = L"{\"level\":\"";
+			line += levelName(l);
+			line += L"\",\"message\":";
+			appendQuoted(line, text);
+			if (repeated_name)
+			{
+				line += L",\"repeated\":\"";
+				line += repeated_name;
+				line += L"\",\"count\":";
+				line += to_wstring(count);
+			}
+			line += L"}\n";
+		}
+		else
+		{
+			if (l == LEVEL_ERROR) line = L"error: ";
+			else if (l == LEVEL_WARNING) line = L"warning: ";
+			line += text;
+			line += L'\n';
+		}
+		console.push(line);
+	}
+
+	wstring groupDigits(unsigned long long n)
+	{
+		wstring digits = to_wstring(n);
+		wstring ret;
+		for (size_t i = 0; i < digits.length(); ++i)
+		{
+			if (i > 0 && (digits.length() - i) % 3 == 0) ret += L',';
+			ret += digits[i];
+		}
+		return ret;
+	}
+
+	void setLevel(level l)
+	{
+		current_level = l;
+	}
+
+	void setJson(bool json)
+	{
+		json_lines = json;
+	}
+
+	bool enabled(level l)
+	{
+		return l <= current_level;
+	}
+
+	bool repeat(repeated r)
+	{
+		unsigned long long n = ++repeats[r];
+		return enabled(LEVEL_WARNING) && (n <= repeat_limit || enabled(LEVEL_DEBUG));
+	}
+
+	void status(const wstring& text)
+	{
+		if (!json_lines)
+		{
+			console.setStatus(text);
+			return;
+		}
+		if (text.length() == 0) return;
+		wstring line = L"{\"level\":\"progress\",\"message\":";
+		appendQuoted(line, text);
+		line += L"}\n";
+		console.push(line);
+	}
+
+	void flush()
+	{
+		console.flush();
+	}
+
+	void finish()
+	{
+		for (int r = 0; r < REPEAT_COUNT; ++r)
+		{
+			unsigned long long n = repeats[r].exchange(0);
+			if (n == 0 || !enabled(LEVEL_WARNING)) continue;
+
+			wstring text;
+			switch (r)
+			{
+			case REPEAT_REPLACED_VALUE: text = L"replaced " + groupDigits(n) + L" existing value(s)"; break;
+			case REPEAT_KEPT_KEY: text = L"kept " + groupDigits(n) + L" key(s) with contents that are not defined in xml"; break;
+			default: text = L"ignored " + groupDigits(n) + L" unknown element(s)"; break;
+			}
+			if (n > repeat_limit && !enabled(LEVEL_DEBUG)) text += L", the first " + to_wstring(repeat_limit) + L" shown above";
+			write(LEVEL_WARNING, text, repeatedName((repeated)r), n);
+		}
+		flush();
+	}
+
+	message::message(level l) : l(l), active(enabled(l))
+	{
+	}
+
+	message::~message()
+	{
+		if (active) write(l, text.str());
+	}
+}
@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <sstream>
+
+// console messages of every operation, queued and written by a background thread
+// the console is slow to flush, so lines are written in batches instead of one endl at a time
+namespace xrlog {
+
+	enum level
+	{
+		LEVEL_ERROR,		// always written
+		LEVEL_WARNING,		// hidden by --quiet
+		LEVEL_INFO,			// what is being done, hidden by --quiet
+		LEVEL_DEBUG			// only with --verbose
+	};
+
+	// warnings that can come once per value or key
+	// only the first few of each are written unless --verbose is used, finish() reports how many there were
+	enum repeated
+	{
+		REPEAT_REPLACED_VALUE,
+		REPEAT_KEPT_KEY,
+		REPEAT_UNKNOWN_ELEMENT,
+		REPEAT_COUNT
+	};
+
+	void setLevel(level l);
+	// one json object per line instead of text: {"level":"warning","message":"..."}
+	void setJson(bool json);
+	bool enabled(level l);
+
+	// counts one occurrence, true if it should also be written
+	bool repeat(repeated r);
+
+	// a line kept below the messages and rewritten in place (such as --progress), an empty text removes it
+	// with json, every call is written as a {"level":"progress"} line instead
+	void status(const std::wstring& text);
+
+	// 84211 as "84,211", for counts in messages
+	std::wstring groupDigits(unsigned long long n);
+
+	// waits until everything queued is on the console, before asking the user something
+	void flush();
+	// writes the summary of repeated warnings, resets their counters and flushes
+	void finish();
+
+	// one message, queued when the object is destroyed
+	// xrlog::warning() << "ignoring unknown element " << name;
+	class message
+	{
+		level l;
+		bool active;
+		std::wostringstream text;
+	public:
+		message(level l);
+		~message();
+
+		template<class T>
+		message& operator<<(const T& value)
+		{
+			if (active) text << value;
+			return *this;
+		}
+	};
+
+	struct error : message { error() : message(LEVEL_ERROR) {} };
+	struct warning : message { warning() : message(LEVEL_WARNING) {} };
+	struct info : message { info() : message(LEVEL_INFO) {} };
+	struct debug : message { debug() : message(LEVEL_DEBUG) {} };
+}
@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// bounded queue between two pipeline stages, one producer thread and one consumer thread, without locks
+// push() waits while the queue is full and pop() while it is empty, so the pipeline runs at the pace of its slowest stage
+template <class T>
+class spscQueue
+{
+	std::vector<T> slots;
+	size_t mask;
+	alignas(64) std::atomic<size_t> head;		// next slot to pop, only moved by the consumer
+	alignas(64) std::atomic<size_t> tail;		// next slot to push, only moved by the producer
+
+public:
+	// 'capacity' is rounded up to a power of two
+	spscQueue(size_t capacity) : head(0), tail(0)
+	{
+		size_t size = 1;
+		while (size < capacity) size <<= 1;
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	void push(T&& item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		while (t - head.load(std::memory_order_acquire) == slots.size()) std::this_thread::yield();
+		slots[t & mask] = std::move(item);
+		tail.store(t + 1, std::memory_order_release);
+	}
+
+	void pop(T& item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		while (tail.load(std::memory_order_acquire) == h) std::this_thread::yield();
+		item = std::move(slots[h & mask]);
+		head.store(h + 1, std::memory_order_release);
+	}
+};
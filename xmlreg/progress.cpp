@@ -0,0 +1,200 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "progress.h"
+#include "log.h"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+
+using namespace std;
+
+namespace xrprogress {
+
+	static bool is_enabled = false;
+
+	// relaxed everywhere, the ticker only needs a recent value of each
+	static atomic<unsigned long long> keys_done{ 0 }, values_done{ 0 };
+	static atomic<unsigned long long> keys_total{ 0 }, values_total{ 0 };
+	static atomic<bool> total_known{ false };
+	static atomic<unsigned long long> offset{ 0 }, length{ 0 };
+
+	static const chrono::milliseconds tick(500);
+
+	using xrlog::groupDigits;
+
+	// 1:02:03 or 2:03
+	static wstring formatDuration(double seconds)
+	{
+		unsigned long long s = (unsigned long long)(seconds + 0.5);
+		wstring ret;
+		if (s >= 3600)
+		{
+			ret = to_wstring(s / 3600) + L":";
+			if ((s / 60) % 60 < 10) ret += L'0';
+		}
+		ret += to_wstring((s / 60) % 60) + L":";
+		if (s % 60 < 10) ret += L'0';
+		return ret + to_wstring(s % 60);
+	}
+
+	class ticker
+	{
+		mutex lock;
+		condition_variable wake;
+		bool stopping = false;
+		thread worker;
+		wstring verb;
+		measure m = MEASURE_ITEMS;
+		chrono::steady_clock::time_point started;
+
+		// the fraction done, negative while it is not known
+		double fraction() const
+		{
+			if (m == MEASURE_OFFSET)
+			{
+				unsigned long long total = length.load(memory_order_relaxed);
+				return total ? (double)offset.load(memory_order_relaxed) / total : -1;
+			}
+			if (!total_known.load(memory_order_relaxed)) return -1;
+			unsigned long long total = keys_total.load(memory_order_relaxed) + values_total.load(memory_order_relaxed);
+			unsigned long long done = keys_done.load(memory_order_relaxed) + values_done.load(memory_order_relaxed);
+			// the registry can change between the pre-count and the export
+			return total ? min(1.0, (double)done / total) : -1;
+		}
+
+		wstring line() const
+		{
+			double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+			unsigned long long values = values_done.load(memory_order_relaxed);
+			double f = fraction();
+
+			wstring text = verb;
+			if (f >= 0) text += L" " + to_wstring((int)(f * 100)) + L"%,";
+			text += L" " + groupDigits(values) + L" values";
+			if (elapsed > 0) text += L", " + groupDigits((unsigned long long)(values / elapsed)) + L" values/s";
+			if (f > 0 && f < 1) text += L", eta " + formatDuration(elapsed * (1 - f) / f);
+			else if (f < 0 && m == MEASURE_ITEMS) text += L", counting " + groupDigits(keys_total.load(memory_order_relaxed)) + L" keys";
+			return text;
+		}
+
+		void run()
+		{
+			unique_lock<mutex> guard(lock);
+			while (!wake.wait_for(guard, tick, [this]() { return stopping; }))
+				xrlog::status(line());
+		}
+
+	public:
+		// displays alive, only changed with 'displays' held so that start and stop each run once
+		unsigned depth = 0;
+		mutex displays;
+
+		void start(const wchar_t* v, measure how)
+		{
+			verb = v;
+			m = how;
+			keys_done = values_done = keys_total = values_total = offset = length = 0;
+			total_known = false;
+			stopping = false;
+			started = chrono::steady_clock::now();
+			worker = thread(&ticker::run, this);
+		}
+
+		void stop()
+		{
+			{
+				lock_guard<mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_one();
+			worker.join();
+
+			double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+			unsigned long long values = values_done.load();
+			xrlog::status(L"");
+			xrlog::info() << L"done in " << formatDuration(elapsed) << L", " << groupDigits(values) << L" values"
+				<< L" (" << groupDigits(elapsed > 0 ? (unsigned long long)(values / elapsed) : values) << L" values/s)";
+		}
+	};
+
+	static ticker current;
+
+	void enable()
+	{
+		is_enabled = true;
+	}
+
+	bool enabled()
+	{
+		return is_enabled;
+	}
+
+	// only the outermost display runs the ticker, an export that calls another one keeps the first line
+	// parallel batch jobs each make one on their own thread, the first to get here starts the ticker
+	display::display(const wchar_t* verb, measure m) : active(is_enabled)
+	{
+		if (!active) return;
+		lock_guard<mutex> guard(current.displays);
+		if (current.depth++ == 0) current.start(verb, m);
+	}
+
+	display::~display()
+	{
+		if (!active) return;
+		lock_guard<mutex> guard(current.displays);
+		if (--current.depth == 0) current.stop();
+	}
+
+	void addTotal(unsigned long long keys, unsigned long long values)
+	{
+		if (!is_enabled) return;
+		keys_total.fetch_add(keys, memory_order_relaxed);
+		values_total.fetch_add(values, memory_order_relaxed);
+	}
+
+	void totalKnown()
+	{
+		total_known = true;
+	}
+
+	void addKeys(unsigned long long n)
+	{
+		if (is_enabled) keys_done.fetch_add(n, memory_order_relaxed);
+	}
+
+	void addValues(unsigned long long n)
+	{
+		if (is_enabled) values_done.fetch_add(n, memory_order_relaxed);
+	}
+
+	void setLength(unsigned long long n)
+	{
+		if (is_enabled) length.store(n, memory_order_relaxed);
+	}
+
+	void setOffset(unsigned long long n)
+	{
+		if (is_enabled) offset.store(n, memory_order_relaxed);
+	}
+}
@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+
+// --progress: a status line with the values done, values per second and an eta, rewritten by a background ticker
+// the traversals only bump atomic counters, everything else (rates, formatting, the console) happens on the ticker thread
+namespace xrprogress {
+
+	// how the fraction done is measured
+	enum measure
+	{
+		MEASURE_ITEMS,		// keys and values done against a total, which a pre-count can still be adding to
+		MEASURE_OFFSET		// position in the input file against its length
+	};
+
+	// nothing is counted or shown until this is called
+	void enable();
+	bool enabled();
+
+	// the status line is shown while one of these exists, and a summary is written when the outermost one goes away
+	class display
+	{
+		bool active;
+	public:
+		display(const wchar_t* verb, measure m);
+		~display();
+		display(const display&) = delete;
+		display& operator=(const display&) = delete;
+	};
+
+	// MEASURE_ITEMS, the pre-count adds to the totals from its own threads and calls totalKnown when it is done
+	void addTotal(unsigned long long keys, unsigned long long values);
+	void totalKnown();
+	void addKeys(unsigned long long n);
+	void addValues(unsigned long long n);
+
+	// MEASURE_OFFSET, in whatever unit the input is read (bytes, or characters once decoded)
+	void setLength(unsigned long long length);
+	void setOffset(unsigned long long offset);
+}
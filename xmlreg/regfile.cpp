@@ -0,0 +1,559 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "regfile.h"
+#include "progress.h"
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace regfile {
+
+	static const wchar_t* header5 = L"Windows Registry Editor Version 5.00";
+	static const wchar_t* header4 = L"REGEDIT4";
+
+	bool selected(const wstring& format, const wstring& file)
+	{
+		if (format.length() > 0) return _wcsicmp(format.c_str(), L"reg") == 0;
+		return file.length() > 4 && _wcsicmp(file.c_str() + file.length() - 4, L".reg") == 0;
+	}
+
+	wstring hiveToString(HKEY hive)
+	{
+		if (hive == HKEY_LOCAL_MACHINE) return L"HKEY_LOCAL_MACHINE";
+		if (hive == HKEY_CURRENT_USER) return L"HKEY_CURRENT_USER";
+		if (hive == HKEY_USERS) return L"HKEY_USERS";
+		if (hive == HKEY_CLASSES_ROOT) return L"HKEY_CLASSES_ROOT";
+		return L"INVALID";
+	}
+
+	static bool stringToHive(const wchar_t* begin, const wchar_t* end, HKEY& hive)
+	{
+		wstring name(begin, end);
+		transform(name.begin(), name.end(), name.begin(), ::towupper);
+		if (name == L"HKEY_LOCAL_MACHINE" || name == L"HKLM") hive = HKEY_LOCAL_MACHINE;
+		else if (name == L"HKEY_CURRENT_USER" || name == L"HKCU") hive = HKEY_CURRENT_USER;
+		else if (name == L"HKEY_USERS" || name == L"HKU") hive = HKEY_USERS;
+		else if (name == L"HKEY_CLASSES_ROOT" || name == L"HKCR") hive = HKEY_CLASSES_ROOT;
+		else return false;
+		return true;
+	}
+
+	// whole file, decoded to utf-16
+	static bool readText(const wstring& path, wstring& text, wstring& error)
+	{
+		FILE* file = nullptr;
+		if (_wfopen_s(&file, path.c_str(), L"rb") || !file)
+		{
+			error = L"cannot open " + path;
+			return false;
+		}
+
+		string bytes;
+		char chunk[65536];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) bytes.append(chunk, read);
+		fclose(file);
+
+		if (bytes.size() >= 2 && (unsigned char)bytes[0] == 0xFF && (unsigned char)bytes[1] == 0xFE)
+		{
+			text.resize((bytes.size() - 2) / sizeof(wchar_t));
+			memcpy(&text[0], bytes.data() + 2, text.size() * sizeof(wchar_t));
+			return true;
+		}
+
+		// version 4 files are ansi, anything else without a bom is taken as utf-8
+		UINT codepage = bytes.compare(0, 8, "REGEDIT4") == 0 ? CP_ACP : CP_UTF8;
+		size_t skip = bytes.compare(0, 3, "\xEF\xBB\xBF") == 0 ? 3 : 0;
+		if (bytes.size() == skip) return true;
+		int size = MultiByteToWideChar(codepage, 0, bytes.data() + skip, (int)(bytes.size() - skip), nullptr, 0);
+		text.resize(size);
+		MultiByteToWideChar(codepage, 0, bytes.data() + skip, (int)(bytes.size() - skip), &text[0], size);
+		return true;
+	}
+
+	struct cursor
+	{
+		const wchar_t* p;
+		const wchar_t* end;
+		size_t line;
+	};
+
+	static bool atEol(const cursor& c)
+	{
+		return c.p >= c.end || *c.p == L'\r' || *c.p == L'\n';
+	}
+
+	static void skipBlanks(cursor& c)
+	{
+		while (c.p < c.end && (*c.p == L' ' || *c.p == L'\t')) ++c.p;
+	}
+
+	static void skipLine(cursor& c)
+	{
+		while (c.p < c.end && *c.p != L'\n') ++c.p;
+		if (c.p < c.end)
+		{
+			++c.p;
+			++c.line;
+		}
+	}
+
+	static bool startsWith(const cursor& c, const wchar_t* prefix)
+	{
+		size_t length = wcslen(prefix);
+		return (size_t)(c.end - c.p) >= length && _wcsnicmp(c.p, prefix, length) == 0;
+	}
+
+	static int hexDigit(wchar_t c)
+	{
+		if (c >= L'0' && c <= L'9') return c - L'0';
+		if (c >= L'a' && c <= L'f') return c - L'a' + 10;
+		if (c >= L'A' && c <= L'F') return c - L'A' + 10;
+		return -1;
+	}
+
+	static void appendUtf16(string& data, const wchar_t* text, size_t length)
+	{
+		for (size_t i = 0; i < length; ++i)
+		{
+			data += (char)(text[i] & 0xFF);
+			data += (char)((text[i] >> 8) & 0xFF);
+		}
+	}
+
+	// "..." with \\ and \" escapes, may span lines
+	static bool parseQuoted(cursor& c, wstring& out)
+	{
+		out.clear();
+		++c.p;
+		while (c.p < c.end && *c.p != L'"')
+		{
+			if (*c.p == L'\\' && c.p + 1 < c.end) ++c.p;
+			if (*c.p == L'\n') ++c.line;
+			out += *c.p++;
+		}
+		if (c.p >= c.end) return false;
+		++c.p;
+		return true;
+	}
+
+	// comma separated hex bytes, lines ending with a backslash continue on the next line
+	static bool parseHexBytes(cursor& c, string& data)
+	{
+		while (true)
+		{
+			skipBlanks(c);
+			if (c.p < c.end && *c.p == L'\\')
+			{
+				++c.p;
+				skipBlanks(c);
+				if (!atEol(c)) return false;
+				skipLine(c);
+				continue;
+			}
+			if (atEol(c) || *c.p == L';') return true;
+
+			int high = c.p + 1 < c.end ? hexDigit(c.p[0]) : -1;
+			int low = high >= 0 ? hexDigit(c.p[1]) : -1;
+			if (low < 0) return false;
+			data += (char)(high * 16 + low);
+			c.p += 2;
+
+			skipBlanks(c);
+			if (c.p < c.end && *c.p == L',') ++c.p;
+		}
+	}
+
+	static bool parseKeyLine(cursor& c, record& rec, wstring& error)
+	{
+		++c.p;
+		rec.kind = RECORD_KEY;
+		if (c.p < c.end && *c.p == L'-')
+		{
+			rec.kind = RECORD_DELETE_KEY;
+			++c.p;
+		}
+
+		// key names may contain ']', so the last one on the line closes the path
+		const wchar_t* begin = c.p;
+		const wchar_t* close = nullptr;
+		while (!atEol(c))
+		{
+			if (*c.p == L']') close = c.p;
+			++c.p;
+		}
+		if (!close)
+		{
+			error = L"missing ']'";
+			return false;
+		}
+
+		const wchar_t* separator = find(begin, close, L'\\');
+		if (!stringToHive(begin, separator, rec.hive))
+		{
+			error = L"unsupported hive " + wstring(begin, separator);
+			return false;
+		}
+		rec.key.assign(separator < close ? separator + 1 : close, close);
+		return true;
+	}
+
+	// REGEDIT4 writes the strings inside hex(2) and hex(7) in the ansi code page, the registry wants utf-16
+	static void widenAnsi(string& data)
+	{
+		if (data.empty()) return;
+		int size = MultiByteToWideChar(CP_ACP, 0, data.data(), (int)data.size(), nullptr, 0);
+		wstring text(size, L'\0');
+		MultiByteToWideChar(CP_ACP, 0, data.data(), (int)data.size(), &text[0], size);
+		data.clear();
+		appendUtf16(data, text.c_str(), text.length());
+	}
+
+	// 'ansi' for REGEDIT4 files
+	static bool parseValueLine(cursor& c, record& rec, bool ansi, wstring& error)
+	{
+		if (*c.p == L'@')
+		{
+			rec.name.clear();
+			++c.p;
+		}
+		else if (!parseQuoted(c, rec.name))
+		{
+			error = L"unterminated value name";
+			return false;
+		}
+
+		skipBlanks(c);
+		if (c.p >= c.end || *c.p != L'=')
+		{
+			error = L"expected '='";
+			return false;
+		}
+		++c.p;
+		skipBlanks(c);
+
+		rec.kind = RECORD_VALUE;
+		rec.data.clear();
+
+		if (c.p < c.end && *c.p == L'-')
+		{
+			rec.kind = RECORD_DELETE_VALUE;
+			++c.p;
+			return true;
+		}
+
+		if (c.p < c.end && *c.p == L'"')
+		{
+			wstring text;
+			if (!parseQuoted(c, text))
+			{
+				error = L"unterminated string";
+				return false;
+			}
+			rec.type = REG_SZ;
+			appendUtf16(rec.data, text.c_str(), text.length() + 1);
+			return true;
+		}
+
+		if (startsWith(c, L"dword:"))
+		{
+			c.p += 6;
+			unsigned long number = 0;
+			int digits = 0, digit;
+			while (c.p < c.end && (digit = hexDigit(*c.p)) >= 0)
+			{
+				number = number * 16 + digit;
+				++c.p;
+				++digits;
+			}
+			// one to eight digits and nothing after them but a comment
+			skipBlanks(c);
+			if (digits == 0 || digits > 8 || !(atEol(c) || *c.p == L';'))
+			{
+				error = L"invalid dword";
+				return false;
+			}
+			rec.type = REG_DWORD;
+			rec.data.assign((const char*)&number, 4);
+			return true;
+		}
+
+		if (startsWith(c, L"hex"))
+		{
+			c.p += 3;
+			rec.type = REG_BINARY;
+			if (c.p < c.end && *c.p == L'(')
+			{
+				++c.p;
+				rec.type = 0;
+				int digit;
+				while (c.p < c.end && (digit = hexDigit(*c.p)) >= 0)
+				{
+					rec.type = rec.type * 16 + digit;
+					++c.p;
+				}
+				if (c.p >= c.end || *c.p != L')')
+				{
+					error = L"invalid hex type";
+					return false;
+				}
+				++c.p;
+			}
+			if (c.p >= c.end || *c.p != L':')
+			{
+				error = L"expected ':'";
+				return false;
+			}
+			++c.p;
+			if (!parseHexBytes(c, rec.data))
+			{
+				error = L"invalid hex data";
+				return false;
+			}
+			if (ansi && (rec.type == REG_SZ || rec.type == REG_EXPAND_SZ || rec.type == REG_MULTI_SZ)) widenAnsi(rec.data);
+			return true;
+		}
+
+		error = L"unknown value format";
+		return false;
+	}
+
+	int parse(const wstring& file, const function<int(const record&)>& visitor, wstring& error)
+	{
+		wstring text;
+		if (!readText(file, text, error)) return -1;
+		xrprogress::setLength(text.length());
+
+		cursor c = { text.c_str(), text.c_str() + text.length(), 1 };
+		record rec;
+		bool have_header = false, have_key = false, key_deleted = false, ansi = false;
+
+		while (c.p < c.end)
+		{
+			skipBlanks(c);
+			if (atEol(c) || *c.p == L';')
+			{
+				skipLine(c);
+				continue;
+			}
+
+			rec.line = c.line;
+			xrprogress::setOffset(c.p - text.c_str());
+			if (!have_header)
+			{
+				if (!startsWith(c, header5) && !startsWith(c, header4))
+				{
+					error = L"missing regedit header";
+					return -1;
+				}
+				have_header = true;
+				ansi = startsWith(c, header4);
+				skipLine(c);
+				continue;
+			}
+
+			bool ok;
+			if (*c.p == L'[')
+			{
+				ok = parseKeyLine(c, rec, error);
+				have_key = ok;
+				key_deleted = rec.kind == RECORD_DELETE_KEY;
+			}
+			else if (*c.p == L'"' || *c.p == L'@')
+			{
+				ok = have_key && !key_deleted;
+				if (!ok) error = L"value outside of a key";
+				else ok = parseValueLine(c, rec, ansi, error);
+			}
+			else
+			{
+				ok = false;
+				error = L"unexpected character";
+			}
+
+			if (!ok)
+			{
+				error += L" at line " + to_wstring(rec.line);
+				return -1;
+			}
+
+			// value lines leave rec.hive and rec.key untouched, so they always belong to the last [key]
+			int r = visitor(rec);
+			if (r) return r;
+			skipLine(c);
+		}
+
+		if (!have_header)
+		{
+			error = L"missing regedit header";
+			return -1;
+		}
+		return 0;
+	}
+
+	writer::~writer()
+	{
+		if (file) fclose(file);
+	}
+
+	bool writer::open(const wstring& path)
+	{
+		if (_wfopen_s(&file, path.c_str(), L"wb") || !file) return false;
+		buffer.reserve(1 << 16);
+		put(L'\xFEFF');
+		put(header5);
+		newline();
+		return true;
+	}
+
+	void writer::put(const wstring& text)
+	{
+		buffer += text;
+		column += text.length();
+	}
+
+	void writer::put(wchar_t c)
+	{
+		buffer += c;
+		++column;
+	}
+
+	void writer::newline()
+	{
+		buffer += L"\r\n";
+		column = 0;
+		if (buffer.size() >= (1 << 15)) flush();
+	}
+
+	void writer::flush()
+	{
+		if (buffer.size() > 0 && fwrite(buffer.data(), sizeof(wchar_t), buffer.size(), file) != buffer.size())
+			failed = true;
+		buffer.clear();
+	}
+
+	static wstring escape(const wstring& text)
+	{
+		wstring ret;
+		ret.reserve(text.length());
+		for (wchar_t c : text)
+		{
+			if (c == L'\\' || c == L'"') ret += L'\\';
+			ret += c;
+		}
+		return ret;
+	}
+
+	// strings are only written in text form if that form reads back to the exact same bytes
+	static bool isPlainString(const char* data, size_t length)
+	{
+		if (length < 2 || length % 2 || data[length - 1] || data[length - 2]) return false;
+		for (size_t i = 0; i + 2 < length; i += 2)
+		{
+			wchar_t c = (wchar_t)((unsigned char)data[i] | ((unsigned char)data[i + 1] << 8));
+			if (c == 0 || c == L'\r' || c == L'\n') return false;
+		}
+		return true;
+	}
+
+	void writer::key(HKEY hive, const wstring& key)
+	{
+		newline();
+		put(L'[');
+		put(hiveToString(hive));
+		if (key.length() > 0)
+		{
+			put(L'\\');
+			put(key);
+		}
+		put(L']');
+		newline();
+	}
+
+	void writer::value(const wstring& name, DWORD type, const char* data, size_t length)
+	{
+		static const wchar_t* digits = L"0123456789abcdef";
+
+		if (name.length() == 0) put(L'@');
+		else
+		{
+			put(L'"');
+			put(escape(name));
+			put(L'"');
+		}
+		put(L'=');
+
+		if (type == REG_SZ && isPlainString(data, length))
+		{
+			put(L'"');
+			put(escape(wstring((const wchar_t*)data, length / 2 - 1)));
+			put(L'"');
+		}
+		else if (type == REG_DWORD && length == 4)
+		{
+			unsigned long number;
+			memcpy(&number, data, 4);
+			wchar_t text[16];
+			swprintf_s(text, L"dword:%08lx", number);
+			put(text);
+		}
+		else
+		{
+			if (type == REG_BINARY) put(L"hex:");
+			else
+			{
+				wchar_t text[16];
+				swprintf_s(text, L"hex(%lx):", type);
+				put(text);
+			}
+
+			// same layout as regedit: lines are kept under 80 columns
+			for (size_t i = 0; i < length; ++i)
+			{
+				put(digits[((unsigned char)data[i]) >> 4]);
+				put(digits[((unsigned char)data[i]) & 0xF]);
+				if (i + 1 < length)
+				{
+					put(L',');
+					if (column > 76)
+					{
+						put(L'\\');
+						newline();
+						put(L"  ");
+					}
+				}
+			}
+		}
+		newline();
+	}
+
+	bool writer::close()
+	{
+		if (!file) return false;
+		newline();
+		flush();
+		if (fclose(file)) failed = true;
+		file = nullptr;
+		return !failed;
+	}
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdio>
+#include <functional>
+
+#include <windows.h>
+
+// reads and writes regedit files ("Windows Registry Editor Version 5.00" and "REGEDIT4")
+namespace regfile {
+
+	enum recordKind { RECORD_KEY, RECORD_DELETE_KEY, RECORD_VALUE, RECORD_DELETE_VALUE };
+
+	// one [key] line or one value line (including its continuation lines)
+	struct record
+	{
+		recordKind kind = RECORD_KEY;
+		HKEY hive = HKEY_CURRENT_USER;
+		std::wstring key;
+		std::wstring name;
+		DWORD type = REG_NONE;
+		std::string data;		// raw bytes, exactly as stored in the registry
+		size_t line = 0;
+	};
+
+	// true if 'format' is "reg", or if it is empty and 'file' has the .reg extension
+	bool selected(const std::wstring& format, const std::wstring& file);
+
+	std::wstring hiveToString(HKEY hive);
+
+	// calls 'visitor' for every record, in file order
+	// the same record object is reused between calls, so the visitor must copy what it keeps
+	// stops at the first non-zero value returned by 'visitor' and returns it
+	// returns -1 and sets 'error' if the file cannot be read or is malformed
+	int parse(const std::wstring& file, const std::function<int(const record&)>& visitor, std::wstring& error);
+
+	// writes version 5.00 files (utf-16 with bom)
+	class writer
+	{
+		FILE* file = nullptr;
+		std::wstring buffer;
+		size_t column = 0;
+		bool failed = false;
+
+		void put(const std::wstring& text);
+		void put(wchar_t c);
+		void newline();
+		void flush();
+
+	public:
+		~writer();
+		bool open(const std::wstring& path);
+		void key(HKEY hive, const std::wstring& key);
+		void value(const std::wstring& name, DWORD type, const char* data, size_t length);
+		bool close();
+	};
+}
@@ -20,9 +20,14 @@ freely, subject to the following restrictions:
 
 #include "registry.h"
 #include "base64.h"
+#include "stats.h"
+#include "trace.h"
 
+#include <list>
+#include <mutex>
 #include <codecvt>
 #include <algorithm>
+#include <unordered_map>
 
 #include <Shlwapi.h>
 
@@ -40,6 +45,327 @@ inline string utf8_from_wstring(const wstring& str)
 	return converter.to_bytes(str);
 }
 
+// every win32 registry call goes through these, so they can be counted, timed and traced
+
+static LSTATUS rawOpen(HKEY hKey, LPCWSTR subKey, DWORD options, REGSAM sam, PHKEY result)
+{
+	xrtrace::callSpan span(L"RegOpenKeyExW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_OPEN);
+	return RegOpenKeyExW(hKey, subKey, options, sam, result);
+}
+
+static LSTATUS regCreate(HKEY hKey, LPCWSTR subKey, DWORD reserved, LPWSTR className, DWORD options, REGSAM sam,
+	LPSECURITY_ATTRIBUTES security, PHKEY result, LPDWORD disposition)
+{
+	xrtrace::callSpan span(L"RegCreateKeyExW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_OPEN);
+	return RegCreateKeyExW(hKey, subKey, reserved, className, options, sam, security, result, disposition);
+}
+
+static LSTATUS regQuery(HKEY hKey, LPCWSTR name, LPDWORD reserved, LPDWORD type, LPBYTE data, LPDWORD size)
+{
+	xrtrace::callSpan span(L"RegQueryValueExW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_QUERY);
+	LSTATUS status = RegQueryValueExW(hKey, name, reserved, type, data, size);
+	if (status == ERROR_SUCCESS && data && size) xrstats::count(xrstats::BYTES_READ, *size);
+	return status;
+}
+
+static LSTATUS regEnumValue(HKEY hKey, DWORD index, LPWSTR name, LPDWORD nameSize, LPDWORD reserved, LPDWORD type, LPBYTE data, LPDWORD size)
+{
+	xrtrace::callSpan span(L"RegEnumValueW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_ENUM);
+	return RegEnumValueW(hKey, index, name, nameSize, reserved, type, data, size);
+}
+
+static LSTATUS regEnumKey(HKEY hKey, DWORD index, LPWSTR name, LPDWORD nameSize, LPDWORD reserved, LPWSTR className, LPDWORD classSize, PFILETIME lastWrite)
+{
+	xrtrace::callSpan span(L"RegEnumKeyExW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_ENUM);
+	return RegEnumKeyExW(hKey, index, name, nameSize, reserved, className, classSize, lastWrite);
+}
+
+static LSTATUS regQueryInfo(HKEY hKey, LPDWORD subKeys, LPDWORD values)
+{
+	xrtrace::callSpan span(L"RegQueryInfoKeyW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_QUERY);
+	return RegQueryInfoKeyW(hKey, NULL, NULL, NULL, subKeys, NULL, NULL, values, NULL, NULL, NULL, NULL);
+}
+
+static LSTATUS regSet(HKEY hKey, LPCWSTR name, DWORD reserved, DWORD type, const BYTE* data, DWORD size)
+{
+	xrtrace::callSpan span(L"RegSetValueExW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_SET);
+	xrstats::count(xrstats::BYTES_WRITTEN, size);
+	return RegSetValueExW(hKey, name, reserved, type, data, size);
+}
+
+static LSTATUS regDeleteValue(HKEY hKey, LPCWSTR name)
+{
+	xrtrace::callSpan span(L"RegDeleteValueW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_DELETE);
+	return RegDeleteValueW(hKey, name);
+}
+
+static LSTATUS regDeleteKey(HKEY hKey, LPCWSTR subKey)
+{
+	xrtrace::callSpan span(L"RegDeleteKeyW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_DELETE);
+	return RegDeleteKeyW(hKey, subKey);
+}
+
+static LSTATUS regDeleteTree(HKEY hKey, LPCWSTR subKey)
+{
+	xrtrace::callSpan span(L"SHDeleteKeyW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_DELETE);
+	return SHDeleteKeyW(hKey, subKey);
+}
+
+static LSTATUS regFlush(HKEY hKey)
+{
+	xrtrace::callSpan span(L"RegFlushKey");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	return RegFlushKey(hKey);
+}
+
+static LSTATUS regCopyTree(HKEY src, LPCWSTR subKey, HKEY dst)
+{
+	xrtrace::callSpan span(L"RegCopyTreeW");
+	xrstats::timer t(xrstats::PHASE_REGISTRY);
+	xrstats::count(xrstats::REG_SET);
+	return RegCopyTreeW(src, subKey, dst);
+}
+
+// bounded lru cache of open keys under the predefined hives, shared by every thread
+//
+// the same key is opened once per (hive, access, path) and reused until it is evicted; a missing key
+// is opened relative to its deepest cached ancestor, so the kernel only resolves the remaining components
+// only read access is cached, and a hit is checked with the kernel first: another process may have deleted
+// the key since, its handle then fails with ERROR_KEY_DELETED and is opened again
+namespace {
+
+	struct cachedKey
+	{
+		wstring id;
+		HKEY hive;
+		REGSAM sam;
+		wstring path;
+		HKEY handle;
+		unsigned refs;
+	};
+
+	class keyCache
+	{
+		static const size_t capacity = 256;
+
+		mutex lock;
+		// most recently used first, entries dropped while in use wait in 'retired' until released
+		list<cachedKey> entries, retired;
+		unordered_map<wstring, list<cachedKey>::iterator> by_id;
+		unordered_map<HKEY, list<cachedKey>::iterator> by_handle;
+
+		static wstring makeId(HKEY hive, REGSAM sam, const wstring& path)
+		{
+			return to_wstring((unsigned long long)(ULONG_PTR)hive) + L":" + to_wstring(sam) + L":" + path;
+		}
+
+		// the entry is no longer found, its handle is closed now or when its last user releases it
+		void drop(list<cachedKey>::iterator it)
+		{
+			by_id.erase(it->id);
+			if (it->refs > 0)
+			{
+				retired.splice(retired.end(), entries, it);
+				return;
+			}
+			by_handle.erase(it->handle);
+			RegCloseKey(it->handle);
+			entries.erase(it);
+		}
+
+		void evict()
+		{
+			auto it = entries.end();
+			while (entries.size() > capacity && it != entries.begin())
+			{
+				--it;
+				if (it->refs > 0) continue;
+				auto victim = it++;
+				drop(victim);
+			}
+		}
+
+	public:
+		static bool cacheable(HKEY hive, REGSAM sam)
+		{
+			if (sam & (KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK | DELETE | WRITE_DAC | WRITE_OWNER)) return false;
+			return hive == HKEY_CLASSES_ROOT || hive == HKEY_CURRENT_USER || hive == HKEY_LOCAL_MACHINE
+				|| hive == HKEY_USERS || hive == HKEY_CURRENT_CONFIG;
+		}
+
+		// paths are case insensitive and may come with stray separators
+		static wstring normalize(const wstring& key)
+		{
+			size_t first = key.find_first_not_of(L'\\');
+			if (first == wstring::npos) return L"";
+			wstring path = key.substr(first, key.find_last_not_of(L'\\') - first + 1);
+			transform(path.begin(), path.end(), path.begin(), ::towlower);
+			return path;
+		}
+
+		LSTATUS open(HKEY hive, const wstring& key, REGSAM sam, HKEY& result)
+		{
+			wstring path = normalize(key);
+			wstring id = makeId(hive, sam, path);
+
+			HKEY parent, handle = NULL;
+			LSTATUS status;
+			// runs again for every stale handle that is found, each one is forgotten first
+			while (true)
+			{
+				parent = hive;
+				wstring relative = path;
+				bool hit = false;
+				{
+					lock_guard<mutex> guard(lock);
+					auto found = by_id.find(id);
+					if (found != by_id.end())
+					{
+						found->second->refs++;
+						entries.splice(entries.begin(), entries, found->second);
+						result = found->second->handle;
+						hit = true;
+					}
+					else for (size_t pos = path.find_last_of(L'\\'); pos != wstring::npos && pos > 0; pos = path.find_last_of(L'\\', pos - 1))
+					{
+						auto ancestor = by_id.find(makeId(hive, sam, path.substr(0, pos)));
+						if (ancestor == by_id.end()) continue;
+						ancestor->second->refs++;
+						parent = ancestor->second->handle;
+						relative = path.substr(pos + 1);
+						break;
+					}
+				}
+
+				if (hit)
+				{
+					if (regQueryInfo(result, NULL, NULL) != ERROR_KEY_DELETED)
+					{
+						xrstats::count(xrstats::KEY_CACHE_HIT);
+						return ERROR_SUCCESS;
+					}
+					forget(result);
+					release(result);
+					continue;
+				}
+
+				status = rawOpen(parent, relative.c_str(), 0, sam, &handle);
+				if (parent == hive) break;
+				if (status == ERROR_KEY_DELETED) forget(parent);
+				release(parent);
+				if (status != ERROR_KEY_DELETED) break;
+			}
+			xrstats::count(xrstats::KEY_CACHE_MISS);
+			if (status != ERROR_SUCCESS) return status;
+
+			lock_guard<mutex> guard(lock);
+			auto found = by_id.find(id);
+			if (found != by_id.end())
+			{
+				// another thread opened it meanwhile
+				RegCloseKey(handle);
+				found->second->refs++;
+				result = found->second->handle;
+				return ERROR_SUCCESS;
+			}
+
+			entries.push_front(cachedKey{ id, hive, sam, path, handle, 1 });
+			by_id[id] = entries.begin();
+			by_handle[handle] = entries.begin();
+			evict();
+			result = handle;
+			return ERROR_SUCCESS;
+		}
+
+		void release(HKEY handle)
+		{
+			lock_guard<mutex> guard(lock);
+			auto found = by_handle.find(handle);
+			if (found == by_handle.end())
+			{
+				RegCloseKey(handle);
+				return;
+			}
+
+			auto it = found->second;
+			if (--it->refs > 0) return;
+			auto current = by_id.find(it->id);
+			if (current == by_id.end() || current->second != it)
+			{
+				by_handle.erase(found);
+				RegCloseKey(handle);
+				retired.erase(it);
+			}
+			else evict();
+		}
+
+		// 'handle' was deleted behind our back, the next open of its key goes to the kernel again
+		void forget(HKEY handle)
+		{
+			lock_guard<mutex> guard(lock);
+			auto found = by_handle.find(handle);
+			if (found == by_handle.end()) return;
+			auto current = by_id.find(found->second->id);
+			if (current != by_id.end() && current->second == found->second) drop(found->second);
+		}
+
+		// drops 'key' and everything below it, and everything under a hive that can alias it
+		void invalidate(HKEY hive, const wstring& key)
+		{
+			wstring path = normalize(key);
+			lock_guard<mutex> guard(lock);
+			for (auto it = entries.begin(); it != entries.end();)
+			{
+				auto current = it++;
+				bool below = current->path.compare(0, path.length(), path) == 0
+					&& (path.empty() || current->path.length() == path.length() || current->path[path.length()] == L'\\');
+				if (current->hive == hive ? below : winreg::hivesOverlap(current->hive, hive)) drop(current);
+			}
+		}
+
+		// predefined hives were remapped, nothing cached points to the right place anymore
+		void clear()
+		{
+			lock_guard<mutex> guard(lock);
+			while (!entries.empty()) drop(entries.begin());
+		}
+	};
+
+	keyCache cache;
+}
+
+static LSTATUS regOpen(HKEY hKey, LPCWSTR subKey, DWORD options, REGSAM sam, PHKEY result)
+{
+	if (options || !keyCache::cacheable(hKey, sam)) return rawOpen(hKey, subKey, options, sam, result);
+	return cache.open(hKey, subKey ? subKey : L"", sam, *result);
+}
+
+// handles returned by regOpen must be released with this, never with RegCloseKey
+static void regClose(HKEY hKey)
+{
+	cache.release(hKey);
+}
+
 namespace winreg {
 
 	HKEY splitHiveFromKey(string path, string& key)
@@ -75,6 +401,16 @@ namespace winreg {
 		return ret;
 	}
 
+	bool hivesOverlap(HKEY a, HKEY b)
+	{
+		if (a == b) return true;
+		// HKCR is a merged view of HKLM and HKCU classes, and HKCU lives inside HKU
+		if (a == HKEY_CLASSES_ROOT || b == HKEY_CLASSES_ROOT)
+			return a == HKEY_LOCAL_MACHINE || b == HKEY_LOCAL_MACHINE || a == HKEY_CURRENT_USER || b == HKEY_CURRENT_USER;
+		if ((a == HKEY_CURRENT_USER && b == HKEY_USERS) || (a == HKEY_USERS && b == HKEY_CURRENT_USER)) return true;
+		return false;
+	}
+
 	bool keyExists(HKEY hive, string key, REGSAM redirection)
 	{
 		return keyExists(hive, wstring_from_utf8(key), redirection);
@@ -82,8 +418,8 @@ namespace winreg {
 	bool keyExists(HKEY hive, wstring key, REGSAM redirection)
 	{
 		HKEY hKey = NULL;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) != ERROR_SUCCESS) return false;
-		RegCloseKey(hKey);
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) != ERROR_SUCCESS) return false;
+		regClose(hKey);
 		return true;
 	}
 	bool createKey(HKEY hive, string key, REGSAM redirection)
@@ -93,8 +429,8 @@ namespace winreg {
 	bool createKey(HKEY hive, wstring key, REGSAM redirection)
 	{
 		HKEY hKey;
-		bool b = RegCreateKeyExW(hive, key.c_str(), NULL, NULL, REG_OPTION_NON_VOLATILE, KEY_CREATE_SUB_KEY | redirection, NULL, &hKey, NULL) == ERROR_SUCCESS;
-		RegCloseKey(hKey);
+		bool b = regCreate(hive, key.c_str(), NULL, NULL, REG_OPTION_NON_VOLATILE, KEY_CREATE_SUB_KEY | redirection, NULL, &hKey, NULL) == ERROR_SUCCESS;
+		if (b) RegCloseKey(hKey);
 		return b;
 	}
 
@@ -108,13 +444,13 @@ namespace winreg {
 		DWORD type, nsize = 0;
 		bool ret = true;
 
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_QUERY_VALUE | redirection, &hKey) != ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_QUERY_VALUE | redirection, &hKey) != ERROR_SUCCESS)
 			return false;
 
-		if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, NULL, &nsize) == ERROR_FILE_NOT_FOUND)
+		if (regQuery(hKey, property.c_str(), NULL, &type, NULL, &nsize) == ERROR_FILE_NOT_FOUND)
 			ret = false;
 
-		RegCloseKey(hKey);
+		regClose(hKey);
 		return ret;
 	}
 
@@ -126,10 +462,11 @@ namespace winreg {
 	{
 		HKEY hKey;
 		DWORD type;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, NULL, NULL) == ERROR_SUCCESS)
-				return type;
+			LSTATUS status = regQuery(hKey, property.c_str(), NULL, &type, NULL, NULL);
+			regClose(hKey);
+			if (status == ERROR_SUCCESS) return type;
 		}
 		return REG_NONE;
 	}
@@ -145,7 +482,7 @@ namespace winreg {
 	{
 		vector<wstring> ret;
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_QUERY_VALUE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_QUERY_VALUE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const unsigned long sz = 32767;
 			unsigned long size = sz;
@@ -154,12 +491,12 @@ namespace winreg {
 			while (loop != ERROR_NO_MORE_ITEMS)
 			{
 				size = sz;
-				loop = RegEnumValueW(hKey, i++, buffer, &size, NULL, NULL, NULL, NULL);
+				loop = regEnumValue(hKey, i++, buffer, &size, NULL, NULL, NULL, NULL);
 				if (loop == ERROR_SUCCESS) ret.push_back(buffer);
 			}
 
 			delete[] buffer;
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return ret;
 	}
@@ -177,7 +514,7 @@ namespace winreg {
 		vector<wstring> ret;
 
 		const unsigned int keyBufferSize = 256;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_ENUMERATE_SUB_KEYS | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_ENUMERATE_SUB_KEYS | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			unsigned int i = 0;
 			unsigned long loop = 0;
@@ -185,10 +522,10 @@ namespace winreg {
 			{
 				wchar_t keyName[keyBufferSize] = { 0 };
 				DWORD buffSize = keyBufferSize;
-				loop = RegEnumKeyExW(hKey, i++, keyName, &buffSize, NULL, NULL, NULL, NULL);
+				loop = regEnumKey(hKey, i++, keyName, &buffSize, NULL, NULL, NULL, NULL);
 				if (keyName[0] != L'\0') ret.push_back(keyName);
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 
 		return ret;
@@ -201,11 +538,37 @@ namespace winreg {
 	bool deleteProperty(HKEY hive, wstring key, wstring property, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), NULL, KEY_ALL_ACCESS | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), NULL, KEY_ALL_ACCESS | redirection, &hKey) == ERROR_SUCCESS)
 		{
-			RegDeleteValueW(hKey, property.c_str());
-			RegCloseKey(hKey);
-			return true;
+			// a value that is already gone counts as deleted
+			LSTATUS status = regDeleteValue(hKey, property.c_str());
+			regClose(hKey);
+			return status == ERROR_SUCCESS || status == ERROR_FILE_NOT_FOUND;
+		}
+		return false;
+	}
+
+	bool deleteProperties(HKEY hive, string key, const vector<string>& properties, REGSAM redirection)
+	{
+		vector<wstring> wproperties;
+		for (auto it = properties.begin(); it != properties.end(); ++it) wproperties.push_back(wstring_from_utf8(*it));
+		return deleteProperties(hive, wstring_from_utf8(key), wproperties, redirection);
+	}
+	bool deleteProperties(HKEY hive, wstring key, const vector<wstring>& properties, REGSAM redirection, vector<wstring>* failed)
+	{
+		HKEY hKey;
+		if (regOpen(hive, key.c_str(), NULL, KEY_SET_VALUE | redirection, &hKey) == ERROR_SUCCESS)
+		{
+			bool ret = true;
+			for (auto it = properties.begin(); it != properties.end(); ++it)
+			{
+				LSTATUS status = regDeleteValue(hKey, it->c_str());
+				if (status == ERROR_SUCCESS || status == ERROR_FILE_NOT_FOUND) continue;
+				ret = false;
+				if (failed) failed->push_back(*it);
+			}
+			regClose(hKey);
+			return ret;
 		}
 		return false;
 	}
@@ -228,16 +591,43 @@ namespace winreg {
 		bool ret = false;
 		if (!key.empty() && key[key.length() - 1] != L'\\') key += L"\\";
 		if (!keyExists(hive, key + subkey, redirection)) return true;
-		if (RegOpenKeyExW(hive, key.c_str(), NULL, KEY_ALL_ACCESS | redirection, &hKey) == ERROR_SUCCESS)
+		cache.invalidate(hive, key + subkey);
+		if (regOpen(hive, key.c_str(), NULL, KEY_ALL_ACCESS | redirection, &hKey) == ERROR_SUCCESS)
 		{
-			if (recurse) ret = SHDeleteKeyW(hKey, subkey.c_str()) == ERROR_SUCCESS ? true : false;
-			else ret = RegDeleteKeyW(hKey, subkey.c_str()) == ERROR_SUCCESS ? true : false;
-			RegCloseKey(hKey);
+			if (recurse) ret = regDeleteTree(hKey, subkey.c_str()) == ERROR_SUCCESS ? true : false;
+			else ret = regDeleteKey(hKey, subkey.c_str()) == ERROR_SUCCESS ? true : false;
+			regClose(hKey);
 		}
 
 		return ret;
 	}
 
+	bool deleteTree(HKEY hive, string key, REGSAM redirection)
+	{
+		return deleteTree(hive, wstring_from_utf8(key), redirection);
+	}
+	bool deleteTree(HKEY hive, wstring key, REGSAM redirection)
+	{
+		HKEY hKey;
+		bool ret = false;
+		wstring parent, subkey = key;
+		size_t pos = key.find_last_of(L'\\');
+		if (pos != wstring::npos)
+		{
+			parent = key.substr(0, pos);
+			subkey = key.substr(pos + 1);
+		}
+		if (subkey.empty()) return false;
+		cache.invalidate(hive, key);
+		if (regOpen(hive, parent.c_str(), NULL, KEY_ALL_ACCESS | redirection, &hKey) == ERROR_SUCCESS)
+		{
+			LSTATUS status = regDeleteTree(hKey, subkey.c_str());
+			ret = status == ERROR_SUCCESS || status == ERROR_FILE_NOT_FOUND;
+			regClose(hKey);
+		}
+		return ret;
+	}
+
 	bool copyKey(HKEY srcHive, wstring srcKey, HKEY dstHive, wstring dstKey, REGSAM srcRedirection, REGSAM dstRedirection)
 	{
 		HKEY hSKey, hDKey;
@@ -252,17 +642,17 @@ namespace winreg {
 			ret = func(hSKey, L"", hDKey) == ERROR_SUCCESS;
 		*/
 
-		if (RegOpenKeyExW(srcHive, srcKey.c_str(), 0, KEY_READ | srcRedirection, &hSKey) == ERROR_SUCCESS)
+		if (regOpen(srcHive, srcKey.c_str(), 0, KEY_READ | srcRedirection, &hSKey) == ERROR_SUCCESS)
 		{
 			if (!keyExists(dstHive, dstKey, dstRedirection))
 				dstCreated = createKey(dstHive, dstKey, dstRedirection);
 
-			if (RegOpenKeyExW(dstHive, dstKey.c_str(), 0, KEY_ALL_ACCESS | dstRedirection, &hDKey) == ERROR_SUCCESS)
+			if (regOpen(dstHive, dstKey.c_str(), 0, KEY_ALL_ACCESS | dstRedirection, &hDKey) == ERROR_SUCCESS)
 			{
-				ret = RegCopyTreeW(hSKey, L"", hDKey) == ERROR_SUCCESS;
-				RegCloseKey(hDKey);
+				ret = regCopyTree(hSKey, L"", hDKey) == ERROR_SUCCESS;
+				regClose(hDKey);
 			}
-			RegCloseKey(hSKey);
+			regClose(hSKey);
 		}
 
 		if (!ret && dstCreated && keyExists(dstHive, dstKey, dstRedirection))
@@ -280,14 +670,14 @@ namespace winreg {
 	{
 		wstring ret = L"";
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			DWORD type;
 			DWORD nsize = 0;
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, NULL, &nsize) == ERROR_SUCCESS && (type == REG_SZ || type == REG_EXPAND_SZ))
+			if (regQuery(hKey, property.c_str(), NULL, &type, NULL, &nsize) == ERROR_SUCCESS && (type == REG_SZ || type == REG_EXPAND_SZ))
 			{
 				BYTE* buffer = new BYTE[nsize];
-				if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && (type == REG_SZ || type == REG_EXPAND_SZ))
+				if (regQuery(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && (type == REG_SZ || type == REG_EXPAND_SZ))
 				{
 					for (DWORD i = 0; i < nsize; i += 2)
 					{
@@ -296,11 +686,11 @@ namespace winreg {
 						ret += c;
 					}
 				}
-				RegCloseKey(hKey);
+				regClose(hKey);
 				delete[] buffer;
 				return ret;
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return default_value;
 	}
@@ -311,7 +701,7 @@ namespace winreg {
 	bool setString(HKEY hive, wstring key, wstring property, wstring value, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const size_t size = value.length() * 2 + 2;
 			BYTE* buffer = new BYTE[size];
@@ -322,9 +712,9 @@ namespace winreg {
 			}
 			buffer[size - 2] = 0;
 			buffer[size - 1] = 0;
-			RegSetValueExW(hKey, property.c_str(), NULL, REG_SZ, buffer, (DWORD)size);
+			regSet(hKey, property.c_str(), NULL, REG_SZ, buffer, (DWORD)size);
 			delete[] buffer;
-			RegCloseKey(hKey);
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -355,7 +745,7 @@ namespace winreg {
 	bool setExpandString(HKEY hive, wstring key, wstring property, wstring value, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const size_t size = value.length() * 2 + 2;
 			BYTE* buffer = new BYTE[size];
@@ -366,9 +756,9 @@ namespace winreg {
 			}
 			buffer[size - 2] = 0;
 			buffer[size - 1] = 0;
-			RegSetValueExW(hKey, property.c_str(), NULL, REG_EXPAND_SZ, buffer, (DWORD)size);
+			regSet(hKey, property.c_str(), NULL, REG_EXPAND_SZ, buffer, (DWORD)size);
 			delete[] buffer;
-			RegCloseKey(hKey);
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -385,14 +775,14 @@ namespace winreg {
 	bool getMultiString(HKEY hive, wstring key, wstring property, vector<wstring>& value, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			DWORD buffersize = 1;
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, NULL, NULL, &buffersize) == ERROR_SUCCESS && buffersize > 1)
+			if (regQuery(hKey, property.c_str(), NULL, NULL, NULL, &buffersize) == ERROR_SUCCESS && buffersize > 1)
 			{
 				DWORD type;
 				BYTE* buffer = new BYTE[buffersize];
-				if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, buffer, &buffersize) == ERROR_SUCCESS && type == REG_MULTI_SZ)
+				if (regQuery(hKey, property.c_str(), NULL, &type, buffer, &buffersize) == ERROR_SUCCESS && type == REG_MULTI_SZ)
 				{
 					BYTE* pb = buffer;
 					while (pb < buffer + buffersize)
@@ -410,10 +800,10 @@ namespace winreg {
 					}
 				}
 				delete[] buffer;
-				RegCloseKey(hKey);
+				regClose(hKey);
 				return true;
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return false;
 	}
@@ -428,7 +818,7 @@ namespace winreg {
 		HKEY hKey;
 		bool ret = false;
 		
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			size_t trueSize = 2;
 			size_t buffersize = 0;
@@ -459,10 +849,10 @@ namespace winreg {
 				}
 			}
 
-			if (RegSetValueExW(hKey, property.c_str(), NULL, REG_MULTI_SZ, (BYTE*)buffer, (DWORD)trueSize) == ERROR_SUCCESS)
+			if (regSet(hKey, property.c_str(), NULL, REG_MULTI_SZ, (BYTE*)buffer, (DWORD)trueSize) == ERROR_SUCCESS)
 				ret = true;
 
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return ret;
 	}
@@ -478,19 +868,19 @@ namespace winreg {
 	{
 		long ret = 0;
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const int size = sizeof(DWORD);
 			DWORD nsize = size;
 			BYTE buffer[size];
 			DWORD type;
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && type == REG_DWORD)
+			if (regQuery(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && type == REG_DWORD)
 			{
 				memcpy(&ret, buffer, size);
-				RegCloseKey(hKey);
+				regClose(hKey);
 				return ret;
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return default_value;
 	}
@@ -501,11 +891,11 @@ namespace winreg {
 	bool setDword(HKEY hive, wstring key, wstring property, long number, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			DWORD val = number;
-			RegSetValueExW(hKey, property.c_str(), NULL, REG_DWORD, (BYTE*)&val, sizeof(DWORD));
-			RegCloseKey(hKey);
+			regSet(hKey, property.c_str(), NULL, REG_DWORD, (BYTE*)&val, sizeof(DWORD));
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -522,20 +912,20 @@ namespace winreg {
 	{
 		long ret = 0;
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const int size = sizeof(DWORD);
 			DWORD nsize = size;
 			BYTE buffer[size], invertedbuffer[size];
 			DWORD type;
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && type == REG_DWORD_BIG_ENDIAN)
+			if (regQuery(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && type == REG_DWORD_BIG_ENDIAN)
 			{
 				for (int i = 0; i < size; ++i) invertedbuffer[i] = buffer[size - i - 1];
 				memcpy(&ret, invertedbuffer, size);
-				RegCloseKey(hKey);
+				regClose(hKey);
 				return ret;
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return default_value;
 	}
@@ -546,17 +936,17 @@ namespace winreg {
 	bool setDwordBE(HKEY hive, wstring key, wstring property, long number, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const int size = sizeof(DWORD);
 			unsigned char* bytes = new unsigned char[size];
 			unsigned char* invertedbytes = new unsigned char[size];
 			memcpy(bytes, &number, size);
 			for (int i = 0; i < size; ++i) invertedbytes[i] = bytes[size - i - 1];
-			RegSetValueExW(hKey, property.c_str(), NULL, REG_DWORD_BIG_ENDIAN, (BYTE*)invertedbytes, size);
+			regSet(hKey, property.c_str(), NULL, REG_DWORD_BIG_ENDIAN, (BYTE*)invertedbytes, size);
 			delete[] bytes;
 			delete[] invertedbytes;
-			RegCloseKey(hKey);
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -574,19 +964,19 @@ namespace winreg {
 	{
 		long long ret = 0;
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			const int size = sizeof(long long);
 			DWORD nsize = size;
 			BYTE buffer[size];
 			DWORD type;
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && type == REG_QWORD)
+			if (regQuery(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && type == REG_QWORD)
 			{
 				memcpy(&ret, buffer, size);
-				RegCloseKey(hKey);
+				regClose(hKey);
 				return ret;
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return default_value;
 	}
@@ -597,11 +987,11 @@ namespace winreg {
 	bool setQword(HKEY hive, wstring key, wstring property, long long number, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			long long val = number;
-			RegSetValueExW(hKey, property.c_str(), NULL, REG_QWORD, (BYTE*)&val, sizeof(long long));
-			RegCloseKey(hKey);
+			regSet(hKey, property.c_str(), NULL, REG_QWORD, (BYTE*)&val, sizeof(long long));
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -614,25 +1004,25 @@ namespace winreg {
 	bool getBinary(HKEY hive, wstring key, wstring property, char*& data, size_t& datalen, REGSAM redirection)
 	{
 		HKEY hKey = NULL;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			DWORD type;
 			DWORD nsize = 0;
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, NULL, &nsize) == ERROR_SUCCESS && (type == REG_BINARY))
+			if (regQuery(hKey, property.c_str(), NULL, &type, NULL, &nsize) == ERROR_SUCCESS && (type == REG_BINARY))
 			{
 				BYTE* buffer = new BYTE[nsize];
-				if (RegQueryValueExW(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && (type == REG_BINARY))
+				if (regQuery(hKey, property.c_str(), NULL, &type, buffer, &nsize) == ERROR_SUCCESS && (type == REG_BINARY))
 				{
 					data = new char[nsize];
 					memcpy(data, buffer, nsize);
 					delete[] buffer;
 					datalen = nsize;
-					RegCloseKey(hKey);
+					regClose(hKey);
 					return true;
 				}
 				delete[] buffer;
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return false;
 	}
@@ -643,7 +1033,7 @@ namespace winreg {
 	bool getBinary(HKEY hive, string key, string property, string& result, REGSAM redirection)
 	{
 		size_t len;
-		char* buffer;
+		char* buffer = nullptr;
 		bool ret = getBinary(hive, wstring_from_utf8(key), wstring_from_utf8(property), buffer, len, redirection);
 		if (ret) result = string(buffer, len);
 		delete[] buffer;
@@ -652,7 +1042,7 @@ namespace winreg {
 	bool getBinary(HKEY hive, wstring key, wstring property, string& result, REGSAM redirection)
 	{
 		size_t len;
-		char* buffer;
+		char* buffer = nullptr;
 		bool ret = getBinary(hive, key, property, buffer, len, redirection);
 		if (ret) result = string(buffer, len);
 		delete[] buffer;
@@ -682,10 +1072,10 @@ namespace winreg {
 	bool setBinary(HKEY hive, wstring key, wstring property, const char* const data, size_t datalen, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
-			RegSetValueExW(hKey, property.c_str(), NULL, REG_BINARY, (BYTE*)data, (DWORD)datalen);
-			RegCloseKey(hKey);
+			regSet(hKey, property.c_str(), NULL, REG_BINARY, (BYTE*)data, (DWORD)datalen);
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -708,12 +1098,12 @@ namespace winreg {
 	bool getAsByteArray(HKEY hive, wstring key, wstring property, char*& data, size_t& datalen, unsigned long& type, REGSAM redirection)
 	{
 		HKEY hKey = NULL;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_READ | redirection, &hKey) == ERROR_SUCCESS)
 		{
 			DWORD dwType;
 			DWORD nsize = 0;
 
-			if (RegQueryValueExW(hKey, property.c_str(), NULL, &dwType, NULL, &nsize) == ERROR_SUCCESS)
+			if (regQuery(hKey, property.c_str(), NULL, &dwType, NULL, &nsize) == ERROR_SUCCESS)
 			{
 				/*
 				bool isExoticRegType = dwType == REG_NONE ||
@@ -727,20 +1117,20 @@ namespace winreg {
 				//{
 				type = dwType;
 				BYTE* buffer = new BYTE[nsize];
-				if (RegQueryValueExW(hKey, property.c_str(), NULL, &dwType, buffer, &nsize) == ERROR_SUCCESS)
+				if (regQuery(hKey, property.c_str(), NULL, &dwType, buffer, &nsize) == ERROR_SUCCESS)
 				{
 					type = dwType;
 					data = new char[nsize];
 					memcpy(data, buffer, nsize);
 					delete[] buffer;
 					datalen = nsize;
-					RegCloseKey(hKey);
+					regClose(hKey);
 					return true;
 				}
 				delete[] buffer;
 				//}
 			}
-			RegCloseKey(hKey);
+			regClose(hKey);
 		}
 		return false;
 	}
@@ -751,7 +1141,7 @@ namespace winreg {
 	bool getAsByteArray(HKEY hive, string key, string property, string& result, unsigned long& type, REGSAM redirection)
 	{
 		size_t len;
-		char* buffer;
+		char* buffer = nullptr;
 		bool ret = getAsByteArray(hive, wstring_from_utf8(key), wstring_from_utf8(property), buffer, len, type, redirection);
 		if (ret) result = string(buffer, len);
 		delete[] buffer;
@@ -760,7 +1150,7 @@ namespace winreg {
 	bool getAsByteArray(HKEY hive, wstring key, wstring property, string& result, unsigned long& type, REGSAM redirection)
 	{
 		size_t len;
-		char* buffer;
+		char* buffer = nullptr;
 		bool ret = getAsByteArray(hive, key, property, buffer, len, type, redirection);
 		if (ret) result = string(buffer, len);
 		delete[] buffer;
@@ -786,10 +1176,10 @@ namespace winreg {
 	bool setByteArray(HKEY hive, wstring key, wstring property, const char* const data, size_t datalen, unsigned long type, REGSAM redirection)
 	{
 		HKEY hKey;
-		if (RegOpenKeyExW(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
+		if (regOpen(hive, key.c_str(), 0, KEY_WRITE | redirection, &hKey) == ERROR_SUCCESS)
 		{
-			RegSetValueExW(hKey, property.c_str(), NULL, type, (BYTE*)data, (DWORD)datalen);
-			RegCloseKey(hKey);
+			regSet(hKey, property.c_str(), NULL, type, (BYTE*)data, (DWORD)datalen);
+			regClose(hKey);
 			return true;
 		}
 		return false;
@@ -812,6 +1202,190 @@ namespace winreg {
 
 
 
+	bool flushHive(HKEY hive)
+	{
+		return regFlush(hive) == ERROR_SUCCESS;
+	}
+
+	// type and bytes of a value through an open key, shared by keyWriter and keyHandle
+	static bool readValue(HKEY hKey, const wstring& property, string& result, unsigned long& type)
+	{
+		DWORD dwType, size = 0;
+		if (regQuery(hKey, property.c_str(), NULL, &dwType, NULL, &size) != ERROR_SUCCESS) return false;
+
+		while (true)
+		{
+			result.resize(size);
+			LSTATUS status = regQuery(hKey, property.c_str(), NULL, &dwType, size ? (BYTE*)&result[0] : NULL, &size);
+			// the value grew since its size was queried
+			if (status == ERROR_MORE_DATA) continue;
+			if (status != ERROR_SUCCESS) return false;
+			result.resize(size);
+			type = dwType;
+			return true;
+		}
+	}
+
+	// bulk writes
+	keyWriter::~keyWriter()
+	{
+		close();
+	}
+	bool keyWriter::open(HKEY hive, const wstring& key, REGSAM redirection)
+	{
+		close();
+		this->redirection = redirection;
+		DWORD disposition = 0;
+		// children are created relative to this handle, RegCreateKeyExW needs KEY_CREATE_SUB_KEY on it for that
+		REGSAM sam = KEY_QUERY_VALUE | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | redirection;
+		if (regCreate(hive, key.c_str(), NULL, NULL, REG_OPTION_NON_VOLATILE, sam, NULL, &hKey, &disposition) == ERROR_SUCCESS)
+		{
+			is_new = disposition == REG_CREATED_NEW_KEY;
+			return true;
+		}
+		hKey = NULL;
+		return false;
+	}
+	bool keyWriter::open(const keyWriter& parent, const wstring& name)
+	{
+		if (!parent.hKey)
+		{
+			close();
+			return false;
+		}
+		return open(parent.hKey, name, parent.redirection);
+	}
+	bool keyWriter::exists(const wstring& property)
+	{
+		DWORD type, nsize = 0;
+		return hKey && regQuery(hKey, property.c_str(), NULL, &type, NULL, &nsize) != ERROR_FILE_NOT_FOUND;
+	}
+	bool keyWriter::read(const wstring& property, string& result, unsigned long& type) const
+	{
+		return hKey && readValue(hKey, property, result, type);
+	}
+	bool keyWriter::write(const valueRecord& value)
+	{
+		return hKey && regSet(hKey, value.name.c_str(), NULL, value.type, (const BYTE*)value.data.data(), (DWORD)value.data.length()) == ERROR_SUCCESS;
+	}
+	bool keyWriter::write(const vector<valueRecord>& values, vector<size_t>& failed)
+	{
+		failed.clear();
+		for (size_t i = 0; i < values.size(); ++i)
+			if (!write(values[i])) failed.push_back(i);
+		return failed.empty();
+	}
+	bool keyWriter::flush()
+	{
+		return hKey && regFlush(hKey) == ERROR_SUCCESS;
+	}
+	void keyWriter::close()
+	{
+		if (hKey) RegCloseKey(hKey);
+		hKey = NULL;
+		is_new = false;
+	}
+
+
+
+
+	// traversals
+	keyHandle::~keyHandle()
+	{
+		close();
+	}
+	bool keyHandle::open(HKEY hive, const wstring& key, REGSAM sam)
+	{
+		close();
+		this->sam = sam;
+		if (regOpen(hive, key.c_str(), 0, sam, &hKey) == ERROR_SUCCESS) return true;
+		hKey = NULL;
+		return false;
+	}
+	bool keyHandle::open(const keyHandle& parent, const wstring& name)
+	{
+		if (!parent.hKey)
+		{
+			close();
+			return false;
+		}
+		return open(parent.hKey, name, parent.sam);
+	}
+	void keyHandle::close()
+	{
+		if (hKey) regClose(hKey);
+		hKey = NULL;
+	}
+	vector<wstring> keyHandle::values() const
+	{
+		vector<wstring> ret;
+		values(ret);
+		return ret;
+	}
+	vector<wstring> keyHandle::subkeys() const
+	{
+		vector<wstring> ret;
+		subkeys(ret);
+		return ret;
+	}
+	// overwrites the next name in place, so the strings of 'names' are reused
+	static void assignName(vector<wstring>& names, size_t& count, const wchar_t* name, size_t length)
+	{
+		if (count < names.size()) names[count].assign(name, length);
+		else names.emplace_back(name, length);
+		++count;
+	}
+	void keyHandle::values(vector<wstring>& names) const
+	{
+		size_t count = 0;
+		if (hKey)
+		{
+			// value names are limited to 16383 characters, the buffer is kept off the stack and reused by each thread
+			const unsigned long sz = 16384;
+			static thread_local vector<wchar_t> buffer(sz);
+			unsigned long loop = 0;
+			for (DWORD i = 0; loop != ERROR_NO_MORE_ITEMS; ++i)
+			{
+				unsigned long size = sz;
+				loop = regEnumValue(hKey, i, buffer.data(), &size, NULL, NULL, NULL, NULL);
+				if (loop == ERROR_SUCCESS) assignName(names, count, buffer.data(), size);
+			}
+		}
+		names.resize(count);
+	}
+	void keyHandle::subkeys(vector<wstring>& names) const
+	{
+		size_t count = 0;
+		if (hKey)
+		{
+			const unsigned int keyBufferSize = 256;
+			wchar_t keyName[keyBufferSize];
+			unsigned long loop = 0;
+			for (DWORD i = 0; loop != ERROR_NO_MORE_ITEMS; ++i)
+			{
+				DWORD buffSize = keyBufferSize;
+				loop = regEnumKey(hKey, i, keyName, &buffSize, NULL, NULL, NULL, NULL);
+				if (loop == ERROR_SUCCESS && buffSize > 0) assignName(names, count, keyName, buffSize);
+			}
+		}
+		names.resize(count);
+	}
+	bool keyHandle::read(const wstring& property, string& result, unsigned long& type) const
+	{
+		return hKey && readValue(hKey, property, result, type);
+	}
+
+	bool keyHandle::info(unsigned long& subkeys, unsigned long& values) const
+	{
+		DWORD nsubkeys = 0, nvalues = 0;
+		if (!hKey || regQueryInfo(hKey, &nsubkeys, &nvalues) != ERROR_SUCCESS) return false;
+		subkeys = nsubkeys;
+		values = nvalues;
+		return true;
+	}
+
+
+
 	namespace remap {
 
 		bool start(HKEY sourceHive, HKEY targetHive, const string& targetKey, REGSAM redirection)
@@ -824,17 +1398,20 @@ namespace winreg {
 				createKey(targetHive, targetKey, redirection);
 
 			HKEY hRemappedKey;
-			if (RegOpenKeyExW(targetHive, targetKey.c_str(), 0, KEY_READ | redirection, &hRemappedKey) == ERROR_SUCCESS)
+			if (regOpen(targetHive, targetKey.c_str(), 0, KEY_READ | redirection, &hRemappedKey) == ERROR_SUCCESS)
 			{
 				bool ret = RegOverridePredefKey(sourceHive, hRemappedKey) == ERROR_SUCCESS;
-				RegCloseKey(hRemappedKey);
+				regClose(hRemappedKey);
+				cache.clear();
 				return ret;
 			}
 			return false;
 		}
 		bool stop(HKEY sourceHive)
 		{
-			return RegOverridePredefKey(sourceHive, NULL) == ERROR_SUCCESS;
+			bool ret = RegOverridePredefKey(sourceHive, NULL) == ERROR_SUCCESS;
+			cache.clear();
+			return ret;
 		}
 	}
 }
\ No newline at end of file
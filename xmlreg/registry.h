@@ -34,6 +34,8 @@ namespace winreg {
 
 	HKEY splitHiveFromKey(std::string path, std::string& key);
 	HKEY splitHiveFromKey(std::wstring path, std::wstring& key);
+	/* true if keys under 'a' and 'b' can be the same key (HKCR merges HKLM and HKCU classes, HKCU lives inside HKU) */
+	bool hivesOverlap(HKEY a, HKEY b);
 
 	bool keyExists(HKEY hive, std::string key, REGSAM redirection = 0);
 	bool keyExists(HKEY hive, std::wstring key, REGSAM redirection = 0);
@@ -57,11 +59,18 @@ namespace winreg {
 
 	bool deleteProperty(HKEY hive, std::string key, std::string property, REGSAM redirection = 0);
 	bool deleteProperty(HKEY hive, std::wstring key, std::wstring property, REGSAM redirection = 0);
+	bool deleteProperties(HKEY hive, std::string key, const std::vector<std::string>& properties, REGSAM redirection = 0);
+	// the other values are still deleted when one fails, its name goes to 'failed'; values that do not exist are not failures
+	bool deleteProperties(HKEY hive, std::wstring key, const std::vector<std::wstring>& properties, REGSAM redirection = 0,
+		std::vector<std::wstring>* failed = nullptr);
 
 	bool deleteKey(HKEY hive, std::string key, std::string subkey, bool recurse = false, REGSAM redirection = 0);
 	bool deleteKey(HKEY hive, std::wstring key, std::wstring subkey, bool recurse = false, REGSAM redirection = 0);
 	bool killKey(HKEY hive, std::string key, REGSAM redirection = 0);
 	bool killKey(HKEY hive, std::wstring key, REGSAM redirection = 0);
+	/* like killKey, but does not check if the key exists first (a missing key is not an error) */
+	bool deleteTree(HKEY hive, std::string key, REGSAM redirection = 0);
+	bool deleteTree(HKEY hive, std::wstring key, REGSAM redirection = 0);
 
 	// string
 	std::string getString(HKEY hive, std::string key, std::string property, std::string default_value, REGSAM redirection = 0);
@@ -119,6 +128,74 @@ namespace winreg {
 	bool setByteArrayFromBase64(HKEY hive, std::string key, std::string property, std::string data, unsigned long type, REGSAM redirection = 0);
 	bool setByteArrayFromBase64(HKEY hive, std::wstring key, std::wstring property, std::string data, unsigned long type, REGSAM redirection = 0);
 
+	// bulk writes, the key is opened (or created) once and every value goes through the same handle
+	struct valueRecord
+	{
+		std::wstring name;
+		unsigned long type = REG_NONE;
+		std::string data;
+	};
+
+	class keyWriter
+	{
+		HKEY hKey = NULL;
+		REGSAM redirection = 0;
+		bool is_new = false;
+
+	public:
+		keyWriter() {}
+		keyWriter(const keyWriter&) = delete;
+		keyWriter& operator=(const keyWriter&) = delete;
+		~keyWriter();
+
+		/* creates the key if it does not exist */
+		bool open(HKEY hive, const std::wstring& key, REGSAM redirection = 0);
+		/* creates 'name' below an open parent, without resolving the parent path again */
+		bool open(const keyWriter& parent, const std::wstring& name);
+		/* true if open had to create the key (its parents may have been created too) */
+		bool created() const { return is_new; }
+		bool exists(const std::wstring& property);
+		bool read(const std::wstring& property, std::string& result, unsigned long& type) const;
+		bool write(const valueRecord& value);
+		/* writes every record even if some fail, 'failed' receives the indexes of those that did */
+		bool write(const std::vector<valueRecord>& values, std::vector<size_t>& failed);
+		/* waits until everything written to the hive of the key is on disk (RegFlushKey), slow */
+		bool flush();
+		void close();
+	};
+
+	/* the same for a whole hive, for writes that do not go through a keyWriter */
+	bool flushHive(HKEY hive);
+
+	// an open key for traversals, children are opened relative to it instead of from the hive root
+	class keyHandle
+	{
+		HKEY hKey = NULL;
+		REGSAM sam = 0;
+
+	public:
+		keyHandle() {}
+		keyHandle(const keyHandle&) = delete;
+		keyHandle& operator=(const keyHandle&) = delete;
+		~keyHandle();
+
+		/* 'sam' is the access mask plus redirection, children are opened with the same */
+		bool open(HKEY hive, const std::wstring& key, REGSAM sam);
+		bool open(const keyHandle& parent, const std::wstring& name);
+		bool isOpen() const { return hKey != NULL; }
+		void close();
+
+		/* names of values and subkeys, empty if the key is not open */
+		std::vector<std::wstring> values() const;
+		std::vector<std::wstring> subkeys() const;
+		/* the same into 'names', which keeps its strings and capacity from the previous key */
+		void values(std::vector<std::wstring>& names) const;
+		void subkeys(std::vector<std::wstring>& names) const;
+		bool read(const std::wstring& property, std::string& result, unsigned long& type) const;
+		/* how many subkeys and values the key has, in one call and without enumerating them */
+		bool info(unsigned long& subkeys, unsigned long& values) const;
+	};
+
 	namespace remap {
 		bool start(HKEY sourceHive, HKEY targetHive, const std::string& targetKey, REGSAM redirection);
 		bool start(HKEY sourceHive, HKEY targetHive, const std::wstring& targetKey, REGSAM redirection);
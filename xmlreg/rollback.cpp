@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "xmlreg.h"
+#include "log.h"
+#include "registry.h"
+#include "progress.h"
+#include "undo.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static bool sameKey(const xrundo::change& a, const xrundo::change& b)
+{
+	return a.hive == b.hive && a.redirection == b.redirection && a.key == b.key;
+}
+
+static wstring describeKey(const xrundo::change& c)
+{
+	return L"(" + xrutils::redirectionToString(c.redirection) + L") " + xrutils::hiveToString(c.hive) + L"\\" + c.key;
+}
+
+static void printChange(const xrundo::change& c)
+{
+	switch (c.kind)
+	{
+	case xrundo::CHANGE_VALUE:
+		xrlog::info() << "would restore " << xrutils::propTypeToString(c.type) << " " << c.name << "\n\ton " << describeKey(c);
+		break;
+	case xrundo::CHANGE_ABSENT:
+		xrlog::info() << "would delete value " << c.name << "\n\tfrom " << describeKey(c);
+		break;
+	case xrundo::CHANGE_CREATED:
+		xrlog::info() << "would delete key\n\t" << describeKey(c);
+		break;
+	case xrundo::CHANGE_DELETED:
+		xrlog::info() << "would create key\n\t" << describeKey(c);
+		break;
+	default:
+		break;
+	}
+}
+
+// the newest change is undone first, so every change finds the registry as it was right after it was made
+int rollback_reg(wstring undo_file, bool skip_errors, bool dry_run)
+{
+	xrlog::info() << "rolling back the changes recorded in " << undo_file;
+
+	vector<xrundo::change> changes;
+	wstring error;
+	if (!xrundo::read(undo_file, changes, error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRROLLBACK_READLOG;
+	}
+	xrlog::info() << changes.size() << " change(s) to undo";
+
+	if (dry_run)
+	{
+		for (auto it = changes.rbegin(); it != changes.rend(); ++it) printChange(*it);
+		return 0;
+	}
+
+	xrprogress::display progress(L"rolling back", xrprogress::MEASURE_ITEMS);
+	if (xrprogress::enabled())
+	{
+		xrprogress::addTotal(0, changes.size());
+		xrprogress::totalKnown();
+	}
+
+	// old values of the same key are written back through one open handle
+	winreg::keyWriter writer;
+	const xrundo::change* open = nullptr;
+	winreg::valueRecord value;
+	for (auto it = changes.rbegin(); it != changes.rend(); ++it)
+	{
+		const xrundo::change& c = *it;
+		xrprogress::addValues(1);
+
+		bool ok = true;
+		switch (c.kind)
+		{
+		case xrundo::CHANGE_VALUE:
+			if (!open || !sameKey(*open, c)) open = writer.open(c.hive, c.key, c.redirection) ? &c : nullptr;
+			value.name = c.name;
+			value.type = c.type;
+			value.data = c.data;
+			ok = open && writer.write(value);
+			break;
+
+		case xrundo::CHANGE_ABSENT:
+			ok = winreg::deleteProperty(c.hive, c.key, c.name, c.redirection) || !winreg::propertyExists(c.hive, c.key, c.name, c.redirection);
+			break;
+
+		case xrundo::CHANGE_CREATED:
+			// the handle would keep writing into the deleted key
+			writer.close();
+			open = nullptr;
+			ok = winreg::deleteTree(c.hive, c.key, c.redirection);
+			break;
+
+		case xrundo::CHANGE_DELETED:
+			ok = winreg::createKey(c.hive, c.key, c.redirection);
+			break;
+
+		default:
+			break;
+		}
+
+		if (ok) continue;
+		if (c.kind == xrundo::CHANGE_VALUE) xrlog::error() << "failed to restore value " << c.name << "\n\ton " << describeKey(c);
+		else if (c.kind == xrundo::CHANGE_ABSENT) xrlog::error() << "failed to delete value " << c.name << "\n\tfrom " << describeKey(c);
+		else if (c.kind == xrundo::CHANGE_CREATED) xrlog::error() << "failed to delete key\n\t" << describeKey(c);
+		else xrlog::error() << "failed to create key\n\t" << describeKey(c);
+		if (!skip_errors) return ERROR_XRROLLBACK_RESTORE;
+	}
+	return 0;
+}
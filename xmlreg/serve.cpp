@@ -0,0 +1,364 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "xmlreg.h"
+#include "log.h"
+#include "batch.h"
+
+#include <pugixml.hpp>
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <windows.h>
+#include <sddl.h>
+
+using namespace std;
+
+struct serveRequest
+{
+	batchJob job;
+	HANDLE pipe = INVALID_HANDLE_VALUE;
+	chrono::steady_clock::time_point queued;
+};
+
+struct serveMetrics
+{
+	unsigned long long requests = 0;
+	unsigned long long failed = 0;
+	size_t queue_depth = 0;
+	size_t max_queue_depth = 0;
+	double total_wait_ms = 0;
+	double total_run_ms = 0;
+	double max_run_ms = 0;
+};
+
+struct serveState
+{
+	deque<serveRequest> queue;
+	serveMetrics metrics;
+	jobContext context;
+	mutex lock;
+	condition_variable wakeup;
+	bool stopping = false;
+	// set by <stop>, cancels the pending connect and the reads of clients that did not send their request yet
+	HANDLE stop = NULL;
+	// connections still reading their request, each on its own thread, at most 'max_connections' at once
+	static const size_t max_connections = 16;
+	size_t connections = 0;
+	condition_variable idle;
+};
+
+struct stringWriter : pugi::xml_writer
+{
+	string data;
+	void write(const void* bytes, size_t size) override
+	{
+		data.append((const char*)bytes, size);
+	}
+};
+
+static double millisecondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// pipe instances are overlapped, waits for 'ov' unless 'stop' is signaled or 'timeout' passes first, which cancels it
+static void waitPending(HANDLE pipe, OVERLAPPED& ov, HANDLE stop, DWORD timeout = INFINITE)
+{
+	HANDLE events[2] = { ov.hEvent, stop };
+	if (WaitForMultipleObjects(stop ? 2 : 1, events, FALSE, timeout) != WAIT_OBJECT_0) CancelIoEx(pipe, &ov);
+}
+
+// a client that connects and sends nothing gives its reader back after this long
+static const DWORD read_timeout_ms = 30000;
+
+static bool readMessage(HANDLE pipe, HANDLE stop, string& message)
+{
+	char buffer[4096];
+	OVERLAPPED ov = {};
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	bool ret = false;
+	while (true)
+	{
+		if (!ReadFile(pipe, buffer, sizeof(buffer), NULL, &ov))
+		{
+			DWORD error = GetLastError();
+			if (error == ERROR_IO_PENDING) waitPending(pipe, ov, stop, read_timeout_ms);
+			else if (error != ERROR_MORE_DATA) break;
+		}
+		DWORD read = 0;
+		BOOL ok = GetOverlappedResult(pipe, &ov, &read, TRUE);
+		if (!ok && GetLastError() != ERROR_MORE_DATA) break;
+		message.append(buffer, read);
+		if (ok)
+		{
+			ret = true;
+			break;
+		}
+	}
+	CloseHandle(ov.hEvent);
+	return ret;
+}
+
+// sends the response and closes this client's pipe instance
+static void reply(HANDLE pipe, pugi::xml_document& response)
+{
+	stringWriter writer;
+	response.save(writer, L"", pugi::format_raw | pugi::format_no_declaration, pugi::encoding_utf8);
+
+	OVERLAPPED ov = {};
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	DWORD written = 0;
+	if (WriteFile(pipe, writer.data.data(), (DWORD)writer.data.size(), NULL, &ov) || GetLastError() == ERROR_IO_PENDING)
+		GetOverlappedResult(pipe, &ov, &written, TRUE);
+	CloseHandle(ov.hEvent);
+	FlushFileBuffers(pipe);
+	DisconnectNamedPipe(pipe);
+	CloseHandle(pipe);
+}
+
+static void replyResult(HANDLE pipe, int code, double wait_ms, double run_ms)
+{
+	pugi::xml_document response;
+	auto result = response.append_child(L"result");
+	result.append_attribute(L"code") = code;
+	if (code) result.append_attribute(L"error") = xrutils::errorToString(code).c_str();
+	result.append_attribute(L"queued-ms") = wait_ms;
+	result.append_attribute(L"run-ms") = run_ms;
+	reply(pipe, response);
+}
+
+static void replyMetrics(HANDLE pipe, serveState& state)
+{
+	serveMetrics metrics;
+	{
+		lock_guard<mutex> guard(state.lock);
+		metrics = state.metrics;
+	}
+
+	pugi::xml_document response;
+	auto node = response.append_child(L"metrics");
+	node.append_attribute(L"requests") = metrics.requests;
+	node.append_attribute(L"failed") = metrics.failed;
+	node.append_attribute(L"queue-depth") = (unsigned long long)metrics.queue_depth;
+	node.append_attribute(L"max-queue-depth") = (unsigned long long)metrics.max_queue_depth;
+	node.append_attribute(L"avg-queued-ms") = metrics.requests ? metrics.total_wait_ms / metrics.requests : 0.0;
+	node.append_attribute(L"avg-run-ms") = metrics.requests ? metrics.total_run_ms / metrics.requests : 0.0;
+	node.append_attribute(L"max-run-ms") = metrics.max_run_ms;
+	reply(pipe, response);
+}
+
+// requests are executed one at a time, in arrival order
+static void serveWorker(serveState& state, bool skip_errors)
+{
+	while (true)
+	{
+		serveRequest request;
+		{
+			unique_lock<mutex> guard(state.lock);
+			state.wakeup.wait(guard, [&state]() { return state.stopping || state.queue.size() > 0; });
+			if (state.queue.size() == 0) return;
+			request = state.queue.front();
+			state.queue.pop_front();
+			state.metrics.queue_depth = state.queue.size();
+		}
+
+		double wait_ms = millisecondsSince(request.queued);
+		auto started = chrono::steady_clock::now();
+		// a bad regex or a failed allocation fails this request, not the service
+		int r;
+		try
+		{
+			r = runJob(request.job, state.context, true, skip_errors, false);
+		}
+		catch (exception& ex)
+		{
+			xrlog::error() << "request failed: " << ex.what();
+			r = ERROR_XRSERVE_JOBFAILED;
+		}
+		double run_ms = millisecondsSince(started);
+
+		{
+			lock_guard<mutex> guard(state.lock);
+			state.metrics.requests++;
+			if (r) state.metrics.failed++;
+			state.metrics.total_wait_ms += wait_ms;
+			state.metrics.total_run_ms += run_ms;
+			if (run_ms > state.metrics.max_run_ms) state.metrics.max_run_ms = run_ms;
+		}
+
+		replyResult(request.pipe, r, wait_ms, run_ms);
+	}
+}
+
+// only this account, SYSTEM and administrators can open the pipe, the service usually runs elevated
+static bool pipeSecurity(SECURITY_ATTRIBUTES& attributes)
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) return false;
+	DWORD size = 0;
+	GetTokenInformation(token, TokenUser, NULL, 0, &size);
+	vector<BYTE> user(size);
+	bool ok = size > 0 && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+	CloseHandle(token);
+
+	wchar_t* sid = nullptr;
+	if (!ok || !ConvertSidToStringSidW(((TOKEN_USER*)user.data())->User.Sid, &sid)) return false;
+	wstring sddl = wstring(L"D:P(A;;GA;;;SY)(A;;GA;;;BA)(A;;GA;;;") + sid + L")";
+	LocalFree(sid);
+
+	attributes.nLength = sizeof(attributes);
+	attributes.bInheritHandle = FALSE;
+	return ConvertStringSecurityDescriptorToSecurityDescriptorW(sddl.c_str(), SDDL_REVISION_1, &attributes.lpSecurityDescriptor, NULL) != FALSE;
+}
+
+static void handleRequest(serveState& state, HANDLE pipe, const string& message)
+{
+	try
+	{
+		pugi::xml_document request;
+		auto parse_result = request.load_buffer(message.data(), message.size(), pugi::parse_default, pugi::encoding_utf8);
+		auto node = request.first_child();
+		wstring kind = node.name();
+		serveRequest queued;
+		if (parse_result.status != pugi::status_ok) replyResult(pipe, ERROR_XRSERVE_BADREQUEST, 0, 0);
+		else if (kind == L"metrics") replyMetrics(pipe, state);
+		else if (kind == L"stop")
+		{
+			replyResult(pipe, 0, 0, 0);
+			SetEvent(state.stop);
+		}
+		else if (readJob(node, L"", queued.job)) replyResult(pipe, ERROR_XRSERVE_BADREQUEST, 0, 0);
+		else
+		{
+			queued.pipe = pipe;
+			queued.queued = chrono::steady_clock::now();
+			{
+				lock_guard<mutex> guard(state.lock);
+				state.queue.push_back(queued);
+				state.metrics.queue_depth = state.queue.size();
+				if (state.metrics.queue_depth > state.metrics.max_queue_depth)
+					state.metrics.max_queue_depth = state.metrics.queue_depth;
+			}
+			state.wakeup.notify_one();
+		}
+	}
+	catch (exception& ex)
+	{
+		xrlog::error() << "bad request: " << ex.what();
+		replyResult(pipe, ERROR_XRSERVE_BADREQUEST, 0, 0);
+	}
+}
+
+// reads one request and queues it, a client that is slow to send does not hold up the others
+static void serveConnection(serveState& state, HANDLE pipe)
+{
+	string message;
+	if (readMessage(pipe, state.stop, message)) handleRequest(state, pipe, message);
+	else
+	{
+		DisconnectNamedPipe(pipe);
+		CloseHandle(pipe);
+	}
+
+	lock_guard<mutex> guard(state.lock);
+	state.connections--;
+	state.idle.notify_all();
+}
+
+int serve_reg(wstring name, bool skip_errors)
+{
+	wstring path = L"\\\\.\\pipe\\" + name;
+	xrlog::info() << "serving requests on " << path;
+
+	SECURITY_ATTRIBUTES security = {};
+	if (!pipeSecurity(security))
+	{
+		xrlog::error() << "failed to build the security descriptor of " << path;
+		return ERROR_XRSERVE_CREATEPIPE;
+	}
+
+	serveState state;
+	state.stop = CreateEventW(NULL, TRUE, FALSE, NULL);
+	thread worker(serveWorker, ref(state), skip_errors);
+
+	OVERLAPPED ov = {};
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	int ret = 0;
+	while (WaitForSingleObject(state.stop, 0) != WAIT_OBJECT_0)
+	{
+		// the next client waits in the pipe's backlog while every reader is busy
+		{
+			unique_lock<mutex> guard(state.lock);
+			state.idle.wait(guard, [&state]() { return state.connections < serveState::max_connections; });
+		}
+
+		HANDLE pipe = CreateNamedPipeW(path.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+			PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+			PIPE_UNLIMITED_INSTANCES, 65536, 65536, 0, &security);
+		if (pipe == INVALID_HANDLE_VALUE)
+		{
+			xrlog::error() << "failed to create pipe " << path;
+			ret = ERROR_XRSERVE_CREATEPIPE;
+			break;
+		}
+
+		DWORD unused = 0;
+		bool connected = ConnectNamedPipe(pipe, &ov) != FALSE || GetLastError() == ERROR_PIPE_CONNECTED;
+		if (!connected && GetLastError() == ERROR_IO_PENDING)
+		{
+			waitPending(pipe, ov, state.stop);
+			connected = GetOverlappedResult(pipe, &ov, &unused, TRUE) != FALSE;
+		}
+		if (!connected)
+		{
+			CloseHandle(pipe);
+			continue;
+		}
+
+		{
+			lock_guard<mutex> guard(state.lock);
+			state.connections++;
+		}
+		thread(serveConnection, ref(state), pipe).detach();
+	}
+	CloseHandle(ov.hEvent);
+
+	// the stop event cancels the reads that are still waiting, what was queued before is still served
+	SetEvent(state.stop);
+	{
+		unique_lock<mutex> guard(state.lock);
+		state.idle.wait(guard, [&state]() { return state.connections == 0; });
+		state.stopping = true;
+	}
+	state.wakeup.notify_one();
+	worker.join();
+	CloseHandle(state.stop);
+	LocalFree(security.lpSecurityDescriptor);
+
+	xrlog::info() << "served " << state.metrics.requests << " request(s), " << state.metrics.failed << " failed";
+	return ret;
+}
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "stats.h"
+
+#include <atomic>
+#include <sstream>
+
+#include <windows.h>
+#include <psapi.h>
+
+#pragma comment (lib, "Psapi.lib")
+
+using namespace std;
+
+namespace xrstats {
+
+	static bool is_enabled = false;
+	static chrono::steady_clock::time_point started;
+	static atomic<unsigned long long> counters[COUNTER_COUNT];
+	static atomic<unsigned long long> phase_ns[PHASE_COUNT];
+	static atomic<unsigned long long> phase_calls[PHASE_COUNT];
+
+	static const wchar_t* counter_names[COUNTER_COUNT] = {
+		L"open", L"query", L"enum", L"set", L"delete", L"bytes_read", L"bytes_written", L"hits", L"misses"
+	};
+
+	static const wchar_t* phase_names[PHASE_COUNT] = {
+		L"parse", L"replacement", L"registry", L"serialization", L"base64", L"write", L"compression", L"encoding"
+	};
+
+	void enable()
+	{
+		is_enabled = true;
+		started = chrono::steady_clock::now();
+	}
+
+	bool enabled()
+	{
+		return is_enabled;
+	}
+
+	void count(counter c, unsigned long long n)
+	{
+		if (is_enabled) counters[c] += n;
+	}
+
+	void addTime(phase p, chrono::steady_clock::duration elapsed)
+	{
+		phase_ns[p] += chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+		phase_calls[p]++;
+	}
+
+	wstring summary()
+	{
+		wstringstream ss;
+		ss << L"{\"registry_calls\":{";
+		for (int i = 0; i < BYTES_READ; ++i)
+			ss << (i ? L"," : L"") << L"\"" << counter_names[i] << L"\":" << counters[i].load();
+		ss << L"},\"" << counter_names[BYTES_READ] << L"\":" << counters[BYTES_READ].load()
+			<< L",\"" << counter_names[BYTES_WRITTEN] << L"\":" << counters[BYTES_WRITTEN].load();
+
+		unsigned long long hits = counters[KEY_CACHE_HIT].load(), misses = counters[KEY_CACHE_MISS].load();
+		ss << L",\"key_cache\":{\"" << counter_names[KEY_CACHE_HIT] << L"\":" << hits
+			<< L",\"" << counter_names[KEY_CACHE_MISS] << L"\":" << misses
+			<< L",\"hit_rate\":" << (hits + misses ? (double)hits / (hits + misses) : 0.0) << L"}";
+
+		ss << L",\"phases\":{";
+		for (int i = 0; i < PHASE_COUNT; ++i)
+		{
+			ss << (i ? L"," : L"") << L"\"" << phase_names[i] << L"\":{\"ms\":"
+				<< phase_ns[i].load() / 1e6 << L",\"calls\":" << phase_calls[i].load() << L"}";
+		}
+		ss << L"}";
+
+		ss << L",\"total_ms\":" << chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+
+		PROCESS_MEMORY_COUNTERS memory = { 0 };
+		memory.cb = sizeof(memory);
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+			ss << L",\"peak_working_set\":" << (unsigned long long)memory.PeakWorkingSetSize
+				<< L",\"peak_pagefile\":" << (unsigned long long)memory.PeakPagefileUsage;
+
+		ss << L"}";
+		return ss.str();
+	}
+}
@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <chrono>
+
+namespace xrstats {
+
+	enum counter
+	{
+		REG_OPEN,
+		REG_QUERY,
+		REG_ENUM,
+		REG_SET,
+		REG_DELETE,
+		BYTES_READ,
+		BYTES_WRITTEN,
+		KEY_CACHE_HIT,
+		KEY_CACHE_MISS,
+		COUNTER_COUNT
+	};
+
+	enum phase
+	{
+		PHASE_PARSE,
+		PHASE_REPLACEMENT,
+		PHASE_REGISTRY,
+		PHASE_SERIALIZATION,
+		PHASE_BASE64,
+		PHASE_WRITE,
+		PHASE_COMPRESSION,
+		PHASE_ENCODING,
+		PHASE_COUNT
+	};
+
+	// nothing is counted or timed until this is called
+	void enable();
+	bool enabled();
+
+	void count(counter c, unsigned long long n = 1);
+	void addTime(phase p, std::chrono::steady_clock::duration elapsed);
+
+	// adds the lifetime of the object to a phase
+	class timer
+	{
+		phase p;
+		bool active;
+		std::chrono::steady_clock::time_point start;
+	public:
+		timer(phase p) : p(p), active(enabled())
+		{
+			if (active) start = std::chrono::steady_clock::now();
+		}
+		~timer()
+		{
+			if (active) addTime(p, std::chrono::steady_clock::now() - start);
+		}
+	};
+
+	// json object with the counters, phase timings, total run time and peak memory
+	std::wstring summary();
+}
@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "trace.h"
+#include "registry.h"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <fstream>
+
+#include <windows.h>
+
+using namespace std;
+
+namespace xrtrace {
+
+	struct event
+	{
+		long long ts;
+		wchar_t phase;
+		const wchar_t* category;
+		wchar_t name[52];
+	};
+
+	// written only by its owner thread; once it is full new spans are dropped and counted, but there is always
+	// room left for the ends of the spans already open, so the outermost keys stay in the trace and it stays balanced
+	struct eventBuffer
+	{
+		static const size_t capacity = 1 << 16;
+		unsigned tid = 0;
+		atomic<size_t> head{ 0 };
+		size_t open = 0;
+		atomic<unsigned long long> dropped{ 0 };
+		unique_ptr<event[]> events{ new event[capacity] };
+	};
+
+	static bool is_enabled = false;
+	static unsigned depth_limit = 0;
+	static wstring output;
+	static chrono::steady_clock::time_point started;
+
+	static mutex buffers_lock;
+	static vector<shared_ptr<eventBuffer>> buffers;
+
+	static thread_local shared_ptr<eventBuffer> local;
+	static thread_local unsigned depth = 0;
+
+	void enable(const wstring& file, unsigned max_depth)
+	{
+		output = file;
+		depth_limit = max_depth;
+		started = chrono::steady_clock::now();
+		is_enabled = true;
+	}
+
+	bool enabled()
+	{
+		return is_enabled;
+	}
+
+	static eventBuffer& localBuffer()
+	{
+		if (!local)
+		{
+			local = make_shared<eventBuffer>();
+			lock_guard<mutex> guard(buffers_lock);
+			local->tid = (unsigned)buffers.size() + 1;
+			buffers.push_back(local);
+		}
+		return *local;
+	}
+
+	// false if a 'B' was dropped, its 'E' must not be recorded then
+	static bool record(wchar_t phase, const wchar_t* category, const wchar_t* name)
+	{
+		eventBuffer& buffer = localBuffer();
+		size_t head = buffer.head.load(memory_order_relaxed);
+		if (phase == L'B')
+		{
+			// this span's end and the ends of the open ones must still fit
+			if (head + buffer.open + 2 > eventBuffer::capacity)
+			{
+				buffer.dropped.fetch_add(2, memory_order_relaxed);
+				return false;
+			}
+			buffer.open++;
+		}
+		else buffer.open--;
+
+		event& e = buffer.events[head];
+		e.ts = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+		e.phase = phase;
+		e.category = category;
+		wcsncpy_s(e.name, name, _TRUNCATE);
+		buffer.head.store(head + 1, memory_order_release);
+		return true;
+	}
+
+	bool begin(const wchar_t* category, const wchar_t* name)
+	{
+		return is_enabled && record(L'B', category, name);
+	}
+
+	void end(const wchar_t* category, const wchar_t* name)
+	{
+		if (is_enabled) record(L'E', category, name);
+	}
+
+	void keySpan::begin(const wstring& key)
+	{
+		end();
+		if (!is_enabled) return;
+		open = true;
+		recorded = ++depth <= depth_limit;
+		if (!recorded) return;
+
+		// long paths are cut from the left, the leaf is the interesting part
+		const size_t room = sizeof(event::name) / sizeof(wchar_t) - 1;
+		name = key.length() > room ? L"..." + key.substr(key.length() - room + 3) : key;
+		recorded = record(L'B', L"key", name.c_str());
+	}
+
+	void keySpan::end()
+	{
+		if (!open) return;
+		open = false;
+		if (recorded) record(L'E', L"key", name.c_str());
+		--depth;
+	}
+
+	callSpan::callSpan(const wchar_t* name) : recorded(is_enabled && depth <= depth_limit), name(name)
+	{
+		if (recorded) recorded = record(L'B', L"registry", name);
+	}
+
+	callSpan::~callSpan()
+	{
+		if (recorded) record(L'E', L"registry", name);
+	}
+
+	static string escape(const wchar_t* text)
+	{
+		string ret;
+		for (char c : utf8_from_wstring(text))
+		{
+			if (c == '"' || c == '\\') ret += '\\';
+			if ((unsigned char)c < 0x20) continue;
+			ret += c;
+		}
+		return ret;
+	}
+
+	unsigned long long dropped()
+	{
+		unsigned long long ret = 0;
+		lock_guard<mutex> guard(buffers_lock);
+		for (auto& buffer : buffers) ret += buffer->dropped.load(memory_order_relaxed);
+		return ret;
+	}
+
+	bool write()
+	{
+		if (!is_enabled) return true;
+
+		ofstream out(output.c_str(), ios::binary | ios::trunc);
+		if (!out) return false;
+
+		DWORD pid = GetCurrentProcessId();
+		bool first = true;
+		out << "{\"traceEvents\":[";
+
+		lock_guard<mutex> guard(buffers_lock);
+		for (auto& buffer : buffers)
+		{
+			size_t head = buffer->head.load(memory_order_acquire);
+			for (size_t i = 0; i < head; ++i)
+			{
+				const event& e = buffer->events[i];
+				out << (first ? "\n" : ",\n")
+					<< "{\"name\":\"" << escape(e.name) << "\",\"cat\":\"" << escape(e.category)
+					<< "\",\"ph\":\"" << (char)e.phase << "\",\"ts\":" << e.ts
+					<< ",\"pid\":" << pid << ",\"tid\":" << buffer->tid << "}";
+				first = false;
+			}
+		}
+
+		out << "\n]}\n";
+		return out.good();
+	}
+}
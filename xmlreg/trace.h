@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+
+namespace xrtrace {
+
+	// events are kept in memory until write() is called
+	void enable(const std::wstring& file, unsigned max_depth);
+	bool enabled();
+
+	// each thread keeps up to 64K events, later spans are dropped; call end only if begin returned true
+	bool begin(const wchar_t* category, const wchar_t* name);
+	void end(const wchar_t* category, const wchar_t* name);
+	// events that did not fit, write() still produces a balanced trace
+	unsigned long long dropped();
+
+	// writes the events of all threads in chrome trace format (chrome://tracing, ui.perfetto.dev)
+	bool write();
+
+	// one registry key visited by export, import or wipe
+	// keys deeper than the depth limit, and everything inside them, are not recorded
+	// traversals with an explicit stack keep one per level and call begin/end as keys are pushed and popped
+	class keySpan
+	{
+		bool open = false;
+		bool recorded = false;
+		std::wstring name;
+	public:
+		keySpan() {}
+		keySpan(const std::wstring& key) { begin(key); }
+		~keySpan() { end(); }
+		keySpan(const keySpan&) = delete;
+		keySpan& operator=(const keySpan&) = delete;
+
+		void begin(const std::wstring& key);
+		void end();
+	};
+
+	// a registry api call, recorded only inside keys within the depth limit
+	class callSpan
+	{
+		bool recorded;
+		const wchar_t* name;
+	public:
+		callSpan(const wchar_t* name);
+		~callSpan();
+	};
+}
@@ -0,0 +1,239 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "undo.h"
+
+using namespace std;
+
+namespace xrundo {
+
+	static const char header[] = "xmlreg undo 1\n";
+	static const size_t header_length = sizeof(header) - 1;
+
+	static void putInteger(string& out, unsigned long value)
+	{
+		char bytes[4] = { (char)(value & 0xFF), (char)((value >> 8) & 0xFF), (char)((value >> 16) & 0xFF), (char)((value >> 24) & 0xFF) };
+		out.append(bytes, 4);
+	}
+
+	static void putString(string& out, const wstring& text)
+	{
+		putInteger(out, (unsigned long)text.length());
+		for (wchar_t c : text)
+		{
+			out += (char)(c & 0xFF);
+			out += (char)((c >> 8) & 0xFF);
+		}
+	}
+
+	static void putData(string& out, const string& data)
+	{
+		putInteger(out, (unsigned long)data.length());
+		out += data;
+	}
+
+	// reads from 'data' at 'offset', false past the end
+	class recordReader
+	{
+		const string& data;
+		size_t offset;
+
+	public:
+		recordReader(const string& data, size_t offset) : data(data), offset(offset) {}
+
+		size_t position() const { return offset; }
+		bool done() const { return offset >= data.length(); }
+
+		bool getByte(unsigned char& value)
+		{
+			if (offset + 1 > data.length()) return false;
+			value = (unsigned char)data[offset++];
+			return true;
+		}
+
+		bool getInteger(unsigned long& value)
+		{
+			if (offset + 4 > data.length()) return false;
+			const unsigned char* p = (const unsigned char*)data.data() + offset;
+			value = (unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+			offset += 4;
+			return true;
+		}
+
+		bool getString(wstring& text)
+		{
+			unsigned long length;
+			if (!getInteger(length) || offset + (size_t)length * 2 > data.length()) return false;
+			const unsigned char* p = (const unsigned char*)data.data() + offset;
+			text.resize(length);
+			for (unsigned long i = 0; i < length; ++i) text[i] = (wchar_t)(p[2 * i] | (p[2 * i + 1] << 8));
+			offset += (size_t)length * 2;
+			return true;
+		}
+
+		bool getData(string& bytes)
+		{
+			unsigned long length;
+			if (!getInteger(length) || offset + length > data.length()) return false;
+			bytes.assign(data, offset, length);
+			offset += length;
+			return true;
+		}
+	};
+
+	undoLog::~undoLog()
+	{
+		if (file == INVALID_HANDLE_VALUE) return;
+		commit();
+		CloseHandle(file);
+	}
+
+	bool undoLog::open(const wstring& path, bool append, wstring& error)
+	{
+		bool existing = append && GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+		file = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, existing ? OPEN_EXISTING : CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			error = L"cannot write undo log " + path;
+			return false;
+		}
+		if (!existing) pending.assign(header, header_length);
+		return true;
+	}
+
+	void undoLog::at(HKEY hive, REGSAM redirection)
+	{
+		this->hive = hive;
+		this->redirection = redirection;
+	}
+
+	void undoLog::select(const wstring& key)
+	{
+		if (keyed && written_hive == hive && written_key == key) return;
+		pending += (char)CHANGE_KEY;
+		// predefined hives are 32 bit constants, sign extended in 64 bit builds
+		putInteger(pending, (unsigned long)(ULONG_PTR)hive);
+		putInteger(pending, (unsigned long)redirection);
+		putString(pending, key);
+		written_hive = hive;
+		written_key = key;
+		keyed = true;
+	}
+
+	void undoLog::keyCreated(const wstring& key)
+	{
+		select(key);
+		pending += (char)CHANGE_CREATED;
+	}
+
+	void undoLog::keyDeleted(const wstring& key)
+	{
+		select(key);
+		pending += (char)CHANGE_DELETED;
+	}
+
+	void undoLog::value(const wstring& key, const wstring& name, unsigned long type, const string& data)
+	{
+		select(key);
+		pending += (char)CHANGE_VALUE;
+		putString(pending, name);
+		putInteger(pending, type);
+		putData(pending, data);
+	}
+
+	void undoLog::absent(const wstring& key, const wstring& name)
+	{
+		select(key);
+		pending += (char)CHANGE_ABSENT;
+		putString(pending, name);
+	}
+
+	bool undoLog::commit()
+	{
+		if (pending.empty()) return true;
+		DWORD written;
+		bool ok = WriteFile(file, pending.data(), (DWORD)pending.size(), &written, nullptr) && written == pending.size();
+		pending.clear();
+		return ok;
+	}
+
+	bool read(const wstring& path, vector<change>& changes, wstring& error)
+	{
+		string data;
+		HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (h == INVALID_HANDLE_VALUE)
+		{
+			error = L"cannot open undo log " + path;
+			return false;
+		}
+		char chunk[65536];
+		DWORD count;
+		while (ReadFile(h, chunk, sizeof(chunk), &count, nullptr) && count > 0) data.append(chunk, count);
+		CloseHandle(h);
+
+		if (data.compare(0, header_length, header) != 0)
+		{
+			error = path + L" is not an undo log";
+			return false;
+		}
+
+		change current;
+		bool keyed = false;
+		recordReader in(data, header_length);
+		while (!in.done())
+		{
+			unsigned char kind = 0;
+			bool complete = in.getByte(kind);
+			if (complete && kind == CHANGE_KEY)
+			{
+				unsigned long hive, redirection;
+				complete = in.getInteger(hive) && in.getInteger(redirection) && in.getString(current.key);
+				current.hive = (HKEY)(ULONG_PTR)(LONG)hive;
+				current.redirection = (REGSAM)redirection;
+				if (!complete) break;
+				keyed = true;
+				continue;
+			}
+			if (!keyed && complete)
+			{
+				error = path + L" has a record before the first key";
+				return false;
+			}
+
+			current.kind = (changeKind)kind;
+			current.name.clear();
+			current.type = REG_NONE;
+			current.data.clear();
+			if (kind == CHANGE_VALUE) complete = complete && in.getString(current.name) && in.getInteger(current.type) && in.getData(current.data);
+			else if (kind == CHANGE_ABSENT) complete = complete && in.getString(current.name);
+			else if (complete && kind != CHANGE_CREATED && kind != CHANGE_DELETED)
+			{
+				error = path + L" has an unknown record at offset " + to_wstring(in.position() - 1);
+				return false;
+			}
+
+			// whatever stopped the import can leave the last record half written
+			if (!complete) break;
+			changes.push_back(current);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+// --undo-log: what an import is about to change, appended to a binary file before the change is made,
+// so that --rollback can put the old values back in reverse order
+//
+// the file starts with "xmlreg undo 1\n" and is followed by records, one byte for the kind and then its fields:
+// integers are 32 bits little endian, strings a character count and UTF-16 text, data a byte count and the bytes
+//
+//   key		hive, redirection, path		the key the records after it are about
+//   created	-							the key did not exist, rollback deletes it with everything below
+//   deleted	-							the key was deleted, rollback creates it again
+//   value		name, type, data			the value before it was overwritten or deleted
+//   absent		name						the value did not exist, rollback deletes it
+namespace xrundo {
+
+	enum changeKind
+	{
+		CHANGE_KEY = 1,
+		CHANGE_CREATED,
+		CHANGE_DELETED,
+		CHANGE_VALUE,
+		CHANGE_ABSENT
+	};
+
+	// one record of an undo log as rollback reads it, with the key of the last 'key' record filled in
+	struct change
+	{
+		changeKind kind = CHANGE_KEY;
+		HKEY hive = NULL;
+		REGSAM redirection = 0;
+		std::wstring key;
+		std::wstring name;
+		unsigned long type = REG_NONE;
+		std::string data;
+	};
+
+	class undoLog
+	{
+		HANDLE file = INVALID_HANDLE_VALUE;
+		// records since the last commit
+		std::string pending;
+		HKEY hive = NULL;
+		REGSAM redirection = 0;
+		// the key of the last 'key' record, a record about the same key does not repeat it
+		HKEY written_hive = NULL;
+		std::wstring written_key;
+		bool keyed = false;
+
+		void select(const std::wstring& key);
+
+	public:
+		undoLog() {}
+		undoLog(const undoLog&) = delete;
+		undoLog& operator=(const undoLog&) = delete;
+		~undoLog();
+
+		// a new log, or with 'append' the end of an existing one (for --resume)
+		bool open(const std::wstring& path, bool append, std::wstring& error);
+		bool isOpen() const { return file != INVALID_HANDLE_VALUE; }
+
+		// where the keys of the following records are
+		void at(HKEY hive, REGSAM redirection);
+		void keyCreated(const std::wstring& key);
+		void keyDeleted(const std::wstring& key);
+		void value(const std::wstring& key, const std::wstring& name, unsigned long type, const std::string& data);
+		void absent(const std::wstring& key, const std::wstring& name);
+
+		// writes the records since the last call, the caller makes the change they describe after this returns
+		// the file is not flushed to disk, it survives the process but not the machine going down
+		bool commit();
+	};
+
+	// every record of the log at 'path' in the order they were written, a record cut short at the end is left out
+	bool read(const std::wstring& path, std::vector<change>& changes, std::wstring& error);
+}
@@ -148,18 +148,84 @@ namespace xrutils {
 		return REG_NONE;
 	}
 
+	size_t formatDecimal(char* out, long long value)
+	{
+		char digits[20];
+		size_t count = 0;
+		unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+		do
+		{
+			digits[count++] = (char)('0' + magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude);
+
+		size_t length = 0;
+		if (value < 0) out[length++] = '-';
+		while (count) out[length++] = digits[--count];
+		return length;
+	}
+
+	size_t formatHex(char* out, unsigned long long value, int digits)
+	{
+		static const char* hex = "0123456789abcdef";
+		out[0] = '0';
+		out[1] = 'x';
+		for (int i = 0; i < digits; ++i) out[2 + i] = hex[(value >> (4 * (digits - 1 - i))) & 0xF];
+		return 2 + digits;
+	}
+
+	bool parseInteger(const wchar_t* text, long long& value)
+	{
+		value = 0;
+		while (*text == L' ' || *text == L'\t' || *text == L'\r' || *text == L'\n') ++text;
+
+		bool negative = *text == L'-';
+		if (*text == L'-' || *text == L'+') ++text;
+
+		unsigned long long result = 0;
+		const wchar_t* start;
+		if (text[0] == L'0' && (text[1] == L'x' || text[1] == L'X'))
+		{
+			text += 2;
+			start = text;
+			for (;; ++text)
+			{
+				unsigned digit;
+				if (*text >= L'0' && *text <= L'9') digit = *text - L'0';
+				else if (*text >= L'a' && *text <= L'f') digit = *text - L'a' + 10;
+				else if (*text >= L'A' && *text <= L'F') digit = *text - L'A' + 10;
+				else break;
+				result = (result << 4) | digit;
+			}
+		}
+		else
+		{
+			start = text;
+			for (; *text >= L'0' && *text <= L'9'; ++text) result = result * 10 + (*text - L'0');
+		}
+		if (text == start) return false;
+
+		value = negative ? (long long)(0ULL - result) : (long long)result;
+		return true;
+	}
+
 	wstring errorToString(int error)
 	{
 		switch (error)
 		{
 		case ERROR_XRUSAGE_TOO_FEW_ARGUMENTS: return L"too few arguments";
-		case ERROR_XRUSAGE_IMPORT_AND_EXPORT_AND_WIPE: return L"cannot use --import, --export and --wipe at the same time";
-		case ERROR_XRUSAGE_NOIMPORT_AND_NOEXPORT_AND_NOWIPE: return L"must use either --import or --export -or --wipe";
+		case ERROR_XRUSAGE_IMPORT_AND_EXPORT_AND_WIPE: return L"cannot use more than one of --import, --export, --wipe, --batch, --serve, --rollback, --verify and --copy";
+		case ERROR_XRUSAGE_NOIMPORT_AND_NOEXPORT_AND_NOWIPE: return L"must use either --import, --export, --wipe, --batch, --serve, --rollback, --verify or --copy";
 		case ERROR_XRUSAGE_NO_FILE: return L"no file specified";
 		case ERROR_XRUSAGE_PARAMETER_WITHOUT_SWITCH: return L"parameter without preceding switch";
 		case ERROR_XRUSAGE_NO_INPUT_HIVE: return L"no input hive";
 		case ERROR_XRUSAGE_NO_OUTPUT_HIVE: return L"no output hive";
 		case ERROR_XRUSAGE_NO_REPLACE_AFTER_MATCH: return L"must use --replace after --match";
+		case ERROR_XRUSAGE_WINE_FORMAT: return L"wine registry files only work with xml files, in import, export and wipe";
+		case ERROR_XRUSAGE_VALUE_TYPE: return L"unknown type in --value-types";
+		case ERROR_XRUSAGE_RESUME_WITHOUT_JOURNAL: return L"--resume needs --journal";
+		case ERROR_XRUSAGE_VERIFY_FORMAT: return L"--verify only reads xml fragments, in the registry";
+		case ERROR_XRUSAGE_COPY_KEYS: return L"--copy needs a source and a target key, each starting with its hive (HKLM\\Software\\...)";
 		}
 
 		wstringstream ss;
@@ -0,0 +1,271 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "xmlreg.h"
+#include "log.h"
+#include "registry.h"
+#include "document.h"
+#include "progress.h"
+#include "keystack.hpp"
+
+#include <pugixml.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// one difference between the fragment and the registry
+struct difference
+{
+	wstring key;
+	wstring what;
+};
+
+// one <key> element being checked
+struct verifyFrame
+{
+	winreg::keyHandle handle;
+	pugi::xml_node child;			// next child element to look at
+	size_t mark = 0;				// length of the key before this level appended its name
+	xrfilter::position position;
+};
+
+// strings written by other tools can leave out the terminating null, that is not a difference
+static bool sameData(DWORD type, const string& a, const string& b)
+{
+	if (type != REG_SZ && type != REG_EXPAND_SZ && type != REG_MULTI_SZ) return a == b;
+	size_t la = a.length(), lb = b.length();
+	while (la >= 2 && a[la - 1] == '\0' && a[la - 2] == '\0') la -= 2;
+	while (lb >= 2 && b[lb - 1] == '\0' && b[lb - 2] == '\0') lb -= 2;
+	return la == lb && a.compare(0, la, b, 0, lb) == 0;
+}
+
+static wstring valueName(const wstring& name)
+{
+	return name.length() > 0 ? name : L"(default)";
+}
+
+// checks the subtrees of the fragment key on 'workers' threads, each takes the next <key> child of the fragment
+// and walks it depth first, the registry is only read for the keys and values the fragment names
+class fragmentCheck
+{
+	const replacement_rules& rules;
+	const xrfilter::keyFilter& filter;
+	bool first_mismatch;
+	const winreg::keyHandle& root;
+	const wstring& root_key;
+	xrfilter::position root_position;
+
+	vector<pugi::xml_node> tops;
+	// what each subtree found, reported in the order of the fragment once every thread is done
+	vector<vector<difference>> found;
+	atomic<size_t> next_top{ 0 };
+	atomic<bool> stopped{ false };
+	atomic<unsigned long long> keys{ 0 };
+	atomic<unsigned long long> values{ 0 };
+
+	void report(vector<difference>& out, const wstring& key, const wstring& what)
+	{
+		out.push_back({ key, what });
+		if (first_mismatch) stopped = true;
+	}
+
+	void checkValues(const winreg::keyHandle& handle, const wstring& key, const pugi::xml_node& node, const xrfilter::position& position,
+		vector<difference>& out)
+	{
+		if (!position.included) return;
+
+		string expected, actual;
+		vector<wstring> list;
+		unsigned long type;
+		for (pugi::xml_node child : node.children(L"value"))
+		{
+			if (stopped.load(memory_order_relaxed)) return;
+			wstring stype = child.attribute(L"type").value();
+			DWORD wanted = xrutils::stringToPropType(stype);
+			if (filter.filtersTypes() && !filter.wantsType(wanted)) continue;
+
+			wstring name = child.attribute(L"name").value();
+			list.clear();
+			if (wanted == REG_MULTI_SZ)
+				for (pugi::xml_node item : child.children(L"li")) list.push_back(item.text().as_string());
+			encode_value(rules, stype, child.text().as_string(), list, expected);
+			++values;
+			xrprogress::addValues(1);
+
+			if (!handle.read(name, actual, type)) report(out, key, L"missing value " + valueName(name));
+			else if (type != wanted)
+				report(out, key, valueName(name) + L" is " + xrutils::propTypeToString(type) + L", expected " + xrutils::propTypeToString(wanted));
+			else if (!sameData(type, actual, expected)) report(out, key, valueName(name) + L" has different data");
+		}
+	}
+
+	// opens the <key> 'node' below 'parent' and checks its values, or reports it missing and leaves the stack alone
+	void enter(keyStack<verifyFrame>& stack, const winreg::keyHandle& parent, const pugi::xml_node& node, const xrfilter::position& position,
+		wstring& key, vector<difference>& out)
+	{
+		wstring name = node.attribute(L"name").value();
+		size_t mark = key.length();
+		key += L"\\";
+		key += name;
+
+		verifyFrame& frame = stack.push();
+		if (!frame.handle.open(parent, name))
+		{
+			report(out, key, L"missing key");
+			key.resize(mark);
+			stack.pop();
+			return;
+		}
+		frame.child = node.first_child();
+		frame.mark = mark;
+		frame.position = position;
+		++keys;
+		xrprogress::addKeys(1);
+		checkValues(frame.handle, key, node, position, out);
+	}
+
+	void checkBelow(size_t top, const xrfilter::position& position)
+	{
+		keyStack<verifyFrame> stack;
+		wstring key = root_key;
+		xrfilter::position scratch;
+		enter(stack, root, tops[top], position, key, found[top]);
+
+		while (!stack.empty() && !stopped.load(memory_order_relaxed))
+		{
+			verifyFrame& frame = stack.top();
+			if (!frame.child)
+			{
+				frame.handle.close();
+				key.resize(frame.mark);
+				stack.pop();
+				continue;
+			}
+
+			pugi::xml_node child = frame.child;
+			frame.child = child.next_sibling();
+			if (wstring(child.name()) != L"key") continue;
+			if (!filter.enter(frame.position, child.attribute(L"name").value(), scratch)) continue;
+			enter(stack, frame.handle, child, scratch, key, found[top]);
+		}
+	}
+
+	void work()
+	{
+		xrfilter::position position;
+		size_t i;
+		while (!stopped.load(memory_order_relaxed) && (i = next_top++) < tops.size())
+			if (filter.enter(root_position, tops[i].attribute(L"name").value(), position)) checkBelow(i, position);
+	}
+
+public:
+	fragmentCheck(const replacement_rules& rules, const xrfilter::keyFilter& filter, bool first_mismatch,
+		const winreg::keyHandle& root, const wstring& root_key, const xrfilter::position& root_position)
+		: rules(rules), filter(filter), first_mismatch(first_mismatch), root(root), root_key(root_key), root_position(root_position) {}
+
+	// returns how many mismatches were found, after writing them
+	size_t run(const pugi::xml_node& fragment, unsigned workers)
+	{
+		vector<difference> own;
+		++keys;
+		xrprogress::addKeys(1);
+		checkValues(root, root_key, fragment, root_position, own);
+
+		for (pugi::xml_node child : fragment.children(L"key")) tops.push_back(child);
+		found.resize(tops.size());
+
+		vector<thread> threads;
+		if (!stopped) for (size_t i = 0; i < min((size_t)workers, tops.size()); ++i) threads.emplace_back(&fragmentCheck::work, this);
+		for (auto& t : threads) t.join();
+
+		size_t count = own.size();
+		for (auto& m : own) xrlog::warning() << m.what << "\n\ton " << m.key;
+		for (auto& subtree : found)
+		{
+			count += subtree.size();
+			for (auto& m : subtree) xrlog::warning() << m.what << "\n\ton " << m.key;
+		}
+
+		xrlog::info() << keys.load() << " key(s) and " << values.load() << " value(s) checked, " << count << " mismatch(es)"
+			<< (stopped ? L", stopped at the first one" : L"");
+		return count;
+	}
+};
+
+// registry calls wait on the kernel, so a few threads check faster than one
+static unsigned verifyWorkers()
+{
+	return max(1u, min(4u, thread::hardware_concurrency()));
+}
+
+int verify_reg(wstring file, const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool first_mismatch)
+{
+	xrlog::info() << "verifying registry against file " << file;
+
+	pugi::xml_document doc;
+	pugi::xml_parse_result parse_result = loadDocument(doc, file);
+	if (parse_result.status != pugi::status_ok)
+	{
+		xrlog::error() << parse_result.description();
+		return ERROR_XRVERIFY_PARSEXML;
+	}
+
+	pugi::xml_node root = doc.first_element_by_path(L"fragment");
+	if (root.name() != wstring(L"fragment"))
+	{
+		xrlog::error() << "root element is not 'fragment'";
+		return ERROR_XRVERIFY_XMLSCHEMA;
+	}
+
+	wstring ahive = root.attribute(L"hive").value();
+	wstring akey = root.attribute(L"key").value();
+	wstring aredir = root.attribute(L"redirection").value();
+
+	if (ahive.length() == 0 && !target.has_hive)
+		xrlog::info() << "no hive, assuming HKCU";
+
+	wstring key = target.has_key ? target.key : akey;
+	HKEY hive = target.has_hive ? target.hive : xrutils::stringToHive(ahive);
+	REGSAM redirection = target.has_redirection ? target.redirection : xrutils::stringToRedirection(aredir);
+
+	xrlog::info() << "in ("
+		<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
+		<< L"): " << xrutils::hiveToString(hive) << L":\\" << key;
+
+	xrfilter::position position;
+	if (!filter.start(position)) return 0;
+
+	winreg::keyHandle handle;
+	if (!handle.open(hive, key, KEY_READ | redirection))
+	{
+		xrlog::warning() << "missing key\n\ton " << key;
+		return ERROR_XRVERIFY_MISMATCH;
+	}
+
+	xrprogress::display progress(L"verifying", xrprogress::MEASURE_ITEMS);
+	fragmentCheck check(rules, filter, first_mismatch, handle, key, position);
+	return check.run(root, verifyWorkers()) > 0 ? ERROR_XRVERIFY_MISMATCH : 0;
+}
@@ -0,0 +1,810 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "winefile.h"
+#include "document.h"
+#include "asyncfile.h"
+#include "stats.h"
+#include "xmlreg.h"
+#include "keystack.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+namespace winefile {
+
+	struct value
+	{
+		wstring name;
+		// the whole "name"=data text in the mapped file (without the last line break) and where its data starts,
+		// null once the value is written
+		const char* raw = nullptr;
+		size_t raw_length = 0;
+		size_t data_offset = 0;
+		unsigned long type = REG_NONE;
+		string data;
+		bool deleted = false;
+	};
+
+	struct key
+	{
+		wstring name;
+		key* parent = nullptr;
+		vector<unique_ptr<key>> subkeys;
+		unordered_map<wstring, key*> subkey_index;
+		vector<value> values;
+		// built on the first lookup, most keys are only written back
+		unordered_map<wstring, size_t> value_index;
+		bool values_indexed = false;
+		// the "[path] time" line and the # lines below it, null for keys that were not in the file
+		const char* header = nullptr;
+		size_t header_length = 0;
+		bool modified = false;
+	};
+
+	// registry names are case insensitive
+	static wstring lower(const wstring& name)
+	{
+		wstring ret = name;
+		transform(ret.begin(), ret.end(), ret.begin(), ::towlower);
+		return ret;
+	}
+
+	static key* findSubkey(key* k, const wstring& name, bool create)
+	{
+		wstring id = lower(name);
+		auto found = k->subkey_index.find(id);
+		if (found != k->subkey_index.end()) return found->second;
+		if (!create) return nullptr;
+
+		unique_ptr<key> sub(new key());
+		sub->name = name;
+		sub->parent = k;
+		sub->modified = true;
+		key* ret = sub.get();
+		k->subkeys.push_back(move(sub));
+		k->subkey_index[id] = ret;
+		return ret;
+	}
+
+	static value* findValue(key* k, const wstring& name)
+	{
+		if (!k->values_indexed)
+		{
+			for (size_t i = 0; i < k->values.size(); ++i) k->value_index[lower(k->values[i].name)] = i;
+			k->values_indexed = true;
+		}
+		auto found = k->value_index.find(lower(name));
+		if (found == k->value_index.end() || k->values[found->second].deleted) return nullptr;
+		return &k->values[found->second];
+	}
+
+	// hex without leading zeros, as printf's %x
+	static void appendHex(string& out, unsigned long long number)
+	{
+		char buffer[24];
+		xrutils::formatHex(buffer, number, 16);
+		size_t skip = 2;
+		while (skip < 17 && buffer[skip] == '0') ++skip;
+		out.append(buffer + skip, 18 - skip);
+	}
+
+	static int hexDigit(int c)
+	{
+		return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+	}
+
+	// wine's string escapes: \a \b \e \f \n \r \t \v, \x with up to 4 hex digits, up to 3 octal digits,
+	// anything else stands for itself; stops at the first unescaped 'terminator'
+	static bool unescape(const char*& p, const char* end, char terminator, wstring& out)
+	{
+		out.clear();
+		while (p < end && *p != terminator)
+		{
+			unsigned c = (unsigned char)*p++;
+			if (c == '\\' && p < end)
+			{
+				c = (unsigned char)*p++;
+				switch (c)
+				{
+				case 'a': c = '\a'; break;
+				case 'b': c = '\b'; break;
+				case 'e': c = 27; break;
+				case 'f': c = '\f'; break;
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				case 'v': c = '\v'; break;
+				case 'x':
+					c = 0;
+					for (int i = 0; i < 4 && p < end && hexDigit(*p) >= 0; ++i) c = c * 16 + hexDigit(*p++);
+					break;
+				default:
+					if (c >= '0' && c <= '7')
+					{
+						c -= '0';
+						for (int i = 0; i < 2 && p < end && *p >= '0' && *p <= '7'; ++i) c = c * 8 + (*p++ - '0');
+					}
+					break;
+				}
+			}
+			else if (c >= 0x80)
+			{
+				// older prefixes can have utf-8 text
+				int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+				c &= extra == 3 ? 0x07 : extra == 2 ? 0x0F : 0x1F;
+				for (int i = 0; i < extra && p < end; ++i) c = (c << 6) | (*p++ & 0x3F);
+				if (c >= 0x10000)
+				{
+					c -= 0x10000;
+					out += (wchar_t)(0xD800 + (c >> 10));
+					c = 0xDC00 + (c & 0x3FF);
+				}
+			}
+			out += (wchar_t)c;
+		}
+		if (p == end) return false;
+		++p;
+		return true;
+	}
+
+	// the reverse, as wine's dump_strW: non ascii characters as \x, control characters as C or octal escapes,
+	// and a backslash before the backslash and the two 'specials'
+	static void escape(const wchar_t* text, size_t length, const char* specials, string& out)
+	{
+		static const char escapes[33] = ".......abtnvfr.............e....";
+		static const char* digits = "0123456789abcdef";
+		char buffer[16];
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			unsigned c = text[i];
+			if (c > 127)
+			{
+				bool padded = i + 1 < length && text[i + 1] < 128 && hexDigit(text[i + 1]) >= 0;
+				int n = 0;
+				for (int shift = 12; shift >= 0; shift -= 4)
+					if (padded || n > 0 || (c >> shift) != 0 || shift == 0) buffer[n++] = digits[(c >> shift) & 0xF];
+				out += "\\x";
+				out.append(buffer, n);
+			}
+			else if (c < 32)
+			{
+				if (c == 0 && i + 1 == length) continue;
+				out += '\\';
+				if (escapes[c] != '.') out += escapes[c];
+				else if (i + 1 < length && text[i + 1] >= '0' && text[i + 1] <= '7')
+				{
+					out += (char)('0' + (c >> 6));
+					out += (char)('0' + ((c >> 3) & 7));
+					out += (char)('0' + (c & 7));
+				}
+				else
+				{
+					if (c >= 8) out += (char)('0' + (c >> 3));
+					out += (char)('0' + (c & 7));
+				}
+			}
+			else
+			{
+				if (c == '\\' || c == (unsigned char)specials[0] || c == (unsigned char)specials[1]) out += '\\';
+				out += (char)c;
+			}
+		}
+	}
+
+	// type and bytes of the data part of a value line (after the '=')
+	static bool decode(const char* p, const char* end, unsigned long& type, string& data)
+	{
+		data.clear();
+		wstring text;
+
+		if (*p == '"' || (end - p > 4 && memcmp(p, "str(", 4) == 0))
+		{
+			type = REG_SZ;
+			if (*p != '"')
+			{
+				type = strtoul(p + 4, nullptr, 16);
+				p = (const char*)memchr(p, ':', end - p);
+				if (!p || ++p == end || *p != '"') return false;
+			}
+			++p;
+			if (!unescape(p, end, '"', text)) return false;
+			data.assign((const char*)text.c_str(), (text.length() + 1) * sizeof(wchar_t));
+			return true;
+		}
+
+		if (end - p >= 6 && memcmp(p, "dword:", 6) == 0)
+		{
+			type = REG_DWORD;
+			DWORD number = strtoul(p + 6, nullptr, 16);
+			data.assign((const char*)&number, sizeof(number));
+			return true;
+		}
+
+		if (end - p >= 4 && memcmp(p, "hex", 3) == 0)
+		{
+			type = REG_BINARY;
+			if (p[3] == '(') type = strtoul(p + 4, nullptr, 16);
+			p = (const char*)memchr(p, ':', end - p);
+			if (!p) return false;
+			for (++p; p < end; ++p)
+			{
+				if (hexDigit(*p) < 0) continue;
+				if (p + 1 == end || hexDigit(p[1]) < 0) return false;
+				data += (char)(hexDigit(p[0]) * 16 + hexDigit(p[1]));
+				++p;
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	// as wine's save_value: terminated strings as text, dwords as dword:, everything else as hex with lines of about 76 characters
+	static void encode(const value& v, string& out)
+	{
+		size_t start = out.length();
+		if (v.name.length() == 0) out += '@';
+		else
+		{
+			out += '"';
+			escape(v.name.c_str(), v.name.length(), "\"\"", out);
+			out += '"';
+		}
+		out += '=';
+
+		const unsigned char* data = (const unsigned char*)v.data.data();
+		size_t length = v.data.length();
+		char buffer[16];
+
+		switch (v.type)
+		{
+		case REG_SZ:
+		case REG_EXPAND_SZ:
+		case REG_MULTI_SZ:
+			if (length < sizeof(wchar_t) || length % sizeof(wchar_t) || ((const wchar_t*)data)[length / sizeof(wchar_t) - 1]) break;
+			if (v.type != REG_SZ) out += v.type == REG_EXPAND_SZ ? "str(2):" : "str(7):";
+			out += '"';
+			escape((const wchar_t*)data, length / sizeof(wchar_t), "\"\"", out);
+			out += "\"\n";
+			return;
+
+		case REG_DWORD:
+			if (length != sizeof(DWORD)) break;
+			out += "dword:";
+			out.append(buffer + 2, xrutils::formatHex(buffer, *(const DWORD*)data, 8) - 2);
+			out += '\n';
+			return;
+		}
+
+		if (v.type == REG_BINARY) out += "hex:";
+		else
+		{
+			out += "hex(";
+			appendHex(out, v.type);
+			out += "):";
+		}
+
+		static const char* digits = "0123456789abcdef";
+		size_t count = out.length() - start;
+		for (size_t i = 0; i < length; ++i)
+		{
+			out += digits[data[i] >> 4];
+			out += digits[data[i] & 0xF];
+			count += 2;
+			if (i + 1 < length)
+			{
+				out += ',';
+				if (++count > 76)
+				{
+					out += "\\\n  ";
+					count = 2;
+				}
+			}
+		}
+		out += '\n';
+	}
+
+	registry::registry()
+	{
+	}
+
+	registry::~registry()
+	{
+	}
+
+	bool registry::load(const wstring& file, wstring& error)
+	{
+		this->file = file;
+		mapped.reset(new mappedFile(file));
+		if (!mapped->view)
+		{
+			error = L"cannot open " + file;
+			return false;
+		}
+
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		const char* p = (const char*)mapped->view;
+		const char* end = p + mapped->size;
+
+		static const char signature[] = "WINE REGISTRY Version 2";
+		if (mapped->size < sizeof(signature) - 1 || memcmp(p, signature, sizeof(signature) - 1) != 0)
+		{
+			error = file + L" is not a wine registry file";
+			return false;
+		}
+
+		root.reset(new key());
+		preamble = p;
+		key* current = nullptr;
+		size_t line_number = 0;
+
+		while (p < end)
+		{
+			const char* line = p;
+			const char* eol = (const char*)memchr(p, '\n', end - p);
+			if (!eol) eol = end;
+			p = eol < end ? eol + 1 : end;
+			++line_number;
+
+			const char* last = eol;
+			if (last > line && last[-1] == '\r') --last;
+
+			if (line == last) continue;
+
+			if (*line == '[')
+			{
+				if (!current) preamble_length = line - preamble;
+
+				const char* q = line + 1;
+				wstring path;
+				if (!unescape(q, last, ']', path))
+				{
+					error = L"invalid key at line " + to_wstring(line_number);
+					return false;
+				}
+
+				current = root.get();
+				size_t start = 0;
+				while (start <= path.length())
+				{
+					size_t split = path.find(L'\\', start);
+					if (split == wstring::npos) split = path.length();
+					if (split > start) current = findSubkey(current, path.substr(start, split - start), true);
+					start = split + 1;
+				}
+				current->header = line;
+				current->header_length = last - line;
+				current->modified = false;
+				continue;
+			}
+
+			if (!current)
+			{
+				if (line_number == 2 && last - line > 24 && memcmp(line, ";; All keys relative to ", 24) == 0)
+				{
+					const char* q = line + 24;
+					unescape(q, last, '\n', root_path);
+				}
+				else if (last - line == 11 && memcmp(line, "#arch=win64", 11) == 0) win64 = true;
+				continue;
+			}
+
+			if (*line == '#')
+			{
+				// #time, #class and #link belong to the key above them
+				if (current->header && current->header + current->header_length + 1 >= line - 1) current->header_length = last - current->header;
+				continue;
+			}
+
+			if (*line != '"' && *line != '@') continue;
+
+			// hex data goes on in the next lines after a trailing backslash
+			while (last > line && last[-1] == '\\' && p < end)
+			{
+				eol = (const char*)memchr(p, '\n', end - p);
+				if (!eol) eol = end;
+				last = eol;
+				if (last > p && last[-1] == '\r') --last;
+				p = eol < end ? eol + 1 : end;
+				++line_number;
+			}
+
+			value v;
+			const char* q = line + 1;
+			if (*line == '"' && !unescape(q, last, '"', v.name))
+			{
+				error = L"invalid value name at line " + to_wstring(line_number);
+				return false;
+			}
+			if (q == last || *q != '=')
+			{
+				error = L"expected '=' at line " + to_wstring(line_number);
+				return false;
+			}
+			v.raw = line;
+			v.raw_length = last - line;
+			v.data_offset = q + 1 - line;
+			current->values.push_back(move(v));
+		}
+
+		if (!current) preamble_length = end - preamble;
+		// the preamble ends with its last line break, blank lines before the first key are written again with it
+		while (preamble_length > 0 && (preamble[preamble_length - 1] == '\n' || preamble[preamble_length - 1] == '\r')) --preamble_length;
+		return true;
+	}
+
+	key* registry::locate(HKEY hive, const wstring& path, REGSAM redirection, bool create)
+	{
+		if (!root) return nullptr;
+
+		wstring root_id = lower(root_path);
+		bool machine = root_id == L"\\machine";
+		bool user = root_id.compare(0, 6, L"\\user\\") == 0;
+
+		vector<wstring> names;
+		size_t start = 0;
+		while (start <= path.length())
+		{
+			size_t split = path.find(L'\\', start);
+			if (split == wstring::npos) split = path.length();
+			if (split > start) names.push_back(path.substr(start, split - start));
+			start = split + 1;
+		}
+
+		if (hive == HKEY_LOCAL_MACHINE || hive == HKEY_CLASSES_ROOT)
+		{
+			if (!machine) return nullptr;
+			if (hive == HKEY_CLASSES_ROOT)
+			{
+				names.insert(names.begin(), L"Classes");
+				names.insert(names.begin(), L"Software");
+			}
+			// 32 bit programs see HKLM\Software\Wow6432Node as HKLM\Software, and HKCR\Wow6432Node as HKCR
+			if (win64 && (redirection & KEY_WOW64_32KEY) && names.size() > 0 && lower(names[0]) == L"software")
+			{
+				size_t at = hive == HKEY_CLASSES_ROOT ? 2 : 1;
+				if (names.size() <= at || lower(names[at]) != L"wow6432node") names.insert(names.begin() + at, L"Wow6432Node");
+			}
+		}
+		else if (hive == HKEY_CURRENT_USER)
+		{
+			if (!user) return nullptr;
+		}
+		else if (hive == HKEY_USERS)
+		{
+			if (!user || names.size() == 0 || lower(names[0]) != root_id.substr(6)) return nullptr;
+			names.erase(names.begin());
+		}
+		else return nullptr;
+
+		key* k = root.get();
+		for (auto& name : names)
+		{
+			k = findSubkey(k, name, create);
+			if (!k) return nullptr;
+		}
+		return k;
+	}
+
+	bool registry::deleteProperties(HKEY hive, const wstring& path, const vector<wstring>& properties, REGSAM redirection)
+	{
+		key* k = find(hive, path, redirection);
+		if (!k) return false;
+		for (auto& property : properties)
+		{
+			value* v = findValue(k, property);
+			if (!v) continue;
+			v->deleted = true;
+			k->modified = true;
+		}
+		return true;
+	}
+
+	bool registry::deleteTree(HKEY hive, const wstring& path, REGSAM redirection)
+	{
+		key* k = find(hive, path, redirection);
+		if (!k) return true;
+		key* parent = k->parent;
+		if (!parent) return false;
+
+		parent->subkey_index.erase(lower(k->name));
+		for (auto it = parent->subkeys.begin(); it != parent->subkeys.end(); ++it)
+		{
+			if (it->get() != k) continue;
+			parent->subkeys.erase(it);
+			break;
+		}
+		parent->modified = true;
+		return true;
+	}
+
+	// a key is only given a header if it has values, had one in the file,
+	// or has no subkeys (its path is implied by the subkeys otherwise)
+	static void writeKey(const key* k, const string& path, const string& stamp, string& out, asyncfile::writer& file)
+	{
+		bool has_values = false;
+		for (auto& v : k->values) has_values = has_values || !v.deleted;
+
+		if (k->header || has_values || k->subkeys.empty())
+		{
+			out += '\n';
+			if (k->header && !k->modified)
+			{
+				out.append(k->header, k->header_length);
+				out += '\n';
+			}
+			else
+			{
+				out += '[';
+				out += path;
+				out += stamp;
+				// #class and #link lines stay, #time is replaced
+				const char* p = k->header;
+				const char* end = k->header ? k->header + k->header_length : nullptr;
+				while (p && p < end)
+				{
+					const char* eol = (const char*)memchr(p, '\n', end - p);
+					if (!eol) eol = end;
+					if (*p == '#' && (eol - p < 6 || memcmp(p, "#time=", 6) != 0))
+					{
+						out.append(p, eol - p);
+						out += '\n';
+					}
+					p = eol + 1;
+				}
+			}
+		}
+
+		for (auto& v : k->values)
+		{
+			if (v.deleted) continue;
+			if (v.raw)
+			{
+				out.append(v.raw, v.raw_length);
+				out += '\n';
+			}
+			else encode(v, out);
+		}
+
+		if (out.length() >= (1 << 16))
+		{
+			file.write(out.data(), out.length());
+			out.clear();
+		}
+	}
+
+	struct writeFrame
+	{
+		const key* k = nullptr;
+		size_t next = 0;		// index of the next subkey to write
+		size_t mark = 0;		// length of the path before this key was appended
+	};
+
+	// keys are written depth first like wine does, with an explicit stack
+	static void writeTree(const key* root, const string& stamp, string& out, asyncfile::writer& file)
+	{
+		string path;
+		keyStack<writeFrame> stack;
+		writeFrame& first = stack.push();
+		first.k = root;
+		first.next = 0;
+
+		while (!stack.empty())
+		{
+			writeFrame& top = stack.top();
+			if (top.next == top.k->subkeys.size())
+			{
+				path.resize(top.mark);
+				stack.pop();
+				continue;
+			}
+
+			const key* sub = top.k->subkeys[top.next++].get();
+			size_t mark = path.length();
+			if (top.k->parent) path += "\\\\";
+			escape(sub->name.c_str(), sub->name.length(), "[]", path);
+			writeKey(sub, path, stamp, out, file);
+
+			writeFrame& frame = stack.push();
+			frame.k = sub;
+			frame.next = 0;
+			frame.mark = mark;
+		}
+	}
+
+	bool registry::save(wstring& error)
+	{
+		if (!root)
+		{
+			error = L"no wine registry loaded";
+			return false;
+		}
+
+		// written next to the original and moved over it once complete, the original stays mapped until then
+		wstring temp = file + L".xmlreg";
+		{
+			asyncfile::writer out;
+			if (!out.open(temp, false))
+			{
+				error = L"cannot create " + temp;
+				return false;
+			}
+
+			// "] seconds since 1970\n#time=filetime\n" for every key that changed
+			FILETIME now;
+			GetSystemTimeAsFileTime(&now);
+			unsigned long long ticks = ((unsigned long long)now.dwHighDateTime << 32) | now.dwLowDateTime;
+			char buffer[24];
+			string stamp = "] ";
+			stamp.append(buffer, xrutils::formatDecimal(buffer, (long long)((ticks - 116444736000000000ULL) / 10000000)));
+			stamp += "\n#time=";
+			appendHex(stamp, ticks);
+			stamp += '\n';
+
+			string text(preamble, preamble_length);
+			text += '\n';
+			writeTree(root.get(), stamp, text, out);
+			out.write(text.data(), text.length());
+
+			if (!out.close())
+			{
+				DeleteFileW(temp.c_str());
+				error = L"failed to write " + temp;
+				return false;
+			}
+		}
+
+		root.reset();
+		mapped.reset();
+		if (!MoveFileExW(temp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			error = L"failed to replace " + file + L" with " + temp;
+			return false;
+		}
+		return true;
+	}
+
+	bool keyWriter::open(registry& reg, HKEY hive, const wstring& path, REGSAM redirection)
+	{
+		this->reg = &reg;
+		k = reg.locate(hive, path, redirection, true);
+		return k != nullptr;
+	}
+
+	bool keyWriter::open(const keyWriter& parent, const wstring& name)
+	{
+		reg = parent.reg;
+		k = parent.k ? findSubkey(parent.k, name, true) : nullptr;
+		return k != nullptr;
+	}
+
+	bool keyWriter::exists(const wstring& property)
+	{
+		return k && findValue(k, property) != nullptr;
+	}
+
+	bool keyWriter::write(const winreg::valueRecord& record)
+	{
+		if (!k) return false;
+		k->modified = true;
+
+		value* v = findValue(k, record.name);
+		if (!v)
+		{
+			k->values.push_back(value());
+			k->value_index[lower(record.name)] = k->values.size() - 1;
+			v = &k->values.back();
+			v->name = record.name;
+		}
+		v->raw = nullptr;
+		v->type = record.type;
+		v->data = record.data;
+		return true;
+	}
+
+	bool keyWriter::write(const vector<winreg::valueRecord>& values, vector<size_t>& failed)
+	{
+		failed.clear();
+		for (size_t i = 0; i < values.size(); ++i)
+			if (!write(values[i])) failed.push_back(i);
+		return failed.empty();
+	}
+
+	void keyWriter::close()
+	{
+		k = nullptr;
+	}
+
+	bool keyHandle::open(registry& reg, HKEY hive, const wstring& path, REGSAM redirection)
+	{
+		k = reg.find(hive, path, redirection);
+		return k != nullptr;
+	}
+
+	bool keyHandle::open(const keyHandle& parent, const wstring& name)
+	{
+		k = parent.k ? findSubkey(parent.k, name, false) : nullptr;
+		return k != nullptr;
+	}
+
+	vector<wstring> keyHandle::values() const
+	{
+		vector<wstring> ret;
+		values(ret);
+		return ret;
+	}
+
+	vector<wstring> keyHandle::subkeys() const
+	{
+		vector<wstring> ret;
+		subkeys(ret);
+		return ret;
+	}
+
+	void keyHandle::values(vector<wstring>& names) const
+	{
+		size_t count = 0;
+		if (k) for (auto& v : k->values)
+		{
+			if (v.deleted) continue;
+			if (count < names.size()) names[count] = v.name;
+			else names.push_back(v.name);
+			++count;
+		}
+		names.resize(count);
+	}
+
+	void keyHandle::subkeys(vector<wstring>& names) const
+	{
+		size_t count = 0;
+		if (k) for (auto& sub : k->subkeys)
+		{
+			if (count < names.size()) names[count] = sub->name;
+			else names.push_back(sub->name);
+			++count;
+		}
+		names.resize(count);
+	}
+
+	bool keyHandle::read(const wstring& property, string& result, unsigned long& type) const
+	{
+		value* v = k ? findValue(k, property) : nullptr;
+		if (!v) return false;
+		if (v->raw) return decode(v->raw + v->data_offset, v->raw + v->raw_length, type, result);
+		type = v->type;
+		result = v->data;
+		return true;
+	}
+
+	bool keyHandle::info(unsigned long& subkeys, unsigned long& values) const
+	{
+		if (!k) return false;
+		subkeys = (unsigned long)k->subkeys.size();
+		values = 0;
+		for (auto& v : k->values)
+			if (!v.deleted) ++values;
+		return true;
+	}
+}
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include "registry.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+struct mappedFile;
+
+// wine keeps its registry in text files inside the prefix (system.reg, user.reg, userdef.reg):
+//
+// WINE REGISTRY Version 2
+// ;; All keys relative to \\Machine
+//
+// #arch=win64
+//
+// [Software\\Vendor\\Tool] 1600000000
+// #time=1d68f2a3b4c5d6e
+// @="default"
+// "Path"="c:\\tool"
+// "Count"=dword:00000001
+// "Data"=hex:01,02,03
+// "Expand"=str(2):"%SystemRoot%\\tool"
+//
+// the file is mapped and only the key headers and value names are indexed, untouched values are
+// written back byte for byte and only what was imported or wiped is encoded again
+// wine must not be running, wineserver keeps its own copy of the registry and writes it on exit
+namespace winefile {
+
+	struct key;
+
+	class registry
+	{
+		std::wstring file;
+		std::unique_ptr<mappedFile> mapped;
+		std::unique_ptr<key> root;
+		// the lines before the first key (version, root path and #arch)
+		const char* preamble = nullptr;
+		size_t preamble_length = 0;
+		std::wstring root_path;
+		bool win64 = false;
+
+	public:
+		registry();
+		~registry();
+
+		bool load(const std::wstring& file, std::wstring& error);
+		/* writes the tree back in one sequential pass and releases the file, nothing can be used after this */
+		bool save(std::wstring& error);
+
+		// hives are relative to the root of the file: \Machine holds HKLM and HKCR, \User\<sid> holds HKCU (and HKU\<sid>)
+		// KEY_WOW64_32KEY moves HKLM\Software and HKCR below their Wow6432Node in 64 bit prefixes
+		// nullptr if the key does not exist and 'create' is not set, or if the hive is not in this file
+		key* locate(HKEY hive, const std::wstring& path, REGSAM redirection, bool create);
+		key* find(HKEY hive, const std::wstring& path, REGSAM redirection) { return locate(hive, path, redirection, false); }
+		bool keyExists(HKEY hive, const std::wstring& path, REGSAM redirection) { return find(hive, path, redirection) != nullptr; }
+		bool deleteProperties(HKEY hive, const std::wstring& path, const std::vector<std::wstring>& properties, REGSAM redirection);
+		bool deleteTree(HKEY hive, const std::wstring& path, REGSAM redirection);
+	};
+
+	// same interface as winreg::keyWriter, over a key of the in-memory tree
+	class keyWriter
+	{
+		registry* reg = nullptr;
+		key* k = nullptr;
+
+	public:
+		/* creates the key if it does not exist */
+		bool open(registry& reg, HKEY hive, const std::wstring& path, REGSAM redirection);
+		bool open(const keyWriter& parent, const std::wstring& name);
+		bool exists(const std::wstring& property);
+		bool write(const winreg::valueRecord& value);
+		bool write(const std::vector<winreg::valueRecord>& values, std::vector<size_t>& failed);
+		/* nothing is on disk before registry::save writes the whole file */
+		bool flush() { return true; }
+		void close();
+	};
+
+	// same interface as winreg::keyHandle, over a key of the in-memory tree
+	class keyHandle
+	{
+		key* k = nullptr;
+
+	public:
+		bool open(registry& reg, HKEY hive, const std::wstring& path, REGSAM redirection);
+		bool open(const keyHandle& parent, const std::wstring& name);
+		bool isOpen() const { return k != nullptr; }
+		void close() { k = nullptr; }
+
+		std::vector<std::wstring> values() const;
+		std::vector<std::wstring> subkeys() const;
+		void values(std::vector<std::wstring>& names) const;
+		void subkeys(std::vector<std::wstring>& names) const;
+		bool read(const std::wstring& property, std::string& result, unsigned long& type) const;
+		bool info(unsigned long& subkeys, unsigned long& values) const;
+	};
+}
@@ -19,123 +19,615 @@ freely, subject to the following restrictions:
 */
 
 #include "xmlreg.h"
+#include "log.h"
 #include "registry.h"
+#include "stats.h"
+#include "trace.h"
+#include "regfile.h"
+#include "jsonfile.h"
+#include "document.h"
+#include "winefile.h"
+#include "progress.h"
+#include "keystack.hpp"
 
 #include <pugixml.hpp>
 
+#include <map>
 #include <string>
+#include <vector>
 #include <sstream>
-#include <iostream>
 #include <algorithm>
 
 using namespace std;
 
-int wipeNode(HKEY hive, const wstring& key, REGSAM redirection, pugi::xml_node& node, bool skip_errors)
+// what the xml fragment names under a single key
+struct wipeTarget
 {
-	if (!winreg::keyExists(hive, key, redirection)) return 0;
-	
-	auto properties = winreg::enumerateProperties(hive, key, redirection);
-	auto subkeys = winreg::enumerateSubkeys(hive, key, redirection);
+	wstring name;
+	vector<wstring> values;
+	vector<wipeTarget> subkeys;
+};
 
-	for (pugi::xml_node child : node.children())
+// what will actually be removed from the registry, in execution order
+struct wipePlan
+{
+	vector<pair<wstring, vector<wstring>>> values;	// key, value names
+	vector<wstring> keys;							// keys removed wholesale, children before parents
+};
+
+// the traversal holds an open handle per level and only keeps the path for the plan and messages,
+// this appends 'name' to it and returns the length to restore it to
+static size_t appendKey(wstring& path, const wstring& name)
+{
+	size_t mark = path.length();
+	if (mark > 0) path += L'\\';
+	path += name;
+	return mark;
+}
+
+static bool sameName(const wstring& a, const wstring& b)
+{
+	// registry names are case insensitive
+	return _wcsicmp(a.c_str(), b.c_str()) == 0;
+}
+
+static wipeTarget* findTarget(vector<wipeTarget>& targets, const wstring& name)
+{
+	for (auto& target : targets)
+		if (sameName(target.name, name)) return &target;
+	return nullptr;
+}
+
+// one <key> element of collectTargets
+struct collectFrame
+{
+	pugi::xml_node child;		// next child element to look at
+	wipeTarget* target = nullptr;
+};
+
+void collectTargets(pugi::xml_node& node, wipeTarget& target)
+{
+	keyStack<collectFrame> stack;
+	collectFrame& first = stack.push();
+	first.child = node.first_child();
+	first.target = &target;
+
+	while (!stack.empty())
 	{
+		collectFrame& top = stack.top();
+		if (!top.child)
+		{
+			stack.pop();
+			continue;
+		}
+
+		pugi::xml_node child = top.child;
+		top.child = child.next_sibling();
 		wstring elemname = child.name();
 		if (elemname.length() == 0) continue;
-		bool isKey = elemname == L"key";
-		bool isValue = !isKey && elemname == L"value";
 		wstring name = child.attribute(L"name").value();
-		if (isValue)
+		if (elemname == L"value") top.target->values.push_back(name);
+		else if (elemname == L"key")
 		{
-			if (!winreg::deleteProperty(hive, key, name, redirection))
+			// keys listed more than once in the xml are merged
+			// pushing a sibling may move the targets before it, which are complete by then
+			wipeTarget* sub = findTarget(top.target->subkeys, name);
+			if (!sub)
 			{
-				wcout << "warning: failed to delete " << name << "\n\tfrom ("
-					<< xrutils::redirectionToString(redirection) << ") " << key << endl;
-				if (!skip_errors) return ERROR_XRWIPE_DELETEPROPERTY;
+				top.target->subkeys.push_back(wipeTarget());
+				sub = &top.target->subkeys.back();
+				sub->name = name;
 			}
+			collectFrame& frame = stack.push();
+			frame.child = child.first_child();
+			frame.target = sub;
 		}
-		else if (isKey)
-		{
-			wstring subkey = key + L"\\" + name;
-			int r = wipeNode(hive, subkey, redirection, child, skip_errors);
-			if (r && !skip_errors) return r;
-		}
-		else wcout << "warning: ignoring unknown element " << elemname << endl;
+		else if (xrlog::repeat(xrlog::REPEAT_UNKNOWN_ELEMENT)) xrlog::warning() << "ignoring unknown element " << elemname;
 	}
+}
 
-	properties = winreg::enumerateProperties(hive, key, redirection);
-	bool kill = properties.size() == 0;
-	if (!kill && properties.size() == 1 && properties[0].length() == 0)
+// one key of planKey, which is decided once all its subkeys are
+template<class Handle>
+struct planFrame
+{
+	Handle handle;
+	const Handle* open = nullptr;		// 'handle', or the root the caller opened
+	wipeTarget* target = nullptr;
+	vector<wstring> subkeys;
+	size_t next = 0;					// index of the next subkey to plan
+	size_t mark = 0;					// length of the key before this level appended its name
+	size_t values_mark = 0;				// size of the plan before this key, to drop what is below it when it dies
+	size_t keys_mark = 0;
+	bool kill = false;					// nothing found so far keeps the key alive
+	xrfilter::position position;		// set by the caller before enterPlan
+	xrtrace::keySpan span;
+};
+
+template<class Handle>
+static void enterPlan(planFrame<Handle>& frame, const Handle& handle, const wstring& key, size_t mark, wipeTarget& target, const wipePlan& plan)
+{
+	frame.open = &handle;
+	frame.target = &target;
+	frame.next = 0;
+	frame.mark = mark;
+	frame.values_mark = plan.values.size();
+	frame.keys_mark = plan.keys.size();
+	frame.kill = key.length() > 0;
+	frame.span.begin(key);
+	handle.subkeys(frame.subkeys);
+}
+
+// plans the values of a key whose subkeys are done, true if the whole key can be dropped
+// a key the filter only walks through is never dropped, and values the filter leaves out keep their key alive
+template<class Handle>
+static bool finishPlan(planFrame<Handle>& frame, const wstring& key, REGSAM redirection, const xrfilter::keyFilter& filter,
+	vector<wstring>& properties, wipePlan& plan)
+{
+	const Handle& handle = *frame.open;
+	wipeTarget& target = *frame.target;
+	bool kill = frame.kill && frame.position.included;
+	if (frame.position.included) handle.values(properties);
+	else properties.clear();
+
+	vector<wstring> doomed;
+	string bytes;
+	for (auto& property : properties)
 	{
-		string bytes;
+		bool named = false;
+		for (auto& value : target.values)
+		{
+			if (sameName(value, property))
+			{
+				named = true;
+				break;
+			}
+		}
+
 		unsigned long type;
-		if (winreg::getAsByteArray(hive, key, L"", bytes, type, redirection))
-			kill = bytes.length() == 0;
-		else kill = true;
+		if (named && filter.filtersTypes() && !(handle.read(property, bytes, type) && filter.wantsType(type))) kill = false;
+		else if (named) doomed.push_back(property);
+		else if (property.length() == 0)
+		{
+			// an empty default value does not keep the key alive
+			if (handle.read(L"", bytes, type) && bytes.length() > 0)
+				kill = false;
+		}
+		else kill = false;
 	}
 
 	if (kill)
 	{
-		subkeys = winreg::enumerateSubkeys(hive, key, redirection);
-		kill = subkeys.size() == 0;
+		plan.values.resize(frame.values_mark);
+		plan.keys.resize(frame.keys_mark);
+		plan.keys.push_back(key);
+		return true;
 	}
 
-	if (kill)
+	if (doomed.size() > 0) plan.values.push_back(make_pair(key, move(doomed)));
+	if (key.length() > 0 && xrlog::repeat(xrlog::REPEAT_KEPT_KEY)) xrlog::warning() << "will not delete key\n\t(" << xrutils::redirectionToString(redirection) << ") " << key
+		<< "\n\tbecause it has contents that are not defined in xml";
+	return false;
+}
+
+// reads the current state of 'handle' (open on 'key') and appends to 'plan' what must be removed
+// returns true if the whole key can be dropped, in which case nothing below it is left in the plan
+// keys are decided after their subkeys, depth first with an explicit stack
+// 'position' is where 'key' is in 'filter', subkeys it leaves out are not opened and keep their parent alive
+// 'Handle' is winreg::keyHandle or winefile::keyHandle, they have the same interface
+template<class Handle>
+static bool planKey(const Handle& handle, wstring& key, REGSAM redirection, wipeTarget& target,
+	const xrfilter::keyFilter& filter, const xrfilter::position& position, wipePlan& plan)
+{
+	keyStack<planFrame<Handle>> stack;
+	vector<wstring> properties;
+	planFrame<Handle>& first = stack.push();
+	first.position = position;
+	enterPlan(first, handle, key, key.length(), target, plan);
+
+	bool killed = false;
+	while (!stack.empty())
+	{
+		planFrame<Handle>& top = stack.top();
+		if (top.next == top.subkeys.size())
+		{
+			killed = finishPlan(top, key, redirection, filter, properties, plan);
+			top.span.end();
+			top.handle.close();
+			key.resize(top.mark);
+			stack.pop();
+			if (!killed && !stack.empty()) stack.top().kill = false;
+			continue;
+		}
+
+		const wstring& subkey = top.subkeys[top.next++];
+		wipeTarget* sub = findTarget(top.target->subkeys, subkey);
+		if (!sub)
+		{
+			top.kill = false;
+			continue;
+		}
+
+		planFrame<Handle>& child = stack.push();
+		if (!filter.enter(top.position, subkey, child.position))
+		{
+			stack.pop();
+			top.kill = false;
+			continue;
+		}
+
+		size_t mark = appendKey(key, subkey);
+		if (!child.handle.open(*top.open, subkey))
+		{
+			stack.pop();
+			key.resize(mark);
+			top.kill = false;
+			continue;
+		}
+		enterPlan(child, child.handle, key, mark, *sub, plan);
+	}
+	return killed;
+}
+
+// opens the top of a wipe from its hive, planKey goes on from there
+static void planRoot(HKEY hive, wstring key, REGSAM redirection, wipeTarget& target,
+	const xrfilter::keyFilter& filter, const xrfilter::position& position, wipePlan& plan)
+{
+	winreg::keyHandle handle;
+	if (handle.open(hive, key, KEY_READ | redirection)) planKey(handle, key, redirection, target, filter, position, plan);
+}
+
+// finds or creates the target for a path below 'root'
+static wipeTarget& targetFor(wipeTarget& root, const wstring& path)
+{
+	wipeTarget* current = &root;
+	size_t start = 0;
+	while (start < path.length())
+	{
+		size_t end = path.find(L'\\', start);
+		if (end == wstring::npos) end = path.length();
+		wstring name = path.substr(start, end - start);
+		start = end + 1;
+		if (name.length() == 0) continue;
+
+		wipeTarget* sub = findTarget(current->subkeys, name);
+		if (!sub)
+		{
+			current->subkeys.push_back(wipeTarget());
+			sub = &current->subkeys.back();
+			sub->name = name;
+		}
+		current = sub;
+	}
+	return *current;
+}
+
+void printPlan(const wipePlan& plan, REGSAM redirection)
+{
+	for (auto& entry : plan.values)
+		for (auto& name : entry.second)
+			xrlog::info() << "would delete value " << name << "\n\tfrom ("
+				<< xrutils::redirectionToString(redirection) << ") " << entry.first;
+
+	for (auto& key : plan.keys)
+		xrlog::info() << "would delete key\n\t(" << xrutils::redirectionToString(redirection) << ") " << key;
+}
+
+// executePlan deletes through this, or through a winefile::registry
+struct liveRegistry
+{
+	bool deleteProperties(HKEY hive, const wstring& key, const vector<wstring>& properties, REGSAM redirection)
+	{
+		vector<wstring> failed;
+		if (winreg::deleteProperties(hive, key, properties, redirection, &failed)) return true;
+		for (auto& name : failed) xrlog::warning() << "failed to delete value " << name;
+		return false;
+	}
+	bool deleteTree(HKEY hive, const wstring& key, REGSAM redirection)
+	{
+		return winreg::deleteTree(hive, key, redirection);
+	}
+};
+
+template<class Registry>
+static int executePlan(Registry& registry, HKEY hive, REGSAM redirection, const wipePlan& plan, bool skip_errors)
+{
+	// the plan is made before anything is deleted, so its size is the total
+	xrprogress::display progress(L"wiping", xrprogress::MEASURE_ITEMS);
+	if (xrprogress::enabled())
+	{
+		unsigned long long values = 0;
+		for (auto& entry : plan.values) values += entry.second.size();
+		xrprogress::addTotal(plan.keys.size(), values);
+		xrprogress::totalKnown();
+	}
+
+	for (auto& entry : plan.values)
 	{
-		if (!winreg::killKey(hive, key, redirection))
+		xrprogress::addValues(entry.second.size());
+		xrtrace::keySpan span(entry.first);
+		if (!registry.deleteProperties(hive, entry.first, entry.second, redirection))
 		{
-			wcout << "warning: failed to delete empty key\n\tfrom ("
-				<< xrutils::redirectionToString(redirection) << ") " << key << endl;
+			xrlog::warning() << "failed to delete " << entry.second.size() << " value(s)\n\tfrom ("
+				<< xrutils::redirectionToString(redirection) << ") " << entry.first;
+			if (!skip_errors) return ERROR_XRWIPE_DELETEPROPERTY;
+		}
+	}
+
+	for (auto& key : plan.keys)
+	{
+		xrprogress::addKeys(1);
+		xrtrace::keySpan span(key);
+		if (!registry.deleteTree(hive, key, redirection))
+		{
+			xrlog::warning() << "failed to delete empty key\n\tfrom ("
+				<< xrutils::redirectionToString(redirection) << ") " << key;
 			if (!skip_errors) return ERROR_XRWIPE_DELETEKEY;
 		}
 	}
-	else wcout << "warning: will not delete key\n\t(" << xrutils::redirectionToString(redirection) << ") " << key
-		<< "\n\tbecause it has contents that are not defined in xml" << endl;
 
 	return 0;
 }
 
-int wipe_reg(wstring file, bool unattended, bool skip_errors)
+int wipe_reg(wstring file, bool unattended, bool skip_errors, bool dry_run)
+{
+	return wipe_reg(file, fragment_target(), xrfilter::keyFilter(), unattended, skip_errors, dry_run);
+}
+
+// reads the location and the targets of an xml fragment, 'target' overrides its attributes
+static int readTargets(const pugi::xml_document& doc, const fragment_target& target, wipeTarget& wanted, HKEY& hive, wstring& key, REGSAM& redirection)
+{
+	auto root = doc.first_element_by_path(L"fragment");
+	if (root.name() != wstring(L"fragment"))
+	{
+		xrlog::error() << "root element is not 'fragment'";
+		return ERROR_XRWIPE_XMLSCHEMA;
+	}
+
+	wstring ahive = root.attribute(L"hive").value();
+	wstring akey = root.attribute(L"key").value();
+	wstring aredir = root.attribute(L"redirection").value();
+
+	if (ahive.length() == 0 && !target.has_hive)
+		xrlog::info() << "no hive, assuming HKCU";
+
+	key = target.has_key ? target.key : akey;
+	hive = target.has_hive ? target.hive : xrutils::stringToHive(ahive);
+	redirection = target.has_redirection ? target.redirection : xrutils::stringToRedirection(aredir);
+
+	xrlog::info() << "from ("
+		<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
+		<< L"): " << xrutils::hiveToString(hive) << L":\\" << key;
+
+	wanted.name = key;
+	collectTargets(root, wanted);
+	return 0;
+}
+
+static int readFragment(const wstring& file, const fragment_target& target, wipeTarget& wanted, HKEY& hive, wstring& key, REGSAM& redirection)
 {
-	std::wcout << "wiping from registry items defined in file " << file << std::endl;
+	pugi::xml_document doc;
+	pugi::xml_parse_result parse_result = loadDocument(doc, file);
+	if (parse_result.status != pugi::status_ok)
+	{
+		xrlog::error() << parse_result.description();
+		return ERROR_XRWIPE_PARSEXML;
+	}
+	return readTargets(doc, target, wanted, hive, key, redirection);
+}
+
+int wipe_reg(wstring file, const fragment_target& target, const xrfilter::keyFilter& filter, bool unattended, bool skip_errors, bool dry_run)
+{
+	xrlog::info() << "wiping from registry items defined in file " << file;
 
 	pugi::xml_document doc;
-	auto parse_result = doc.load_file(file.c_str());
-	if (parse_result.status == pugi::status_ok)
+	pugi::xml_parse_result parse_result = loadDocument(doc, file);
+	if (parse_result.status != pugi::status_ok)
+	{
+		xrlog::error() << parse_result.description();
+		return ERROR_XRWIPE_PARSEXML;
+	}
+	return wipe_fragment(doc, target, filter, unattended, skip_errors, dry_run);
+}
+
+int wipe_fragment(const pugi::xml_document& doc, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run)
+{
+	wipeTarget wanted;
+	HKEY hive;
+	wstring key;
+	REGSAM redirection;
+	int r = readTargets(doc, target, wanted, hive, key, redirection);
+	if (r) return r;
+
+	xrfilter::position position;
+	if (!filter.start(position) || !winreg::keyExists(hive, key, redirection)) return 0;
+
+	wipePlan plan;
+	planRoot(hive, key, redirection, wanted, filter, position, plan);
+
+	if (dry_run)
 	{
-		auto root = doc.first_element_by_path(L"fragment");
-		bool isFragment = root.name() == wstring(L"fragment");
+		printPlan(plan, redirection);
+		return 0;
+	}
 
-		if (isFragment)
-		{
-			wstring ahive = root.attribute(L"hive").value();
-			wstring akey = root.attribute(L"key").value();
-			wstring aredir = root.attribute(L"redirection").value();
+	liveRegistry live;
+	return executePlan(live, hive, redirection, plan, skip_errors);
+}
+
+int wipe_wine(wstring file, wstring wine_file, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run)
+{
+	xrlog::info() << "wiping from wine registry " << wine_file << " items defined in file " << file;
 
-			if (ahive.length() == 0)
-				wcout << "no hive, assuming HKCU" << endl;
+	wipeTarget wanted;
+	HKEY hive;
+	wstring key;
+	REGSAM redirection;
+	int r = readFragment(file, target, wanted, hive, key, redirection);
+	if (r) return r;
+	xrfilter::position position;
+	if (!filter.start(position)) return 0;
 
-			wstring key = akey;
-			HKEY hive = xrutils::stringToHive(ahive);
-			REGSAM redirection = xrutils::stringToRedirection(aredir);
+	winefile::registry registry;
+	wstring error;
+	if (!registry.load(wine_file, error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_LOAD;
+	}
 
-			wcout << "from ("
-				<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
-				<< L"): " << xrutils::hiveToString(hive) << L":\\" << key << endl;
+	winefile::keyHandle handle;
+	if (!handle.open(registry, hive, key, redirection)) return 0;
 
-			if (!winreg::keyExists(hive, key, redirection)) return 0;
+	wipePlan plan;
+	planKey(handle, key, redirection, wanted, filter, position, plan);
 
-			return wipeNode(hive, key, redirection, root, skip_errors);
-		}
+	if (dry_run)
+	{
+		printPlan(plan, redirection);
+		return 0;
+	}
+
+	// the file is only written if the whole plan could be applied
+	r = executePlan(registry, hive, redirection, plan, skip_errors);
+	if (r) return r;
+	if (!registry.save(error))
+	{
+		xrlog::error() << error;
+		return ERROR_XRWINE_SAVE;
+	}
+	return 0;
+}
+
+int wipe_regfile(wstring file, REGSAM redirection, const xrfilter::keyFilter& filter, bool skip_errors, bool dry_run)
+{
+	xrlog::info() << "wiping from registry items defined in file " << file;
+
+	// every key and value listed in the file is a wipe target, deletion lines have nothing left to wipe
+	map<HKEY, wipeTarget> roots;
+	wstring error;
+	int r = regfile::parse(file, [&roots](const regfile::record& rec) {
+		if (rec.kind == regfile::RECORD_KEY) targetFor(roots[rec.hive], rec.key);
+		else if (rec.kind == regfile::RECORD_VALUE) targetFor(roots[rec.hive], rec.key).values.push_back(rec.name);
+		return 0;
+	}, error);
+
+	if (r == -1)
+	{
+		xrlog::error() << error;
+		return ERROR_XRWIPE_PARSEREG;
+	}
+
+	for (auto& root : roots)
+	{
+		HKEY hive = root.first;
+		wipePlan plan;
+		xrfilter::position position;
+		// .reg files name their keys from the hive, so the patterns are matched from there
+		for (auto& top : root.second.subkeys)
+			if (filter.locate(top.name, position))
+				planRoot(hive, top.name, redirection, top, filter, position, plan);
+
+		if (dry_run) printPlan(plan, redirection);
 		else
 		{
-			wcout << "error: root element is not 'fragment'" << endl;
-			return ERROR_XRWIPE_XMLSCHEMA;
+			liveRegistry live;
+			r = executePlan(live, hive, redirection, plan, skip_errors);
+			if (r && !skip_errors) return r;
 		}
 	}
-	else
+
+	return 0;
+}
+// builds the same target tree as collectTargets, while the json file is read
+class jsonTargets : public jsonfile::fragmentVisitor
+{
+	// parents are never appended to while their children are open, so these stay valid
+	vector<wipeTarget*> stack;
+
+public:
+	wipeTarget root;
+	wstring hive, key, redirection;
+
+	int location(const wstring& ahive, const wstring& akey, const wstring& aredir) override
+	{
+		hive = ahive;
+		key = akey;
+		redirection = aredir;
+		stack.push_back(&root);
+		return 0;
+	}
+
+	int enterKey(const wstring& name) override
 	{
-		wcout << "error: " << parse_result.description() << endl;
-		return ERROR_XRWIPE_PARSEXML;
+		wipeTarget* parent = stack.back();
+		wipeTarget* sub = findTarget(parent->subkeys, name);
+		if (!sub)
+		{
+			parent->subkeys.push_back(wipeTarget());
+			sub = &parent->subkeys.back();
+			sub->name = name;
+		}
+		stack.push_back(sub);
+		return 0;
+	}
+
+	int leaveKey() override
+	{
+		stack.pop_back();
+		return 0;
+	}
+
+	int value(const wstring& name, const wstring&, const wstring&, const vector<wstring>&) override
+	{
+		stack.back()->values.push_back(name);
+		return 0;
+	}
+};
+
+int wipe_jsonfile(wstring file, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run)
+{
+	xrlog::info() << "wiping from registry items defined in file " << file;
+
+	jsonTargets wanted;
+	wstring error;
+	int r;
+	{
+		xrstats::timer t(xrstats::PHASE_PARSE);
+		r = jsonfile::parseFragment(file, wanted, error);
+	}
+	if (r)
+	{
+		xrlog::error() << error;
+		return ERROR_XRWIPE_PARSEJSON;
 	}
-	return ERROR_XRGENERAL_FAILURE;
-}
\ No newline at end of file
+
+	if (wanted.hive.length() == 0 && !target.has_hive)
+		xrlog::info() << "no hive, assuming HKCU";
+
+	wstring key = target.has_key ? target.key : wanted.key;
+	HKEY hive = target.has_hive ? target.hive : xrutils::stringToHive(wanted.hive);
+	REGSAM redirection = target.has_redirection ? target.redirection : xrutils::stringToRedirection(wanted.redirection);
+
+	xrlog::info() << "from ("
+		<< (redirection ? xrutils::redirectionToString(redirection) : L"0")
+		<< L"): " << xrutils::hiveToString(hive) << L":\\" << key;
+
+	xrfilter::position position;
+	if (!filter.start(position) || !winreg::keyExists(hive, key, redirection)) return 0;
+
+	wanted.root.name = key;
+	wipePlan plan;
+	planRoot(hive, key, redirection, wanted.root, filter, position, plan);
+
+	if (dry_run)
+	{
+		printPlan(plan, redirection);
+		return 0;
+	}
+
+	liveRegistry live;
+	return executePlan(live, hive, redirection, plan, skip_errors);
+}
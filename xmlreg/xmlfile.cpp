@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "xmlfile.h"
+#include "xmlreg.h"
+
+using namespace std;
+
+namespace xmlfile {
+
+	bool writer::open(const wstring& path, bool compress)
+	{
+		if (!out.open(path, compress)) return false;
+		buffer.reserve(1 << 16);
+		buffer = "<?xml version=\"1.0\" encoding=\"utf-8\"?>";
+		return true;
+	}
+
+	bool writer::open(const function<bool(const void*, size_t)>& sink)
+	{
+		if (!sink) return false;
+		this->sink = sink;
+		buffer.reserve(1 << 16);
+		buffer = "<?xml version=\"1.0\" encoding=\"utf-8\"?>";
+		return true;
+	}
+
+	void writer::flush()
+	{
+		if (!sink) out.write(buffer.data(), buffer.size());
+		else if (!failed && !sink(buffer.data(), buffer.size())) failed = true;
+		buffer.clear();
+	}
+
+	void writer::indent(size_t depth)
+	{
+		buffer += '\n';
+		buffer.append(depth, '\t');
+		if (buffer.size() >= (1 << 15)) flush();
+	}
+
+	// same escaping as pugi: &, < and control characters everywhere, > in text, " in attributes,
+	// and tabs and line breaks only in attributes
+	void writer::escaped(const wstring& text, bool attribute)
+	{
+		for (size_t i = 0; i < text.length(); ++i)
+		{
+			unsigned c = text[i];
+			if (c == '&') buffer += "&amp;";
+			else if (c == '<') buffer += "&lt;";
+			else if (c == '>' && !attribute) buffer += "&gt;";
+			else if (c == '"' && attribute) buffer += "&quot;";
+			else if (c < 0x20 && (attribute || (c != '\t' && c != '\r' && c != '\n')))
+			{
+				buffer += "&#";
+				buffer += (char)('0' + c / 10);
+				buffer += (char)('0' + c % 10);
+				buffer += ';';
+			}
+			else if (c < 0x80) buffer += (char)c;
+			else
+			{
+				if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.length() && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+					c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
+
+				if (c < 0x800)
+				{
+					buffer += (char)(0xC0 | (c >> 6));
+				}
+				else if (c < 0x10000)
+				{
+					buffer += (char)(0xE0 | (c >> 12));
+					buffer += (char)(0x80 | ((c >> 6) & 0x3F));
+				}
+				else
+				{
+					buffer += (char)(0xF0 | (c >> 18));
+					buffer += (char)(0x80 | ((c >> 12) & 0x3F));
+					buffer += (char)(0x80 | ((c >> 6) & 0x3F));
+				}
+				buffer += (char)(0x80 | (c & 0x3F));
+			}
+		}
+	}
+
+	void writer::start(const wstring& name)
+	{
+		if (in_start_tag) buffer += '>';
+		indent(elements.size());
+		buffer += '<';
+		escaped(name, false);
+		elements.push_back(name);
+		in_start_tag = true;
+		has_text = false;
+	}
+
+	void writer::attribute(const wstring& name, const wstring& value)
+	{
+		buffer += ' ';
+		escaped(name, false);
+		buffer += "=\"";
+		escaped(value, true);
+		buffer += '"';
+	}
+
+	void writer::text(const wstring& value)
+	{
+		if (in_start_tag) buffer += '>';
+		in_start_tag = false;
+		escaped(value, false);
+		has_text = true;
+	}
+
+	void writer::integer(long long value)
+	{
+		if (in_start_tag) buffer += '>';
+		in_start_tag = false;
+		char digits[24];
+		buffer.append(digits, xrutils::formatDecimal(digits, value));
+		has_text = true;
+	}
+
+	void writer::hexadecimal(unsigned long long value, int digits)
+	{
+		if (in_start_tag) buffer += '>';
+		in_start_tag = false;
+		char text[24];
+		buffer.append(text, xrutils::formatHex(text, value, digits));
+		has_text = true;
+	}
+
+	void writer::end()
+	{
+		if (in_start_tag) buffer += " />";
+		else
+		{
+			if (!has_text) indent(elements.size() - 1);
+			buffer += "</";
+			escaped(elements.back(), false);
+			buffer += '>';
+		}
+		elements.pop_back();
+		in_start_tag = false;
+		has_text = false;
+	}
+
+	bool writer::close()
+	{
+		buffer += '\n';
+		flush();
+		if (sink) return !failed;
+		return out.close();
+	}
+}
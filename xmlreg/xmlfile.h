@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2020 Alex Vargas
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "asyncfile.h"
+
+namespace xmlfile {
+
+	// streams utf-8 xml formatted exactly like pugi's save() with "\t" indentation,
+	// so export can write while it is still reading the registry instead of building a document first
+	class writer
+	{
+		asyncfile::writer out;
+		// set by the second open(), takes the text instead of 'out'
+		std::function<bool(const void*, size_t)> sink;
+		bool failed = false;
+		std::string buffer;
+		std::vector<std::wstring> elements;
+		bool in_start_tag = false;		// '>' not written yet, an element without content is closed with " />"
+		bool has_text = false;			// the current element has inline text, its end tag goes on the same line
+
+		void escaped(const std::wstring& text, bool attribute);
+		void indent(size_t depth);
+		void flush();
+
+	public:
+		// creates the file (gzip compressed if 'compress' is set) and writes the xml declaration
+		bool open(const std::wstring& path, bool compress);
+		// hands the text to 'sink' in chunks instead, from the thread that writes, until it returns false
+		bool open(const std::function<bool(const void*, size_t)>& sink);
+		void start(const std::wstring& name);
+		void attribute(const std::wstring& name, const std::wstring& value);
+		// the only content of the current element
+		void text(const std::wstring& value);
+		// numbers as the only content, formatted straight into the output buffer
+		void integer(long long value);
+		void hexadecimal(unsigned long long value, int digits);
+		void end();
+		bool close();
+	};
+}
@@ -19,7 +19,10 @@ freely, subject to the following restrictions:
 */
 
 #include "xmlreg.h"
-#include "registry.h"
+#include "libxmlreg.h"
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
 #include "arguments.hpp"
 #include "version.h"
 
@@ -47,43 +50,82 @@ int wmain(int argc, wchar_t* argv[])
 {
 	try
 	{
-		wcout << LOGO_STR << endl << endl;
-
 		disallowWow();
 
 		arguments args(argc, argv);
+		libxmlreg::verbosity verbosity = libxmlreg::VERBOSITY_NORMAL;
+		if (args.getQuiet()) verbosity = libxmlreg::VERBOSITY_QUIET;
+		else if (args.getVerbose()) verbosity = libxmlreg::VERBOSITY_VERBOSE;
+		libxmlreg::setLogging(verbosity, args.getLogJson());
+
+		xrlog::info() << LOGO_STR;
+		for (auto& warning : args.getWarnings()) xrlog::warning() << warning;
 		if (args.getError())
 		{
-			wcout << "error: " << xrutils::errorToString(args.getError()) << endl;
+			xrlog::error() << xrutils::errorToString(args.getError());
+			xrlog::flush();
 			return args.getError();
 		}
 
-		int xrerror_code = false;
-
-		if (args.isImport()) xrerror_code = import_reg(args.getFile(), args.getReplacements(),
-			args.getComDll(), args.getUnattended(), args.getSkipErrors());
-
-		else if (args.isExport())
-			xrerror_code = export_reg(args.getFile(),
-				args.getInputHive(), args.getInputKey(), args.getInputRedirection(),
-				args.getOutputHive(), args.getOutputKey(), args.getOutputRedirection(),
-				args.getUnattended(), args.getSkipErrors());
-
-		else if (args.isWipe()) xrerror_code = wipe_reg(args.getFile(), args.getUnattended(), args.getSkipErrors());
-
-		if (!xrerror_code)
+		if (args.getStats()) xrstats::enable();
+		if (args.getProgress()) libxmlreg::enableProgress();
+		if (args.getTraceFile().length() > 0) xrtrace::enable(args.getTraceFile(), args.getTraceDepth());
+
+		libxmlreg::options opts;
+		opts.replacements = args.getReplacements();
+		opts.com_dll = args.getComDll();
+		opts.target.redirection = args.getOutputRedirection();
+		opts.format = args.getFormat();
+		opts.wine_file = args.getWineFile();
+		opts.unattended = args.getUnattended();
+		opts.skip_errors = args.getSkipErrors();
+		opts.dry_run = args.getDryRun();
+		opts.hex_numbers = args.getHexNumbers();
+		opts.include = args.getIncludes();
+		opts.exclude = args.getExcludes();
+		opts.value_types = args.getValueTypes();
+		opts.journal = args.getJournalFile();
+		opts.resume = args.getResume();
+		opts.force_resume = args.getForceResume();
+		opts.undo_log = args.getUndoFile();
+		opts.first_mismatch = args.getFirstMismatch();
+
+		libxmlreg::location input, output;
+		input.hive = args.getInputHive();
+		input.key = args.getInputKey();
+		input.redirection = args.getInputRedirection();
+		output.hive = args.getOutputHive();
+		output.key = args.getOutputKey();
+		output.redirection = args.getOutputRedirection();
+
+		libxmlreg::result result;
+		if (args.isImport()) result = libxmlreg::importFile(args.getFile(), opts);
+		else if (args.isExport()) result = libxmlreg::exportFile(args.getFile(), input, output, opts);
+		else if (args.isWipe()) result = libxmlreg::wipeFile(args.getFile(), opts);
+		else if (args.isBatch()) result = libxmlreg::batchFile(args.getFile(), opts);
+		else if (args.isServe()) result = libxmlreg::serve(args.getFile(), opts);
+		else if (args.isRollback()) result = libxmlreg::rollbackFile(args.getFile(), opts);
+		else if (args.isVerify()) result = libxmlreg::verifyFile(args.getFile(), opts);
+		else if (args.isCopy()) result = libxmlreg::copyKeys(input, output, opts);
+		int xrerror_code = result.code;
+
+		if (args.getStats())
 		{
-			wcout << "completed successfully" << endl;
-			return 0;
+			xrlog::flush();
+			wcout << xrstats::summary() << endl;
 		}
-		
-		wcout << "failed: " << xrutils::errorToString(xrerror_code) << endl;
+		if (!xrtrace::write()) xrlog::warning() << "failed to write trace file " << args.getTraceFile();
+		else if (xrtrace::dropped())
+			xrlog::warning() << "trace buffer full, " << xrtrace::dropped() << " event(s) were not recorded (lower --trace-depth)";
 
+		if (!xrerror_code) xrlog::info() << "completed successfully";
+		else xrlog::error() << "failed: " << result.error;
+		xrlog::flush();
 		return xrerror_code;
-		
 	}
 	catch (exception& ex)
 	{
+		xrlog::flush();
 		wcout << "fatal: " << ex.what() << endl << endl;
 	}
 
@@ -21,10 +21,18 @@ freely, subject to the following restrictions:
 #pragma once
 
 #include <map>
+#include <regex>
 #include <string>
+#include <vector>
+#include <functional>
 
 #include <windows.h>
 
+#include "filter.h"
+
+namespace pugi { class xml_document; }
+namespace libxmlreg { class visitor; }
+
 #define EXCEPTION_CODE(error_code) system_error(error_code, generic_category())
 
 #define ERROR_XRUSAGE_TOO_FEW_ARGUMENTS					1
@@ -35,6 +43,11 @@ freely, subject to the following restrictions:
 #define ERROR_XRUSAGE_NO_INPUT_HIVE						6
 #define ERROR_XRUSAGE_NO_OUTPUT_HIVE					7
 #define ERROR_XRUSAGE_NO_REPLACE_AFTER_MATCH			8
+#define ERROR_XRUSAGE_WINE_FORMAT						9
+#define ERROR_XRUSAGE_VALUE_TYPE						10
+#define ERROR_XRUSAGE_RESUME_WITHOUT_JOURNAL			11
+#define ERROR_XRUSAGE_VERIFY_FORMAT						12
+#define ERROR_XRUSAGE_COPY_KEYS							13
 
 #define ERROR_XRGENERAL_FAILURE			100
 
@@ -42,27 +55,157 @@ freely, subject to the following restrictions:
 #define ERROR_XRIMPORT_XMLSCHEMA		201
 #define ERROR_XRIMPORT_CREATEKEY		202
 #define ERROR_XRIMPORT_SETPROPERTY		203
+#define ERROR_XRIMPORT_PARSEREG			204
+#define ERROR_XRIMPORT_DELETE			205
+#define ERROR_XRIMPORT_PARSEJSON		206
+#define ERROR_XRIMPORT_JOURNAL			207
+#define ERROR_XRIMPORT_UNDO				208
 
 #define ERROR_XREXPORT_NOKEY			200
 #define ERROR_XREXPORT_FILEISDIRECTORY	201
 #define ERROR_XREXPORT_DONTOVERWRITE	202
 #define ERROR_XREXPORT_WRITEOUTPUT1		203
 #define ERROR_XREXPORT_WRITEOUTPUT2		204
+#define ERROR_XREXPORT_READVALUE		205
 
 #define ERROR_XRWIPE_PARSEXML			400
 #define ERROR_XRWIPE_XMLSCHEMA			401
 #define ERROR_XRWIPE_DELETEKEY			402
 #define ERROR_XRWIPE_DELETEPROPERTY		403
+#define ERROR_XRWIPE_PARSEREG			404
+#define ERROR_XRWIPE_PARSEJSON			405
+
+#define ERROR_XRBATCH_PARSEXML			500
+#define ERROR_XRBATCH_XMLSCHEMA			501
+#define ERROR_XRBATCH_JOBFAILED			502
+
+#define ERROR_XRSERVE_CREATEPIPE		600
+#define ERROR_XRSERVE_BADREQUEST		601
+#define ERROR_XRSERVE_JOBFAILED			602
+
+#define ERROR_XRWINE_LOAD				700
+#define ERROR_XRWINE_SAVE				701
+
+#define ERROR_XRROLLBACK_READLOG		800
+#define ERROR_XRROLLBACK_RESTORE		801
+
+#define ERROR_XRVERIFY_PARSEXML			900
+#define ERROR_XRVERIFY_XMLSCHEMA		901
+#define ERROR_XRVERIFY_MISMATCH			902
+
+#define ERROR_XRCOPY_NOKEY				1000
+#define ERROR_XRCOPY_NESTED				1001
+#define ERROR_XRCOPY_CREATEKEY			1002
+#define ERROR_XRCOPY_READVALUE			1003
+#define ERROR_XRCOPY_WRITEVALUE			1004
+
+typedef std::vector<std::pair<std::wregex, std::wstring>> replacement_rules;
+
+// overrides the location stored in the <fragment> element of an input file
+struct fragment_target
+{
+	bool has_hive = false;
+	bool has_key = false;
+	bool has_redirection = false;
+	HKEY hive = HKEY_CURRENT_USER;
+	std::wstring key;
+	REGSAM redirection = 0;
+};
+
+// --journal, --resume and --undo-log, what an import into the registry records as it goes
+struct journal_options
+{
+	std::wstring file;		// no journal when empty
+	bool resume = false;
+	bool force_resume = false;	// resume even if the input no longer has the key of the last checkpoint
+	std::wstring undo_file;	// no undo log when empty, appended to with 'resume'
+};
+
+replacement_rules compile_replacements(std::map<std::wstring, std::wstring> replacements, std::wstring com_dll);
+// the type and bytes an import writes for the text form of a value (a multi-string is 'list'), after the replacements
+DWORD encode_value(const replacement_rules& rules, const std::wstring& type, std::wstring text, const std::vector<std::wstring>& list,
+	std::string& data);
+// the same replacements on the bytes of a value that is copied as is, only strings are changed
+void replace_value(const replacement_rules& rules, DWORD type, std::string& data);
 
 int import_reg(std::wstring file, std::map<std::wstring, std::wstring> replacements,
 	std::wstring com_dll, bool unattended, bool skip_errors);
+int import_reg(std::wstring file, const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+	const journal_options& journal, bool unattended, bool skip_errors);
 
-int wipe_reg(std::wstring file, bool unattended, bool skip_errors);
+int wipe_reg(std::wstring file, bool unattended, bool skip_errors, bool dry_run);
+int wipe_reg(std::wstring file, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run);
 
 int export_reg(std::wstring file,
 	HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
 	HKEY output_hive, std::wstring output_key, REGSAM output_redirection,
-	bool unattended, bool skip_errors);
+	bool unattended, bool skip_errors, bool hex_numbers = false);
+int export_reg(std::wstring file,
+	HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
+	HKEY output_hive, std::wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors, bool hex_numbers);
+
+// regedit (.reg) files
+int import_regfile(std::wstring file, const replacement_rules& rules, REGSAM redirection, const xrfilter::keyFilter& filter,
+	const journal_options& journal, bool skip_errors);
+int wipe_regfile(std::wstring file, REGSAM redirection, const xrfilter::keyFilter& filter, bool skip_errors, bool dry_run);
+int export_regfile(std::wstring file,
+	HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
+	HKEY output_hive, std::wstring output_key,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors);
+
+// json fragments, same layout as the xml <fragment>
+int import_jsonfile(std::wstring file, const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+	const journal_options& journal, bool unattended, bool skip_errors);
+int wipe_jsonfile(std::wstring file, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run);
+int export_jsonfile(std::wstring file,
+	HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
+	HKEY output_hive, std::wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors);
+
+// xml fragments applied to and read from a wine registry file (system.reg, user.reg) instead of the registry
+int import_wine(std::wstring file, std::wstring wine_file, const replacement_rules& rules, const fragment_target& target,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors);
+int wipe_wine(std::wstring file, std::wstring wine_file, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run);
+int export_wine(std::wstring file, std::wstring wine_file,
+	HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
+	HKEY output_hive, std::wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors, bool hex_numbers);
+
+// documents and outputs that are not files, for libxmlreg
+int import_fragment(const pugi::xml_document& doc, const replacement_rules& rules, const fragment_target& target,
+	const xrfilter::keyFilter& filter, bool unattended, bool skip_errors);
+int wipe_fragment(const pugi::xml_document& doc, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool unattended, bool skip_errors, bool dry_run);
+int export_stream(const std::function<bool(const void*, size_t)>& sink,
+	HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
+	HKEY output_hive, std::wstring output_key, REGSAM output_redirection,
+	const xrfilter::keyFilter& filter, bool skip_errors, bool hex_numbers);
+int export_visit(libxmlreg::visitor& visitor, HKEY input_hive, std::wstring input_key, REGSAM input_redirection,
+	const xrfilter::keyFilter& filter, bool skip_errors);
+
+// compares the registry with the keys and values an xml fragment names, without writing anything
+// the subtrees below the fragment key are checked on a few threads, 'first_mismatch' stops at the first difference
+int verify_reg(std::wstring file, const replacement_rules& rules, const fragment_target& target, const xrfilter::keyFilter& filter,
+	bool first_mismatch);
+
+// copies a tree to another key, view or hive without going through a file
+// RegCopyTreeW does the work when the tree goes over unchanged within one view, otherwise it is copied key by key
+int copy_reg(HKEY src_hive, std::wstring src_key, REGSAM src_redirection, HKEY dst_hive, std::wstring dst_key, REGSAM dst_redirection,
+	const replacement_rules& rules, const xrfilter::keyFilter& filter, bool unattended, bool skip_errors);
+int copy_wine(std::wstring wine_file, HKEY src_hive, std::wstring src_key, REGSAM src_redirection,
+	HKEY dst_hive, std::wstring dst_key, REGSAM dst_redirection,
+	const replacement_rules& rules, const xrfilter::keyFilter& filter, bool unattended, bool skip_errors);
+
+// puts back what an import recorded in its --undo-log, newest change first
+int rollback_reg(std::wstring undo_file, bool skip_errors, bool dry_run);
+
+int batch_reg(std::wstring file, bool unattended, bool skip_errors, bool dry_run);
+
+int serve_reg(std::wstring pipe_name, bool skip_errors);
 
 namespace xrutils {
 	bool isWindows64();
@@ -76,5 +219,11 @@ namespace xrutils {
 	REGSAM stringToRedirection(std::wstring str);
 	std::wstring propTypeToString(DWORD type);
 	DWORD stringToPropType(std::wstring str);
+	// write digits into 'out' without allocating and return how many were written ('out' must hold 20 characters)
+	size_t formatDecimal(char* out, long long value);
+	size_t formatHex(char* out, unsigned long long value, int digits);
+	// decimal with an optional sign, or hexadecimal with the 0x prefix, wrapping around like an unsigned cast
+	// returns false (and sets 'value' to 0) if 'text' is not a number
+	bool parseInteger(const wchar_t* text, long long& value);
 	std::wstring errorToString(int error);
 }
\ No newline at end of file